@@ -223,6 +223,7 @@ QString Builtins::checkArgs(quint8 builtin, ExpList& args, Type** ret, AstModel*
         break;
     case Builtin::STRLEN:
         expectingNArgs(args,1);
+        *ret = mdl->getType(Type::UINT32);
         break;
     case Builtin::UNSIGNED:
         expectingNArgs(args,1);
@@ -713,6 +714,28 @@ void Builtins::LEN(int nArgs)
     ev->stack.push_back(res);
 }
 
+void Builtins::STRLEN(int nArgs)
+{
+    Value what = ev->stack.takeLast();
+    if( what.type == 0 || !what.type->isText() || what.type->kind == Type::CHAR )
+    {
+        ev->err = "expecting a string or char array argument";
+        return;
+    }
+    Value res;
+    res.type = ev->mdl->getType(Type::UINT32);
+    if( what.isConst() )
+    {
+        res.mode = Value::Const;
+        res.val = (quint32)strlen(what.val.toByteArray().constData());
+    }else
+    {
+        ev->out->call_(coreName("strlen"),1,true);
+        res.mode = Value::Val;
+    }
+    ev->stack.push_back(res);
+}
+
 void Builtins::PRINT(int nArgs, bool ln)
 {
     if( nArgs < 1 || ev->stack.back().type == 0 ||
@@ -865,6 +888,11 @@ void Builtins::callBuiltin(quint8 builtin, int nArgs)
         LEN(nArgs);
         handleStack = false;
         break;
+    case Builtin::STRLEN:
+        checkNumOfActuals(nArgs, 1);
+        STRLEN(nArgs);
+        handleStack = false;
+        break;
     case Builtin::ASSERT:
         checkNumOfActuals(nArgs, 3);
         ASSERT(nArgs);
@@ -42,6 +42,7 @@ protected:
     void INC(int nArgs);
     void DEC(int nArgs);
     void LEN(int nArgs);
+    void STRLEN(int nArgs);
     void incdec(int nArgs, bool inc);
     void ASSERT(int nArgs);
     void bitarith(int op);
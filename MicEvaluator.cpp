@@ -1666,6 +1666,9 @@ bool Evaluator::recursiveRun(Expression* e)
                     return false;
                 if( i < formals.size() )
                     prepareRhs(formals[i]->getType());
+                else if( e->lhs->kind == Expression::Builtin && e->lhs->val.toInt() == Builtin::STRLEN &&
+                         args[i]->isConst() )
+                    ; // folded by Builtins::STRLEN, as Expression::isConst promises
                 else
                     assureTopOnMilStack(); // effects builtin args and variable args
             }
@@ -0,0 +1,186 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Micron language project.
+*
+* The following is the license that applies to this copy of the
+* file. For a license to use the file under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+// Calls the procedures and accesses the variables of testcases/Embedding.mic through the MilInterpreter API
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QtDebug>
+#include <QFileInfo>
+#include <QDir>
+#include <MicPpLexer.h>
+#include <MicParser2.h>
+#include <MicMilEmitter.h>
+#include <MicMilLoader.h>
+#include <MicMilInterpreter.h>
+using namespace Mic;
+
+class Lex : public Scanner2
+{
+public:
+    QString sourcePath;
+    PpLexer lex;
+    Token next()
+    {
+        return lex.nextToken();
+    }
+    Token peek(int offset)
+    {
+        return lex.peekToken(offset);
+    }
+    QString source() const { return sourcePath; }
+};
+
+class Manager : public Importer
+{
+public:
+    // compiles the module and the modules it imports from the same directory
+    QDir dir;
+    MilLoader loader;
+    QList< QPair<QByteArray,Declaration*> > modules;
+
+    ~Manager()
+    {
+        for( int i = 0; i < modules.size(); i++ )
+            delete modules[i].second;
+    }
+
+    Declaration* loadModule( const Import& imp )
+    {
+        const QByteArray name = imp.path.join('.');
+        for( int i = 0; i < modules.size(); i++ )
+        {
+            if( modules[i].first == name )
+                return modules[i].second;
+        }
+        modules.append(qMakePair(name, (Declaration*)0));
+        const int slot = modules.size() - 1;
+
+        const QString file = dir.absoluteFilePath(imp.path.join('/') + ".mic");
+        if( !QFileInfo(file).exists() )
+        {
+            qCritical() << "cannot find source file of module" << name;
+            return 0;
+        }
+        InMemRenderer r(&loader);
+        Lex lex;
+        lex.sourcePath = file;
+        lex.lex.setStream(file);
+        MilEmitter e(&r);
+        AstModel mdl;
+        Parser2 p(&mdl, &lex, &e, this);
+        p.RunParser(imp.metaActuals);
+        if( !p.errors.isEmpty() )
+        {
+            foreach( const Parser2::Error& e, p.errors )
+                qCritical() << QFileInfo(e.path).fileName() << e.row << e.col << e.msg;
+            return 0;
+        }
+        modules[slot].second = p.takeModule();
+        return modules[slot].second;
+    }
+
+    QByteArray moduleSuffix( const MetaActualList& )
+    {
+        return "$" + QByteArray::number(modules.size());
+    }
+
+    QByteArray modulePath( const QByteArrayList& path )
+    {
+        return path.join('$');
+    }
+};
+
+static int failed = 0;
+
+static void check(const MilInterpreter& intp, bool ok, const char* what, const QVariant& res = QVariant())
+{
+    qDebug() << (ok ? "ok  " : "FAIL") << what << res.toString() << intp.error();
+    if( !ok )
+        failed++;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QString path = "testcases";
+    if( a.arguments().size() > 1 )
+        path = a.arguments()[1];
+
+    Manager mgr;
+    mgr.dir = QDir(path);
+    Import imp;
+    imp.path.append(Token::getSymbol("Embedding"));
+    if( mgr.loadModule(imp) == 0 )
+        return -1;
+
+    MilInterpreter intp(&mgr.loader);
+    if( !intp.load("Embedding") )
+    {
+        qCritical() << intp.error();
+        return -1;
+    }
+
+    // procedure with int, real and string arguments and a real result
+    MilInterpreter::Proc weigh = intp.resolve("Embedding", "Weigh");
+    check(intp, weigh != 0, "resolve Weigh");
+    QVariant res = intp.call(weigh, QVariantList() << 3 << 2.5 << QByteArray("abcd"));
+    check(intp, res.toDouble() == 3 * 2.5 + 4, "Weigh(3, 2.5, \"abcd\")", res);
+
+    // variable round-trip, also as seen by the procedures
+    check(intp, intp.setVariable("Embedding", "factor", 2.0), "set factor");
+    res = intp.variable("Embedding", "factor");
+    check(intp, res.toDouble() == 2.0, "get factor", res);
+    res = intp.call(weigh, QVariantList() << 1 << 0.5 << QByteArray(""));
+    check(intp, res.toDouble() == 1.0, "Weigh(1, 0.5, \"\") with factor 2", res);
+    res = intp.variable("Embedding", "calls");
+    check(intp, res.toInt() == 2, "get calls", res);
+
+    res = intp.variable("Embedding", "greeting");
+    check(intp, res.toByteArray() == "hello", "get greeting", res);
+    intp.setVariable("Embedding", "greeting", QByteArray("hi there"));
+    res = intp.variable("Embedding", "greeting");
+    check(intp, res.toByteArray() == "hi there", "set greeting", res);
+
+    // POINTER TO scalar parameters need a modifiable argument list, to which the value is copied back
+    MilInterpreter::Proc bump = intp.resolve("Embedding", "Bump");
+    QVariantList args;
+    args << 40 << 2;
+    intp.call(bump, args);
+    check(intp, args[0].toInt() == 42, "Bump(40, 2)", args[0]);
+    const QVariantList fixed = args;
+    intp.call(bump, fixed);
+    check(intp, !intp.error().isEmpty(), "Bump with a constant argument list fails");
+
+    // errors are reported and don't affect the following calls
+    res = intp.call(weigh, QVariantList() << 1);
+    check(intp, !intp.error().isEmpty(), "Weigh with a missing argument fails", res);
+    check(intp, intp.resolve("Embedding", "Nothing") == 0, "resolve Nothing fails");
+    intp.call(intp.resolve("Embedding", "Check"), QVariantList() << 0);
+    check(intp, intp.error().endsWith("Embedding.mic:23"), "Check(0) fails with the assert position");
+    res = intp.variable("Embedding", "calls");
+    check(intp, res.toInt() == 2 && intp.error().isEmpty(), "get calls after the errors", res);
+
+    if( failed )
+        qCritical() << failed << "checks failed";
+    else
+        qDebug() << "all checks passed";
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,22 @@
+QT       += core
+
+QT       -= gui
+
+TARGET = InterpreterTest
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+DEFINES += _DEBUG
+
+include(MicParser.pri)
+
+SOURCES += \
+    MicInterpreterTest.cpp \
+    MicMilInterpreter.cpp
+
+HEADERS += \
+    MicMilInterpreter.h
@@ -36,6 +36,7 @@
 #include <MilToken.h>
 #include <QBuffer>
 #include <QCommandLineParser>
+#include <QThread>
 
 class Lex2 : public Mic::Scanner2
 {
@@ -215,7 +216,41 @@ public:
     }
 };
 
-static void process(const QStringList& files, const QStringList& searchPaths, bool run, bool dump)
+struct RunOptions
+{
+    bool report, registers, jit;
+    QString cc;
+    QStringList libs;
+};
+
+static void runModule(Mic::MilLoader* loader, const QByteArray& module, const RunOptions& o)
+{
+    Mic::MilInterpreter intp(loader);
+    intp.setReport(o.report);
+    intp.setEngine(o.registers ? Mic::MilInterpreter::RegisterEngine : Mic::MilInterpreter::StackEngine);
+    intp.setJit(o.jit);
+    intp.setCompiler(o.cc);
+    foreach( const QString& lib, o.libs )
+        intp.addLibrary(lib);
+    intp.run(module);
+}
+
+class Isolate : public QThread
+{
+    // runs the module in an interpreter of its own; the loaded modules are shared
+public:
+    Isolate(Mic::MilLoader* loader, const QByteArray& module, const RunOptions& o):
+        loader(loader),module(module),options(o) {}
+protected:
+    void run() { runModule(loader, module, options); }
+private:
+    Mic::MilLoader* loader;
+    QByteArray module;
+    RunOptions options;
+};
+
+static void process(const QStringList& files, const QStringList& searchPaths, bool run, bool dump,
+                    const RunOptions& options, int isolates)
 {
     int ok = 0;
     int all = 0;
@@ -250,11 +285,19 @@ static void process(const QStringList& files, const QStringList& searchPaths, bo
         all += mgr.modules.size();
         foreach( const ModuleSlot& m, mgr.modules )
             ok += m.decl ? 1 : 0;
-        if( run && module )
+        if( run && module && isolates > 1 )
         {
-            Mic::MilInterpreter intp(&mgr.loader);
-            intp.run(imp.path.back());
-        }
+            QList<Isolate*> threads;
+            for( int i = 0; i < isolates; i++ )
+            {
+                threads.append(new Isolate(&mgr.loader, imp.path.back(), options));
+                threads.back()->start();
+            }
+            foreach( Isolate* t, threads )
+                t->wait();
+            qDeleteAll(threads);
+        }else if( run && module )
+            runModule(&mgr.loader, imp.path.back(), options);
     }
     Mic::Expression::killArena();
     Mic::AstModel::cleanupGlobals();
@@ -277,6 +320,18 @@ int main(int argc, char *argv[])
     cp.addOption(run);
     QCommandLineOption dump("d", "dump MIL code");
     cp.addOption(dump);
+    QCommandLineOption report("s", "report fused instruction sequences after run");
+    cp.addOption(report);
+    QCommandLineOption engine("engine", "interpreter engine, stack (default) or reg", "name", "stack");
+    cp.addOption(engine);
+    QCommandLineOption jit("jit", "compile hot procedures to native code (x86-64)");
+    cp.addOption(jit);
+    QCommandLineOption cc("cc", "compile hot procedures to C with the given compiler, e.g. gcc", "compiler");
+    cp.addOption(cc);
+    QCommandLineOption lib("L", "load a shared library to bind EXTERN procedures to", "path");
+    cp.addOption(lib);
+    QCommandLineOption parallel("p", "run the main module in n interpreters on n threads", "n", "1");
+    cp.addOption(parallel);
 
     cp.process(a);
     const QStringList args = cp.positionalArguments();
@@ -284,7 +339,20 @@ int main(int argc, char *argv[])
         return -1;
     const QStringList searchPaths = cp.values(sp);
 
-    process(args, searchPaths, cp.isSet(run), cp.isSet(dump));
+    const QString e = cp.value(engine);
+    if( e != "stack" && e != "reg" )
+    {
+        qCritical() << "unknown engine" << e;
+        return -1;
+    }
+
+    RunOptions options;
+    options.report = cp.isSet(report);
+    options.registers = e == "reg";
+    options.jit = cp.isSet(jit);
+    options.cc = cp.value(cc);
+    options.libs = cp.values(lib);
+    process(args, searchPaths, cp.isSet(run), cp.isSet(dump), options, qMax(cp.value(parallel).toInt(), 1));
 
     return 0;
 }
@@ -109,6 +109,7 @@ void MilEmitter::toFinallySection(bool yes)
 void MilEmitter::endProc()
 {
     Q_ASSERT( !d_proc.isEmpty() && d_typeKind == 0 && ops != 0 );
+    d_proc.back().stackDepth = qMin(d_maxStackDepth, quint16(0xfff)); // 12 bits
     d_out->addProcedure(d_proc.back());
     d_proc.pop_back();
     ops = 0;
@@ -195,46 +196,34 @@ void MilEmitter::setVararg()
     d_proc.back().isVararg = true;
 }
 
-QByteArray MilEmitter::typeSymbol1(Type t)
+struct TypeSymbols
 {
-    static QByteArray symbols[IntPtr];
-    if( symbols[0].isEmpty() )
+    // the symbols of MilEmitter::Type, interned once, also if several threads ask at the same time
+    QByteArray symbols[MilEmitter::IntPtr];
+    TypeSymbols(const char* const names[])
     {
-        symbols[U1] = Token::getSymbol("uint8");
-        symbols[U2] = Token::getSymbol("uint16");
-        symbols[U4] = Token::getSymbol("uint32");
-        symbols[U8] = Token::getSymbol("uint64");
-        symbols[I1] = Token::getSymbol("int8");
-        symbols[I2] = Token::getSymbol("int16");
-        symbols[I4] = Token::getSymbol("int32");
-        symbols[I8] = Token::getSymbol("int64");
-        symbols[R4] = Token::getSymbol("float32");
-        symbols[R8] = Token::getSymbol("float64");
+        for( int i = MilEmitter::I1; i < MilEmitter::IntPtr; i++ )
+            symbols[i] = Token::getSymbol(names[i]);
     }
+};
+
+QByteArray MilEmitter::typeSymbol1(Type t)
+{
+    static const char* const names[] = { "", "int8", "int16", "int32", "int64", "float32", "float64",
+                                         "uint8", "uint16", "uint32", "uint64" };
+    static const TypeSymbols s(names);
     if( t < IntPtr )
-        return symbols[t];
+        return s.symbols[t];
     else
         return QByteArray();
 }
 
 QByteArray MilEmitter::typeSymbol2(Type t)
 {
-    static QByteArray symbols[IntPtr];
-    if( symbols[0].isEmpty() )
-    {
-        symbols[U1] = Token::getSymbol("u1");
-        symbols[U2] = Token::getSymbol("u2");
-        symbols[U4] = Token::getSymbol("u4");
-        symbols[U8] = Token::getSymbol("u8");
-        symbols[I1] = Token::getSymbol("i1");
-        symbols[I2] = Token::getSymbol("i2");
-        symbols[I4] = Token::getSymbol("i4");
-        symbols[I8] = Token::getSymbol("i8");
-        symbols[R4] = Token::getSymbol("r4");
-        symbols[R8] = Token::getSymbol("r8");
-    }
+    static const char* const names[] = { "", "i1", "i2", "i4", "i8", "r4", "r8", "u1", "u2", "u4", "u8" };
+    static const TypeSymbols s(names);
     if( t < IntPtr )
-        return symbols[t];
+        return s.symbols[t];
     else
         return QByteArray();
 }
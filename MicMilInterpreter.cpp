@@ -24,6 +24,26 @@
 #include <QVector>
 #include <QFile>
 #include <QtDebug>
+#include <QTemporaryDir>
+#include <QProcess>
+#include <QLibrary>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QBitArray>
+#include <QVarLengthArray>
+#include <algorithm>
+#include <new>
+#include <math.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#if (defined(__x86_64__) && defined(__unix__)) || (defined(__aarch64__) && !defined(_WIN32))
+#define _MIC_FFI // integer and floating point arguments are assigned to registers independently
+#endif
+#if defined(__x86_64__) && defined(__unix__)
+#define _MIC_JIT
+#include <sys/mman.h>
+#endif
 using namespace Mic;
 
 #define _USE_GETTIMEOFDAY
@@ -65,12 +85,149 @@ int gettimeofday(struct timeval * tp, struct timezone * tzp)
 #endif
 
 struct ModuleData;
+struct ProcData;
+struct FlattenedType;
+struct MemSlot;
+struct NativeCode;
+
+// a procedure compiled from C: the int64 arguments and their half width flags; returns the int64 result
+// and sets retHw to its half width flag, or to -1 if the procedure ended without a result
+typedef qint64 (*CeeProc)(const qint64* args, const char* argHw, char* retHw);
+
+// interpreter private operations, only produced by prepareBytecode
+enum LL_op { LL_jump = IL_NUM_OF_OPS, // goto val
+             LL_brfalse, // pop, goto val if zero
+             LL_case,   // compare top with labels[i]; match: pop, continue; else goto val and pop if len
+             LL_leave,  // end of body
+             // quickened arithmetic and comparison, see quicken
+             LL_add_i, LL_add_u, LL_add_f, LL_sub_i, LL_sub_u, LL_sub_f,
+             LL_mul_i, LL_mul_u, LL_mul_f, LL_div_i, LL_div_f, LL_rem_i, LL_rem_u,
+             LL_clt_i, LL_clt_u, LL_clt_f, LL_cgt_i, LL_cgt_u, LL_cgt_f,
+             // superinstructions, see fuse
+             LL_brtrue, // ldc_i4 0, ceq, brfalse
+             LL_clt_brfalse, LL_clt_brtrue, LL_cgt_brfalse, LL_cgt_brtrue, LL_ceq_brfalse, LL_ceq_brtrue,
+             LL_addi, LL_subi, // ldc_i4 i, add|sub
+             LL_incvar, LL_decvar, // ldvara s, ldvar s, ldc_i4 len, add|sub, stind
+             LL_incloc, LL_decloc, // ldloca val, ldloc val, ldc_i4 len, add|sub, stind
+             LL_ldarg_ldfld, // val arg, len field offset
+             // register form, see toRegisterForm; len is source a << 16 | source b, val the
+             // destination or the jump target
+             LL_radd, LL_rsub, LL_rmul, LL_rdiv, LL_rdiv_un, LL_rrem, LL_rand, LL_ror, LL_rxor,
+             LL_rshl, LL_rshr, LL_rshr_un, LL_rceq, LL_rclt, LL_rcgt,
+             LL_rclt_brfalse, LL_rclt_brtrue, LL_rcgt_brfalse, LL_rcgt_brtrue, LL_rceq_brfalse, LL_rceq_brtrue,
+             LL_rbrfalse, // goto val if source a is zero
+             LL_rmov, // store source a to val
+             LL_rst, // pop and store to val like stind
+             LL_loop, // backward jump, counts towards compiling to native code
+             LL_switch, // pop, goto the target of the top in switches[i] or val, see buildSwitches
+             // MIC$ procedures operating on the operand stack, see lowerIntrinsic; pd is the procedure
+             LL_setin, LL_setdiv,
+             LL_relop, // val is the variant of relop1..4
+             LL_strlen,
+             LL_intrinsic, // the remaining ones, calls callIntrinsic
+             LL_NUM_OF_OPS
+           };
+
+// register form operands: sources are 16 bits, destinations 24 bits; frame slots are counted
+// from the first argument; the global variable is the pointer of the Operation
+enum RegOperand { RegConst = 0x8000, // + index of ProcData::consts
+                  RegPop = 0xfffe, RegVar = 0xffff, // sources
+                  RegPush = 0xfffffe, RegVarDest = 0xffffff // destinations
+                };
+
+static const char* s_llOpName[] = {
+    "jump", "brfalse", "case", "leave",
+    "add.i", "add.u", "add.f", "sub.i", "sub.u", "sub.f",
+    "mul.i", "mul.u", "mul.f", "div.i", "div.f", "rem.i", "rem.u",
+    "clt.i", "clt.u", "clt.f", "cgt.i", "cgt.u", "cgt.f",
+    "brtrue", "clt+brfalse", "clt+brtrue", "cgt+brfalse", "cgt+brtrue", "ceq+brfalse", "ceq+brtrue",
+    "addi", "subi", "incvar", "decvar", "incloc", "decloc", "ldarg+ldfld",
+    "r.add", "r.sub", "r.mul", "r.div", "r.div.un", "r.rem", "r.and", "r.or", "r.xor",
+    "r.shl", "r.shr", "r.shr.un", "r.ceq", "r.clt", "r.cgt",
+    "r.clt+brfalse", "r.clt+brtrue", "r.cgt+brfalse", "r.cgt+brtrue", "r.ceq+brfalse", "r.ceq+brtrue",
+    "r.brfalse", "r.mov", "r.st", "loop", "switch",
+    "setin", "setdiv", "relop", "strlen", "intrinsic",
+};
+
+static inline const char* opName(quint32 op)
+{
+    if( op < IL_NUM_OF_OPS )
+        return s_opName[op];
+    else
+        return s_llOpName[op - IL_NUM_OF_OPS];
+}
+
+struct Operation
+{
+    // pre-decoded MIL operation; the structured statements are resolved to jumps and
+    // all operands are resolved to direct pointers or indices, see prepareBytecode
+    quint32 op : 8; // IL_op or LL_op
+    quint32 val : 24; // jump target, arg, local or field index, vtable index, scalar type
+    quint32 len; // element, field or record width, flags; quickened ops: don't quicken again
+    union {
+        qint64 i;
+        double f;
+        ProcData* pd;
+        FlattenedType* tt;
+        MemSlot* s;
+    };
+    Operation(quint8 o = IL_invalid):op(o),val(0),len(0),i(0) {}
+};
+
+struct SwitchTable
+{
+    // the case chain of a switch; dense if the labels are compact, otherwise sorted label ranges
+    qint64 low;
+    QVector<quint32> dense; // label - low -> target
+    QVector<qint64> from, to; // sorted ranges of labels with the same target
+    QVector<quint32> targets;
+    quint32 other; // target if no label matches
+    quint32 find(qint64 v) const
+    {
+        if( !dense.isEmpty() )
+        {
+            const quint64 i = v - low;
+            return i < (quint64)dense.size() ? dense[i] : other;
+        }
+        const int i = std::upper_bound(from.begin(), from.end(), v) - from.begin() - 1;
+        if( i >= 0 && v <= to[i] )
+            return targets[i];
+        return other;
+    }
+};
+
+struct CallSite
+{
+    // monomorphic inline cache of a callvirt, ldmeth, calli or callvi site
+    FlattenedType* tt; // receiver type of the cached target, if any
+    ProcData* target;
+    CallSite():tt(0),target(0) {}
+};
 
 struct ProcData
 {
     MilProcedure* proc;
     ModuleData* module;
-    ProcData(MilProcedure* p, ModuleData* m):proc(p),module(m) {}
+    QVector<Operation> ops; // the pre-decoded body, only valid if prepared
+    QVector<quint32> pcs; // ops index -> body index, for error reporting
+    QList<CaseLabelList> labels; // case operands
+    QVector<SwitchTable> switches; // switch operands
+    QVector<MemSlot> consts; // register form constants
+    QVector<MemSlot> localsInit; // the initialized locals, copied to each new frame
+    QVector<CallSite> sites; // inline caches, indexed by Operation::len of the call site
+    QVector<Operation> stackOps; // the stack form, kept for the C tier
+    quint32 stackDepth; // max operand stack depth, only valid if prepared
+    quint32 hot; // entries and loop iterations
+    NativeCode* native; // owned
+    enum Tier { Interpreted, Compiling, Compiled, NotCompilable };
+    quint8 tier;
+    quint32 calls; // entries and loop iterations, for the C tier
+    CeeProc cee; // the C tier version, owned by a CeeUnit
+    qint16 ext; // Extern procedures: the index of the native implementation, see bindExtern
+    bool prepared;
+    ProcData(MilProcedure* p, ModuleData* m):proc(p),module(m),stackDepth(0),hot(0),native(0),
+        tier(Interpreted),calls(0),cee(0),ext(-1),prepared(false) {}
+    ~ProcData();
 };
 
 struct FlattenedType
@@ -79,7 +236,9 @@ struct FlattenedType
     quint32 len : 31; // flattened multi-dim-arrays
     quint32 flattened : 1;
     QList<MilVariable*> fields;
-    QList<ProcData> vtable;
+    QVector<quint32> offsets; // of the fields, where MilVariable::offset of the shared modules is not written
+    QList<ProcData*> vtable;
+    QVector<FlattenedType*> display; // objects: the base types from the root down to this type
     ModuleData* module;
     FlattenedType():type(0),len(0),flattened(0),module(0) {}
     int lastIndexOfField(const QByteArray& name)
@@ -95,14 +254,23 @@ struct FlattenedType
     {
         for( int i = vtable.size()-1; i >= 0; i-- )
         {
-            if( vtable[i].proc->name.constData() == name.constData() )
+            if( vtable[i]->proc->name.constData() == name.constData() )
                 return i;
         }
         return -1;
     }
 };
 
-struct MemSlot;
+struct Frame
+{
+    // an activation of a procedure on the VM stack
+    ProcData* pd;
+    MemSlot* args;
+    MemSlot* locals;
+    MemSlot* stack; // operand stack
+    MemSlot* outer; // vmTop of the caller
+    qint32 pc; // the pending call while a callee is active
+};
 
 struct MethRef
 {
@@ -127,70 +295,166 @@ struct MemSlot
         MethRef* m;
     };
     enum Type { Invalid, I, U, F,
-                Record, Array,  // value semantics, as a pointer to sequence of MemSlot, owned
+                Record, Array,  // value semantics, as a pointer to sequence of MemSlot, owned; copies share
+                                // the sequence until it is written, see unshare and expose
                 Pointer, // ref semantics, as pointer to MemSlot (sequence, variable, parameter, field, element), not owned
                 Procedure, // pointer to procedure/module, not owned
                 TypeTag,  // pointer to FlattenedType, tt, not owned
                 Method,   // MethRef, m, owned
-                Header // the header slot of a record or array; the pointer points to the next slot; u is size
+                Header // the header slot of a record or array; the pointer points to the next slot; u is size,
+                       // off the number of further owners, hw set if pointers into the sequence were handed out
               };
-#ifdef _DEBUG
-    Type t;
-#else
-    quint8 t;
-#endif
+    quint8 t; // Type; a byte also in debug builds, where the enum and off would make a slot 24 bytes
     bool hw; // half width for i, u or f
     bool embedded;
+    quint32 off; // Pointer into a sequence: p - off - 1 is the Header, so bounds checks are O(1)
 
-    MemSlot():u(0),t(Invalid),hw(false),embedded(false) {}
-    MemSlot(quint64 u, bool h = false):u(u),t(U),hw(h),embedded(false) { if(hw) u &= 0xffffffff; }
-    MemSlot(qint64 i, bool h = false):i(i),t(I),hw(h),embedded(false) { if(hw) i = (qint32)i; }
-    MemSlot(int i, bool h = true):i(i),t(I),hw(h),embedded(false) {}
-    MemSlot(double d,bool h):f(d),t(F),hw(h),embedded(false) {}
-    MemSlot(MemSlot* s):p(s),t(Pointer), hw(false),embedded(false) {}
-    MemSlot(ProcData* p):pp(p),t(Procedure),hw(false),embedded(false) {}
-    MemSlot(FlattenedType* tt):tt(tt),t(TypeTag), hw(false),embedded(false) {}
-    MemSlot(const MemSlot& rhs):t(Invalid),u(0),embedded(false) { *this = rhs; }
-    MemSlot(MethRef* m):m(m),t(Method), hw(false),embedded(false) {}
+    MemSlot():u(0),t(Invalid),hw(false),embedded(false),off(0) {}
+    MemSlot(quint64 u, bool h = false):u(u),t(U),hw(h),embedded(false),off(0) { if(hw) u &= 0xffffffff; }
+    MemSlot(qint64 i, bool h = false):i(i),t(I),hw(h),embedded(false),off(0) { if(hw) i = (qint32)i; }
+    MemSlot(int i, bool h = true):i(i),t(I),hw(h),embedded(false),off(0) {}
+    MemSlot(double d,bool h):f(d),t(F),hw(h),embedded(false),off(0) {}
+    MemSlot(MemSlot* s, quint32 o = 0):p(s),t(Pointer), hw(false),embedded(false),off(o) {}
+    MemSlot(ProcData* p):pp(p),t(Procedure),hw(false),embedded(false),off(0) {}
+    MemSlot(FlattenedType* tt):tt(tt),t(TypeTag), hw(false),embedded(false),off(0) {}
+    MemSlot(const MemSlot& rhs):u(0),t(Invalid),embedded(false),off(0) { *this = rhs; }
+    MemSlot(MethRef* m):m(m),t(Method), hw(false),embedded(false),off(0) {}
     ~MemSlot();
+    bool owns() const { return t == Record || t == Array || t == Method; }
+    void release(); // the owned sequence or MethRef, without resetting the slot
     void clear();
     MemSlot& operator=(const MemSlot& rhs);
     void move( MemSlot& rhs );
     void copyOf(const MemSlot* rhs, bool record);
+    void unshare(); // give the owned sequence a private copy before writing to it
+    MemSlot* expose(); // the owned sequence, private and pinned, to take pointers into it
     void copyOf(const MemSlot* rhs, quint32 off, quint32 len, bool record);
     static void dispose(MemSlot*);
 };
+// The tag stays beside the payload: slots also live alone as locals, arguments and module variables,
+// and a Pointer may point into the middle of a sequence, so there is no place to find a side table of
+// tags from; the JIT also reads t at a fixed offset from the payload.
+Q_STATIC_ASSERT(sizeof(MemSlot) == 16);
 
 typedef QVector<MemSlot> MemSlotList;
 
+// Sequences of up to MaxPooled slots including the header are carved from slabs by bump pointer
+// and recycled by size class; the larger ones come from the C++ heap. Each interpreter has its own
+// heap, which is released in bulk when the interpreter goes away, see HeapScope.
+enum { MaxPooled = 64, SlabSlots = 16 * 1024 };
+struct SeqHeap
+{
+    MemSlot* free[MaxPooled + 1]; // slots -> free list, linked through the header p
+    QList<MemSlot*> slabs;
+    MemSlot* bump;
+    MemSlot* bumpEnd;
 #ifdef _MIC_MEM_CHECK
-static QHash<MemSlot*,bool> dynamicSeqs;
+    QHash<MemSlot*,bool> dynamicSeqs;
 #endif
+    SeqHeap():bump(0),bumpEnd(0)
+    {
+        for( int i = 0; i <= MaxPooled; i++ )
+            free[i] = 0;
+    }
+    ~SeqHeap()
+    {
+        for( int i = 0; i < slabs.size(); i++ )
+            ::operator delete(slabs[i]);
+    }
+};
+// the heap of the interpreter running on this thread; interpreters share no sequences, so they
+// can run on different threads at the same time
+static thread_local SeqHeap* s_heap = 0;
+
+class HeapScope
+{
+public:
+    HeapScope(SeqHeap* h):prev(s_heap) { s_heap = h; }
+    ~HeapScope() { s_heap = prev; }
+private:
+    SeqHeap* prev;
+};
 
 static MemSlot* createSequence(int size)
 {
-    MemSlot* s = new MemSlot[size+1];
+    const int n = size + 1;
+    MemSlot* s;
+    SeqHeap& h = *s_heap;
+    if( n <= MaxPooled )
+    {
+        s = h.free[n];
+        if( s )
+            h.free[n] = s->p;
+        else
+        {
+            if( h.bump + n > h.bumpEnd )
+            {
+                h.bump = (MemSlot*)::operator new(SlabSlots * sizeof(MemSlot));
+                h.bumpEnd = h.bump + SlabSlots;
+                h.slabs.append(h.bump);
+            }
+            s = h.bump;
+            h.bump += n;
+        }
+        for( int i = 0; i < n; i++ )
+            new(s + i) MemSlot();
+    }else
+        s = new MemSlot[n];
     s->t = MemSlot::Header;
     s->u = size;
     s++; // point to the second element which is the actual first element of the sequence
 #ifdef _MIC_MEM_CHECK
-    dynamicSeqs.insert(s,false);
+    h.dynamicSeqs.insert(s,false);
 #endif
     return s;
 }
 
 void MemSlot::copyOf(const MemSlot* rhs, bool record)
 {
+    MemSlot* s = 0;
+    if( rhs )
+    {
+        MemSlot* header = const_cast<MemSlot*>(rhs) - 1;
+        Q_ASSERT(header->t == MemSlot::Header);
+        if( header->hw )
+        {
+            // pinned, i.e. there may be pointers into rhs, so the copy must not see writes through them
+            s = createSequence(header->u);
+            for(int i = 0; i < header->u; i++ )
+                s[i] = rhs[i];
+        }else
+        {
+            header->off++;
+            s = const_cast<MemSlot*>(rhs);
+        }
+    }
     clear();
     t = record ? Record : Array;
-    p = 0;
-    if( rhs == 0 )
+    p = s;
+}
+
+void MemSlot::unshare()
+{
+    if( p == 0 )
         return;
-    const MemSlot* header = rhs - 1;
+    MemSlot* header = p - 1;
     Q_ASSERT(header->t == MemSlot::Header);
-    p = createSequence(header->u);
+    if( header->off == 0 )
+        return;
+    header->off--;
+    MemSlot* s = createSequence(header->u);
     for(int i = 0; i < header->u; i++ )
-        p[i] = rhs[i];
+        s[i] = p[i];
+    p = s;
+}
+
+MemSlot* MemSlot::expose()
+{
+    // all writes to the elements go through pointers taken here, so the sequence stays private
+    unshare();
+    if( p )
+        p[-1].hw = true;
+    return p;
 }
 
 void MemSlot::copyOf(const MemSlot* rhs, quint32 off, quint32 len, bool record)
@@ -211,16 +475,27 @@ void MemSlot::copyOf(const MemSlot* rhs, quint32 off, quint32 len, bool record)
 }
 
 
+inline void MemSlot::release()
+{
+    if( t == Record || t == Array )
+        dispose(p);
+    else if( t == Method )
+        delete m;
+}
+
 MemSlot& MemSlot::operator=(const MemSlot& rhs)
 {
     if( rhs.t == Array || rhs.t == Record )
         copyOf(rhs.p, rhs.t == Record);
     else
     {
-        clear();
+        if( owns() )
+            release();
         u = rhs.u;
         t = rhs.t;
         hw = rhs.hw;
+        embedded = false;
+        off = rhs.off;
         if( rhs.t == Method )
         {
             m = new MethRef();
@@ -232,73 +507,558 @@ MemSlot& MemSlot::operator=(const MemSlot& rhs)
 
 void MemSlot::move( MemSlot& rhs )
 {
-    clear();
+    // scalars are just copied, only an owned value of this is released
+    if( owns() )
+        release();
     u = rhs.u;
     t = rhs.t;
     hw = rhs.hw;
     embedded = rhs.embedded;
-    if( rhs.t == Record || rhs.t == Array || rhs.t == Method )
+    off = rhs.off;
+    if( rhs.owns() )
         rhs.p = 0;
 }
 
 void MemSlot::clear()
 {
-    if( t == Record || t == Array )
-        dispose(p);
-    else if( t == Method )
-        delete m;
+    if( owns() )
+        release();
     t = Invalid;
     u = 0;
     hw = 0;
+    embedded = 0;
+    off = 0;
 }
 
 MemSlot::~MemSlot()
 {
-    clear();
+    if( owns() )
+        release();
 }
 
 void MemSlot::dispose(MemSlot* s)
 {
     if( s == 0 )
         return;
+    MemSlot* header = s - 1;
+    Q_ASSERT(header->t == MemSlot::Header);
+    if( header->off )
+    {
+        header->off--; // still owned by another slot
+        return;
+    }
+    SeqHeap& h = *s_heap;
 #ifdef _MIC_MEM_CHECK
-    if( !dynamicSeqs.contains(s) )
+    if( !h.dynamicSeqs.contains(s) )
         qCritical() << "not dynamically allocated";
-    else if( dynamicSeqs.value(s) )
+    else if( h.dynamicSeqs.value(s) )
         qCritical() << "double delete";
     else
-        dynamicSeqs[s] = true;
+        h.dynamicSeqs[s] = true;
 #endif
 
-    MemSlot* header = s - 1;
-    Q_ASSERT(header->t == MemSlot::Header);
-    delete[] header;
+    const int n = header->u + 1;
+    if( n <= MaxPooled )
+    {
+        for( int i = 1; i < n; i++ )
+        {
+            if( header[i].owns() )
+                header[i].release(); // the slots are constructed again when reused
+        }
+        header->p = h.free[n];
+        h.free[n] = header;
+    }else
+        delete[] header;
 }
 
 struct ModuleData
 {
     MilModule* module;
     MemSlotList variables;
-    QMap<const char*,ProcData*> procs;
+    QMap<const char*,ProcData*> procs; // not owned
+    QList<MemSlot*> constants; // ldobj operands, materialized once and never modified
 
     ModuleData():module(0){}
-    ~ModuleData()
+    ~ModuleData() { qDeleteAll(constants); }
+};
+
+#ifdef _MIC_JIT
+struct NativeCode
+{
+    // x86-64 code of a procedure in register form, see NativeGen
+    quint8* mem;
+    quint32 size;
+    QVector<qint32> entries; // ops index -> code offset, or -1
+    NativeCode():mem(0),size(0) {}
+    ~NativeCode() { if( mem ) munmap(mem, size); }
+    qint32 run(MemSlot* args, MemSlot* sp, qint32 pc, MemSlot** spOut)
+    {
+        // returns the ops index where the interpreter continues
+        typedef qint32 (*Code)(MemSlot* args, MemSlot* sp, MemSlot** spOut, void* entry);
+        return ((Code)mem)(args, sp, spOut, mem + entries[pc]);
+    }
+};
+
+class NativeGen
+{
+public:
+    // Stitches a machine code template for each register form op and jump, patching in the
+    // operand addresses and jump targets; all other ops, as well as failing type guards, exit
+    // to the interpreter at the op. Register use: rbx args, r13 sp, r14 where to put sp on exit.
+    NativeGen(ProcData* pd):pd(pd) {}
+
+    NativeCode* generate()
+    {
+        const QVector<Operation>& ops = pd->ops;
+        labels.resize(ops.size());
+        // prologue: code(args, sp, spOut, entry)
+        b(0x53); b(0x41); b(0x55); b(0x41); b(0x56); // push rbx, r13, r14
+        b(0x48); b(0x89); b(0xfb); // mov rbx, rdi
+        b(0x49); b(0x89); b(0xf5); // mov r13, rsi
+        b(0x49); b(0x89); b(0xd6); // mov r14, rdx
+        b(0xff); b(0xe1); // jmp rcx
+        int count = 0;
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            labels[pc] = code.size();
+            if( op(pc, ops[pc]) )
+                count++;
+            else
+                exit(pc);
+        }
+        if( count == 0 )
+            return 0;
+        QHash<int,int> stubs;
+        for( int i = 0; i < guards.size(); i++ )
+        {
+            if( !stubs.contains(guards[i].target) )
+            {
+                stubs.insert(guards[i].target, code.size());
+                exit(guards[i].target);
+            }
+            patch(guards[i].pos, stubs.value(guards[i].target));
+        }
+        for( int i = 0; i < jumps.size(); i++ )
+            patch(jumps[i].pos, labels[jumps[i].target]);
+        const int epilogue = code.size();
+        b(0x4d); b(0x89); b(0x2e); // mov [r14], r13
+        b(0x41); b(0x5e); b(0x41); b(0x5d); b(0x5b); // pop r14, r13, rbx
+        b(0xc3); // ret
+        for( int i = 0; i < exits.size(); i++ )
+            patch(exits[i], epilogue);
+
+        void* mem = mmap(0, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( mem == MAP_FAILED )
+            return 0;
+        memcpy(mem, code.constData(), code.size());
+        if( mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0 )
+        {
+            munmap(mem, code.size());
+            return 0;
+        }
+        NativeCode* res = new NativeCode();
+        res->mem = (quint8*)mem;
+        res->size = code.size();
+        res->entries = QVector<qint32>(ops.size(), -1);
+        bool loops = false;
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            // on-stack replacement at the loop heads, i.e. the targets of backward branches
+            const bool back = ops[pc].op == LL_loop ||
+                    ( ops[pc].op >= LL_rclt_brfalse && ops[pc].op <= LL_rbrfalse && ops[pc].val <= quint32(pc) );
+            if( back && supported(ops[ops[pc].val].op) )
+            {
+                res->entries[ops[pc].val] = labels[ops[pc].val];
+                loops = true;
+            }
+        }
+        // without loops a call would mostly just enter and leave again
+        if( loops && supported(ops[0].op) )
+            res->entries[0] = labels[0];
+        return res;
+    }
+private:
+    enum Reg { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7, R13 = 13 };
+    enum Cond { E = 0x4, NE = 0x5, BE = 0x6, A = 0x7, L = 0xc, GE = 0xd, LE = 0xe, G = 0xf };
+    enum { SZ = sizeof(MemSlot) };
+    struct Patch
+    {
+        int pos; // of a rel32
+        int target; // ops index
+        Patch(int p = 0, int t = 0):pos(p),target(t) {}
+    };
+    ProcData* pd;
+    QByteArray code;
+    QVector<int> labels; // ops index -> code offset
+    QList<Patch> jumps;
+    QList<Patch> guards; // to an exit stub of target
+    QList<int> exits; // to the epilogue
+
+    void b(quint8 x) { code.append(char(x)); }
+    void d32(qint32 x) { for( int i = 0; i < 4; i++ ) b(quint32(x) >> (i * 8)); }
+    void d64(quint64 x) { for( int i = 0; i < 8; i++ ) b(x >> (i * 8)); }
+    void patch(int pos, int target)
+    {
+        const qint32 rel = target - ( pos + 4 );
+        for( int i = 0; i < 4; i++ )
+            code[pos+i] = char(quint32(rel) >> (i * 8));
+    }
+
+    static bool supported(quint32 op)
+    {
+        switch( op )
+        {
+        case LL_jump: case LL_loop:
+        case LL_radd: case LL_rsub: case LL_rmul: case LL_rand: case LL_ror: case LL_rxor:
+        case LL_rceq: case LL_rclt: case LL_rcgt:
+        case LL_rclt_brfalse: case LL_rclt_brtrue: case LL_rcgt_brfalse: case LL_rcgt_brtrue:
+        case LL_rceq_brfalse: case LL_rceq_brtrue: case LL_rbrfalse: case LL_rmov:
+        case LL_rdiv: case LL_rrem:
+        case IL_ldarg: case IL_ldloc: case IL_ldvar: case IL_ldc_i4: case IL_ldc_i8:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void exit(int pc)
+    {
+        b(0xb8); d32(pc); // mov eax, pc
+        b(0xe9); exits.append(code.size()); d32(0); // jmp epilogue
+    }
+    void jump(int target)
+    {
+        b(0xe9); jumps.append(Patch(code.size(), target)); d32(0);
+    }
+    void jcc(quint8 cc, int target)
+    {
+        b(0x0f); b(0x80 | cc); jumps.append(Patch(code.size(), target)); d32(0);
+    }
+    void guard(quint8 cc, int pc)
+    {
+        // leave to the interpreter at pc if cc
+        b(0x0f); b(0x80 | cc); guards.append(Patch(code.size(), pc)); d32(0);
+    }
+    void lea(quint8 r, quint8 base, qint32 disp)
+    {
+        b(0x48 | ( r >> 3 ) << 2 | base >> 3); b(0x8d); b(0x80 | ( r & 7 ) << 3 | ( base & 7 )); d32(disp);
+    }
+    void movImm(quint8 r, quint64 imm)
+    {
+        b(0x48 | r >> 3); b(0xb8 | ( r & 7 )); d64(imm);
+    }
+    void cmpType(quint8 r, quint8 t)
+    {
+        // cmp byte [r+t], imm
+        b(0x80); b(0x78 | r); b(offsetof(MemSlot,t)); b(t);
+    }
+    void setType(quint8 r, quint8 t)
+    {
+        // mov byte [r+t], imm
+        b(0xc6); b(0x40 | r); b(offsetof(MemSlot,t)); b(t);
+    }
+
+    int source(quint8 r, quint32 x, const Operation& op, int pos)
+    {
+        // load the address of source x to r; pos counts the popped sources from the top
+        if( x < RegConst )
+            lea(r, RBX, x * SZ);
+        else if( x < RegPop )
+            movImm(r, quint64(&pd->consts[x - RegConst]));
+        else if( x == RegVar )
+            movImm(r, quint64(op.s));
+        else
+        {
+            lea(r, R13, -pos * SZ);
+            return 1;
+        }
+        return 0;
+    }
+    int sources(const Operation& op)
+    {
+        // rsi = a, rdi = b; returns the number of pops
+        const quint32 a = op.len >> 16;
+        const quint32 bb = op.len & 0xffff;
+        int pops = ( a == RegPop ? 1 : 0 ) + ( bb == RegPop ? 1 : 0 );
+        source(RDI, bb, op, 1);
+        source(RSI, a, op, pops);
+        return pops;
+    }
+    void dest(const Operation& op, int pops, int pc)
+    {
+        // rdx = destination, which must not own a value
+        if( op.val < RegConst )
+            lea(RDX, RBX, op.val * SZ);
+        else if( op.val == RegPush )
+            lea(RDX, R13, -pops * SZ);
+        else
+            movImm(RDX, quint64(op.s));
+        owned(RDX, pc);
+    }
+    void owned(quint8 r, int pc)
+    {
+        // leave if r points to a Record, Array or Method, which need the interpreter
+        b(0x0f); b(0xb6); b(0x48 | r); b(offsetof(MemSlot,t)); // movzx ecx, byte [r+t]
+        b(0x83); b(0xe9); b(MemSlot::Record); // sub ecx, Record
+        b(0x83); b(0xf9); b(MemSlot::Array - MemSlot::Record); // cmp ecx, Array - Record
+        guard(BE, pc);
+        cmpType(r, MemSlot::Method);
+        guard(E, pc);
+    }
+    void adjust(const Operation& op, int pops)
+    {
+        // the new sp, without touching the flags
+        const int n = ( op.val == RegPush ? 1 : 0 ) - pops;
+        if( n != 0 )
+        {
+            b(0x4d); b(0x8d); b(0xad); d32(n * SZ); // lea r13, [r13+n*SZ]
+        }
+    }
+    void result(const Operation& op, int pops, bool cmp)
+    {
+        // store rax as the I result to rdx; cl is the hw of a
+        b(0x48); b(0x89); b(0x02); // mov [rdx], rax
+        setType(RDX, MemSlot::I);
+        if( cmp )
+        {
+            b(0xc6); b(0x42); b(offsetof(MemSlot,hw)); b(1); // mov byte [rdx+hw], 1
+        }else
+        {
+            b(0x88); b(0x4a); b(offsetof(MemSlot,hw)); // mov [rdx+hw], cl
+        }
+        b(0xc6); b(0x42); b(offsetof(MemSlot,embedded)); b(0); // mov byte [rdx+embedded], 0
+        b(0xc7); b(0x42); b(offsetof(MemSlot,off)); d32(0); // mov dword [rdx+off], 0
+        adjust(op, pops);
+    }
+    void copy(const Operation& op, int pc)
+    {
+        // *rdx = *rsi for values which are not owned
+        owned(RSI, pc);
+        dest(op, 0, pc);
+        b(0x48); b(0x8b); b(0x06); // mov rax, [rsi]
+        b(0x48); b(0x89); b(0x02); // mov [rdx], rax
+        b(0x8a); b(0x46); b(offsetof(MemSlot,t)); // mov al, [rsi+t]
+        b(0x88); b(0x42); b(offsetof(MemSlot,t)); // mov [rdx+t], al
+        b(0x8a); b(0x46); b(offsetof(MemSlot,hw)); // mov al, [rsi+hw]
+        b(0x88); b(0x42); b(offsetof(MemSlot,hw)); // mov [rdx+hw], al
+        b(0xc6); b(0x42); b(offsetof(MemSlot,embedded)); b(0); // mov byte [rdx+embedded], 0
+        b(0x8b); b(0x46); b(offsetof(MemSlot,off)); // mov eax, [rsi+off]
+        b(0x89); b(0x42); b(offsetof(MemSlot,off)); // mov [rdx+off], eax
+        adjust(op, 0);
+    }
+
+    bool op(int pc, const Operation& op)
     {
-        QMap<const char*,ProcData*>::const_iterator i;
-        for( i = procs.begin(); i != procs.end(); ++i )
-            delete i.value();
+        switch( op.op )
+        {
+        case LL_jump:
+        case LL_loop:
+            jump(op.val);
+            return true;
+        case LL_radd:
+        case LL_rsub:
+        case LL_rmul:
+        case LL_rand:
+        case LL_ror:
+        case LL_rxor:
+            {
+                const int pops = sources(op);
+                cmpType(RSI, MemSlot::I);
+                guard(NE, pc);
+                dest(op, pops, pc);
+                b(0x8a); b(0x4e); b(offsetof(MemSlot,hw)); // mov cl, [rsi+hw]
+                b(0x48); b(0x8b); b(0x06); // mov rax, [rsi]
+                switch( op.op )
+                {
+                case LL_radd:
+                    b(0x48); b(0x03); b(0x07); // add rax, [rdi]
+                    break;
+                case LL_rsub:
+                    b(0x48); b(0x2b); b(0x07); // sub rax, [rdi]
+                    break;
+                case LL_rmul:
+                    b(0x48); b(0x0f); b(0xaf); b(0x07); // imul rax, [rdi]
+                    break;
+                case LL_rand:
+                    b(0x48); b(0x23); b(0x07); // and rax, [rdi]
+                    break;
+                case LL_ror:
+                    b(0x48); b(0x0b); b(0x07); // or rax, [rdi]
+                    break;
+                case LL_rxor:
+                    b(0x48); b(0x33); b(0x07); // xor rax, [rdi]
+                    break;
+                }
+                result(op, pops, false);
+            }
+            return true;
+        case LL_rceq:
+        case LL_rclt:
+        case LL_rcgt:
+            {
+                const int pops = sources(op);
+                if( op.op != LL_rceq )
+                {
+                    cmpType(RSI, MemSlot::I);
+                    guard(NE, pc);
+                }
+                dest(op, pops, pc);
+                b(0x48); b(0x8b); b(0x06); // mov rax, [rsi]
+                b(0x48); b(0x3b); b(0x07); // cmp rax, [rdi]
+                b(0x0f); b(0x90 | ( op.op == LL_rceq ? E : op.op == LL_rclt ? L : G )); b(0xc0); // setcc al
+                b(0x0f); b(0xb6); b(0xc0); // movzx eax, al
+                result(op, pops, true);
+            }
+            return true;
+        case LL_rclt_brfalse:
+        case LL_rclt_brtrue:
+        case LL_rcgt_brfalse:
+        case LL_rcgt_brtrue:
+        case LL_rceq_brfalse:
+        case LL_rceq_brtrue:
+            {
+                const int pops = sources(op);
+                if( op.op != LL_rceq_brfalse && op.op != LL_rceq_brtrue )
+                {
+                    cmpType(RSI, MemSlot::I);
+                    guard(NE, pc);
+                }
+                b(0x48); b(0x8b); b(0x06); // mov rax, [rsi]
+                b(0x48); b(0x3b); b(0x07); // cmp rax, [rdi]
+                Operation o = op;
+                o.val = 0; // no result
+                adjust(o, pops);
+                quint8 cc = 0;
+                switch( op.op )
+                {
+                case LL_rclt_brfalse: cc = GE; break;
+                case LL_rclt_brtrue: cc = L; break;
+                case LL_rcgt_brfalse: cc = LE; break;
+                case LL_rcgt_brtrue: cc = G; break;
+                case LL_rceq_brfalse: cc = NE; break;
+                case LL_rceq_brtrue: cc = E; break;
+                }
+                jcc(cc, op.val);
+            }
+            return true;
+        case LL_rbrfalse:
+            {
+                const int pops = source(RSI, op.len >> 16, op, 1);
+                b(0x48); b(0x83); b(0x3e); b(0x00); // cmp qword [rsi], 0
+                Operation o = op;
+                o.val = 0;
+                adjust(o, pops);
+                jcc(E, op.val);
+            }
+            return true;
+        case LL_rmov:
+            source(RSI, op.len >> 16, op, 1);
+            copy(op, pc);
+            return true;
+        case IL_ldarg:
+        case IL_ldloc:
+        case IL_ldvar:
+            {
+                Operation o = op;
+                o.val = RegPush;
+                if( op.op == IL_ldvar )
+                    movImm(RSI, quint64(op.s));
+                else
+                    lea(RSI, RBX, ( op.op == IL_ldarg ? op.val : pd->proc->params.size() + op.val ) * SZ);
+                copy(o, pc);
+            }
+            return true;
+        case IL_ldc_i4:
+        case IL_ldc_i8:
+            {
+                Operation o = op;
+                o.val = RegPush;
+                dest(o, 0, pc);
+                movImm(RAX, op.i);
+                b(0xb1); b(op.op == IL_ldc_i4 ? 1 : 0); // mov cl, hw
+                result(o, 0, false);
+            }
+            return true;
+        case LL_rdiv:
+        case LL_rrem:
+            {
+                const int pops = sources(op);
+                cmpType(RSI, MemSlot::I);
+                guard(NE, pc);
+                b(0x48); b(0x83); b(0x3f); b(0x00); // cmp qword [rdi], 0
+                guard(E, pc);
+                dest(op, pops, pc);
+                b(0x48); b(0x8b); b(0x06); // mov rax, [rsi]
+                b(0x48); b(0x99); // cqo
+                b(0x48); b(0xf7); b(0x3f); // idiv qword [rdi]
+                if( op.op == LL_rrem )
+                {
+                    b(0x48); b(0x89); b(0xd0); // mov rax, rdx
+                }
+                b(0x8a); b(0x4e); b(offsetof(MemSlot,hw)); // mov cl, [rsi+hw]
+                if( op.val == RegPush )
+                    lea(RDX, R13, -pops * SZ);
+                else if( op.val < RegConst )
+                    lea(RDX, RBX, op.val * SZ);
+                else
+                    movImm(RDX, quint64(op.s));
+                result(op, pops, false);
+            }
+            return true;
+        default:
+            return false;
+        }
     }
 };
 
+static NativeCode* compileNative(ProcData* pd)
+{
+    NativeGen gen(pd);
+    return gen.generate();
+}
+#endif
+
+ProcData::~ProcData()
+{
+#ifdef _MIC_JIT
+    delete native;
+#endif
+}
+
 class MilInterpreter::Imp
 {
 public:
-    Imp():loader(0),out(stdout) {}
+    enum { StackSize = 256 * 1024 }; // slots
+    enum { HotLimit = 1000 }; // entries and loop iterations before a procedure is compiled to native code
+    enum { MaxCeeParams = 16 };
+    Imp():loader(0),vmStack(0),vmFrames(0),engine(StackEngine),jit(false),ceeDir(0),ceeRunning(0),ceeTick(0),
+        report(false),out(stdout),current(0),coBottom(0),switchFrom(0),switchTo(0)
+    {
+        allocStack(StackSize);
+    }
 
+    SeqHeap heap; // the first member, so it is destroyed after all slots
     MilLoader* loader;
+    // args, locals and operand stack of each call are a frame on the VM stack
+    MemSlot* vmStack;
+    MemSlot* vmEnd;
+    MemSlot* vmTop; // end of the innermost frame
+    quint32 vmSlots;
+    Frame* vmFrames;
+    Frame* vmFramesEnd;
+    Frame* vmFrame; // next free frame
 
     QHash<const char*, ModuleData*> modules; // moduleFullName -> data
     QHash<const MilType*,FlattenedType> flattened;
+    QHash<const MilVariable*,quint32> fieldOffsets; // the offsets of all fields flattened so far
+    QHash<const MilProcedure*,ProcData*> procData; // owned
+    struct CLayout
+    {
+        quint32 size;
+        quint32 align;
+        CLayout(quint32 s = 0, quint32 a = 1):size(s),align(a) {}
+    };
+    QHash<const MilType*,CLayout> layouts; // C layout, see cLayout
     typedef QList< QList<int> > LoopStack;
     struct MilLabel
     {
@@ -307,9 +1067,38 @@ public:
         MilLabel():labelPc(0){}
     };
     typedef QHash<const char*,MilLabel> Labels;
+    struct Branch
+    {
+        quint8 op; // IL_invalid: decode as is, IL_nop: drop, IL_pop or LL_op
+        quint8 last;
+        quint32 target; // body index
+        Branch(quint8 op = IL_invalid, quint32 target = 0):op(op),last(0),target(target) {}
+    };
+    typedef QVector<Branch> Branches;
+    quint8 engine;
+    bool jit; // implies the register form
+    MemSlot* nativeSp; // sp on exit from native code
+    struct CeeUnit
+    {
+        // the C source of a hot procedure and its callees, compiled to a shared library in the background
+        ProcData* pd;
+        QString path; // without suffix
+        QProcess* proc;
+        QLibrary* lib;
+        CeeUnit():pd(0),proc(0),lib(0) {}
+        ~CeeUnit() { delete proc; delete lib; }
+    };
+    QString cc; // the C compiler of the C tier, empty if off
+    QList<CeeUnit*> ceeUnits; // owned
+    QTemporaryDir* ceeDir; // private to this interpreter, holds the files of the units while compiling
+    quint32 ceeRunning;
+    quint32 ceeTick;
+    bool report; // collect fusion statistics
+    QHash<quint32,quint32> fusedCount; // superinstruction -> sites
+    QHash<quint32,quint32> pairCount; // op << 16 | next op -> sites not fused
     typedef QHash<QByteArray,MemSlot*> Strings;
     Strings strings; // internalized strings
-    QByteArray intrinsicMod, outMod, inputMod, mathlMod;
+    QByteArray intrinsicMod;
     typedef QHash<const char*, MilProcedure> Intrinsics;
     Intrinsics intrinsics;
     QTextStream out;
@@ -327,6 +1116,70 @@ public:
             MemSlot::dispose(i.value());
             i.value() = 0;
         }
+        for( int j = 0; j < ceeUnits.size(); j++ )
+        {
+            delete ceeUnits[j]->proc; // still running
+            ceeUnits[j]->proc = 0;
+        }
+        delete ceeDir; // removes the files left by the compilers
+        for( int j = 0; j < files.size(); j++ )
+        {
+            delete files[j].file;
+            MemSlot::dispose(files[j].handle);
+        }
+        qDeleteAll(foreign);
+        qDeleteAll(libraries);
+        for( Coroutines::iterator j = coroutines.begin(); j != coroutines.end(); ++j )
+        {
+            coPool.append(j.value()->seg);
+            delete j.value();
+        }
+        for( int j = 0; j < coPool.size(); j++ )
+        {
+            delete[] coPool[j].stack;
+            delete[] coPool[j].frames;
+        }
+        qDeleteAll(procData);
+        qDeleteAll(modules);
+        qDeleteAll(ceeUnits);
+        delete[] vmStack;
+        delete[] vmFrames;
+    }
+
+    void allocStack(quint32 slots)
+    {
+        delete[] vmStack;
+        delete[] vmFrames;
+        vmStack = new MemSlot[slots];
+        vmSlots = slots;
+        vmFrames = new Frame[slots / 4 + 1];
+        resetStack();
+    }
+
+    void resetStack()
+    {
+        vmTop = vmStack;
+        vmFrame = vmFrames;
+        vmEnd = vmStack + vmSlots;
+        // a frame needs at least a few slots, so this suffices for any practical recursion
+        vmFramesEnd = vmFrames + vmSlots / 4 + 1;
+        // the coroutines suspended on the VM stack, and the one a failed run was in, would resume
+        // frames which are gone; the others keep their own segments and survive the reset
+        for( Coroutines::iterator i = coroutines.begin(); i != coroutines.end(); )
+        {
+            Coroutine* co = i.value();
+            if( co == current || co->seg.stack == 0 )
+            {
+                if( co->seg.stack )
+                    coPool.append(co->seg);
+                delete co;
+                i = coroutines.erase(i);
+            }else
+                ++i;
+        }
+        current = 0; // a previous run might have failed in a coroutine
+        coBottom = 0;
+        switchFrom = switchTo = 0;
     }
 
     void dump(const MemSlot& s)
@@ -397,13 +1250,13 @@ public:
             out << endl;
         }
     }
-    void dump(const QList<MemSlot>& stack)
+    void dump(const MemSlot* stack, const MemSlot* sp)
     {
         out << "*** stack:" << endl;
-        for( int i = 0; i < stack.size(); i++ )
+        for( const MemSlot* s = stack; s < sp; s++ )
         {
-            out << (i - stack.size() + 1) << ": ";
-            dump(stack[i]);
+            out << (s - sp + 1) << ": ";
+            dump(*s);
             out << endl;
         }
     }
@@ -413,12 +1266,19 @@ public:
         MemSlot* s = strings.value(str);
         if( s == 0 )
         {
-            s = createSequence(str.size());
+            // hex literals carry their terminating zero, quoted ones like assert file names don't
+            const bool terminated = !str.isEmpty() && str.at(str.size() - 1) == 0;
+            s = createSequence(str.size() + (terminated ? 0 : 1));
             for( int i = 0; i < str.size(); i++ )
             {
                 s[i].t = MemSlot::U;
                 s[i].u = (quint8)str[i];
             }
+            if( !terminated )
+            {
+                s[str.size()].t = MemSlot::U;
+                s[str.size()].u = 0;
+            }
             strings[str] = s;
         }
         return s;
@@ -446,10 +1306,14 @@ public:
     void initSlot(ModuleData* module, MemSlot& s, const MilQuali& type )
     {
         FlattenedType* t = getFlattenedType(module, type);
+        initSlot(s, t, t ? MemSlot::Invalid : fromSymbol(type));  // if t == 0 maybe intrinsic type
+    }
+
+    void initSlot(MemSlot& s, FlattenedType* t, quint8 scalar )
+    {
         if( t == 0 )
         {
-            // maybe intrinsic type
-            s.t = fromSymbol(type);
+            s.t = (MemSlot::Type)scalar;
             return;
         }
         switch( t->type->kind )
@@ -460,7 +1324,7 @@ public:
             s.clear();
             s.t = MemSlot::Record;
             s.p = createSequence(t->fields.size() + (t->type->kind == MilEmitter::Object ? 1 : 0));
-            initFields(module, s.p, t->fields);
+            initFields(t, s.p);
             if( t->type->kind == MilEmitter::Object )
                 s.p[0] = t;
             break;
@@ -468,7 +1332,7 @@ public:
             s.clear();
             s.t = MemSlot::Array;
             s.p = createSequence(t->len);
-            initArray(module, s.p, t->type->base);
+            initArray(t->module, s.p, t->type->base);
             break;
         case MilEmitter::Pointer:
             s.t = MemSlot::Pointer;
@@ -480,10 +1344,8 @@ public:
 
     }
 
-    void initArray(ModuleData* module, MemSlot* ss, const MilQuali& etype )
+    FlattenedType* elementType(ModuleData* module, const MilQuali& etype, quint8& scalar)
     {
-        MemSlot* header = ss-1;
-        Q_ASSERT( header->t == MemSlot::Header );
         MilQuali q = etype;
         FlattenedType* t = getFlattenedType(module,q);
         while( t && t->type->kind == MilEmitter::Array )
@@ -491,12 +1353,27 @@ public:
             // skip embedded arrays since multi-dim were flattened already and
             // we just initialize the flattened one with the ultimate element type
             q = t->type->base;
-            t = getFlattenedType(module,q);
+            t = getFlattenedType(t->module,q);
         }
-        //if( t == 0 || (t->type->kind != MilEmitter::Struct && t->type->kind != MilEmitter::Union) )
+        scalar = t ? MemSlot::Invalid : fromSymbol(q);
+        return t;
+    }
+
+    void initArray(ModuleData* module, MemSlot* ss, const MilQuali& etype )
+    {
+        quint8 scalar;
+        FlattenedType* t = elementType(module, etype, scalar);
+        initArray(ss, t, scalar);
+    }
+
+    void initArray(MemSlot* ss, FlattenedType* t, quint8 scalar )
+    {
+        MemSlot* header = ss-1;
+        Q_ASSERT( header->t == MemSlot::Header );
+        //if( t == 0 || (t->type->kind != MilEmitter::Struct && t->type->kind != MilEmitter::Union) )
         //    return; // scalar or no struct/union type, no initialisation required
         for( int i = 0; i < header->u; i++ )
-            initSlot(module,ss[i],q);
+            initSlot(ss[i],t,scalar);
     }
 
     void initVars(ModuleData* module, MemSlot* ss, const QList<MilVariable>& types )
@@ -506,16 +1383,10 @@ public:
             initSlot(module, ss[i], types[i].type);
     }
 
-    void initFields( ModuleData* module, MemSlot* ss, const QList<MilVariable*>& types )
+    void initFields( FlattenedType* t, MemSlot* ss )
     {
-        for(int i = 0; i < types.size(); i++ )
-        {
-            FlattenedType* t = getFlattenedType(module,types[i]->type);
-            //if( t == 0 || t->type->kind != MilEmitter::Array )
-                // skip embedded structs/unions since they were flattened already
-            //    continue;
-            initSlot(module, ss[types[i]->offset], types[i]->type);
-        }
+        for(int i = 0; i < t->fields.size(); i++ )
+            initSlot(t->module, ss[t->offsets[i]], t->fields[i]->type);
     }
 
     ModuleData* loadModule(const QByteArray& fullName)
@@ -555,11 +1426,7 @@ public:
             }
         }
         if( init )
-        {
-            MemSlotList args;
-            MemSlot ret;
-            execute(md, init, args, ret);
-        }
+            execute(getProcData(md, init), vmTop);
         return md;
     }
 
@@ -602,6 +1469,12 @@ public:
             .arg(proc->name.constData()).arg(s_opName[proc->body[pc].op]).arg(pc).arg(msg);
     }
 
+    void execError(ProcData* pd, int pc, const QString& msg)
+    {
+        // pc is an index into the pre-decoded ops
+        execError(pd->module, pd->proc, pd->pcs[pc], msg);
+    }
+
     void execError(ModuleData* module, const MilProcedure* proc, const QString& msg = QString())
     {
         Q_ASSERT(module);
@@ -629,17 +1502,29 @@ public:
         return QPair<MilType*,ModuleData*>();
     }
 
-    bool isA( ModuleData* module, FlattenedType* sub, FlattenedType* super )
+    static bool isA( FlattenedType* sub, FlattenedType* super )
     {
+        // super is a base of sub if it is at its own level in the display of sub
         if( sub == 0 || super == 0 )
             return false;
-        while(sub)
-        {
-            if( sub == super )
-                return true;
-            sub = getFlattenedType(module, sub->type->base );
-        }
-        return false;
+        if( sub == super )
+            return true;
+        const int level = super->display.size() - 1;
+        return level >= 0 && level < sub->display.size() && sub->display[level] == super;
+    }
+
+    static inline FlattenedType* typeOfObject(const MemSlot& ptr)
+    {
+        // the type tag of the object ptr points to; that is either a variable or field holding the
+        // object, or the object sequence itself, e.g. from newobj; 0 if there is no tag
+        if( ptr.t != MemSlot::Pointer || ptr.p == 0 )
+            return 0;
+        const MemSlot* obj = ptr.p;
+        if( !ptr.embedded && obj->t == MemSlot::Record )
+            obj = obj->p;
+        if( obj == 0 || obj->t != MemSlot::TypeTag )
+            return 0;
+        return obj->tt;
     }
 
     FlattenedType* getFlattenedType(ModuleData* module, const MilQuali& q)
@@ -663,15 +1548,16 @@ public:
                     {
                         out.fields << baseType->fields;
                         out.vtable = baseType->vtable;
+                        out.display = baseType->display;
                     }
+                    out.display << &out;
                 }
                 for( int i = 0; i < ty->fields.size(); i++ )
                 {
                     FlattenedType* fieldType = getFlattenedType(module, ty->fields[i].type);
                     // fieldType is null e.g. in case of int32
-                    ty->fields[i].offset = out.fields.size();
-                    if( ty->kind == MilEmitter::Object )
-                        ty->fields[i].offset++; // make room for the vtable pointer in index 0
+                    // make room for the vtable pointer in index 0 of objects
+                    fieldOffsets[&ty->fields[i]] = out.fields.size() + ( ty->kind == MilEmitter::Object ? 1 : 0 );
                     if( fieldType && !fieldType->fields.isEmpty() )
                     {
                         // field is itself a struct or union, use the flattened fields
@@ -683,29 +1569,28 @@ public:
                 for( int i = 0; i < ty->methods.size(); i++ )
                 {
                     const char* name = ty->methods[i].name.constData();
-                    ty->methods[i].offset = out.vtable.size();
+                    ProcData* pd = getProcData(mt.second, &ty->methods[i]);
                     bool found = false;
                     for(int j = 0; j < out.vtable.size(); j++ )
                     {
                         // look up the method in the inherited vtable and replace it there if it's an override
-                        if( out.vtable[j].proc->name.constData() == name )
+                        if( out.vtable[j]->proc->name.constData() == name )
                         {
-                            out.vtable[j].proc = &ty->methods[i];
-                            out.vtable[j].module = mt.second;
+                            out.vtable[j] = pd;
                             found = true;
                             break;
                         }
                     }
                     if( !found )
                         // otherwise it's a new method, append it to the vtable
-                        out.vtable << ProcData(&ty->methods[i], mt.second);
+                        out.vtable << pd;
                 }
             }else if( ty->kind == MilEmitter::Union )
             {
                 for( int i = 0; i < ty->fields.size(); i++ )
                 {
                     FlattenedType* fieldType = getFlattenedType(module, ty->fields[i].type);
-                    ty->fields[i].offset = 0;
+                    fieldOffsets[&ty->fields[i]] = 0;
                     if( fieldType && !fieldType->fields.isEmpty() )
                     {
                         // field is itself a struct or union, use the flattened fields
@@ -726,10 +1611,120 @@ public:
                 }
             }
             out.type = ty;
+            out.offsets.resize(out.fields.size());
+            for( int i = 0; i < out.fields.size(); i++ )
+                out.offsets[i] = fieldOffsets.value(out.fields[i]);
         }
         return &out;
     }
 
+    void cFields(ModuleData* module, MilType* ty, quint64& pos, quint32& align)
+    {
+        // lays out the fields of ty from bit position pos on; the fields of an object follow the class
+        // pointer or the fields of its base type without the tail padding of the base, as in CeeGen.
+        // A bit field goes to the next free bit unless it would cross a boundary of its type's size.
+        if( ty->kind == MilEmitter::Object )
+        {
+            if( ty->base.second.isEmpty() )
+            {
+                pos = sizeof(void*) * 8;
+                align = qMax(align, quint32(sizeof(void*)));
+            }else
+            {
+                QPair<MilType*,ModuleData*> base = getType(module,ty->base);
+                if( base.first )
+                    cFields(base.second, base.first, pos, align);
+            }
+        }
+        for( int i = 0; i < ty->fields.size(); i++ )
+        {
+            const MilVariable& f = ty->fields[i];
+            const CLayout fl = cLayout(module, f.type);
+            if( f.bits )
+            {
+                const quint32 unit = fl.size * 8;
+                if( unit && pos / unit != ( pos + f.bits - 1 ) / unit )
+                    pos = ( pos + unit - 1 ) / unit * unit;
+                pos += f.bits;
+            }else
+            {
+                const quint64 off = ( pos + 7 ) / 8;
+                pos = ( ( off + fl.align - 1 ) / fl.align * fl.align + fl.size ) * 8;
+            }
+            align = qMax(align, fl.align);
+        }
+    }
+
+    CLayout cLayout(ModuleData* module, const MilQuali& q)
+    {
+        // size and alignment in bytes with the natural alignment of a C compiler, as the C backend
+        // would lay out the type; fields are not reordered, see cFields for the struct rules
+        const quint32 ptr = sizeof(void*);
+        QPair<MilType*,ModuleData*> mt = getType(module,q);
+        if( mt.first == 0 )
+        {
+            switch( MilEmitter::fromSymbol(q.second) )
+            {
+            case MilEmitter::I1: case MilEmitter::U1:
+                return CLayout(1,1);
+            case MilEmitter::I2: case MilEmitter::U2:
+                return CLayout(2,2);
+            case MilEmitter::I4: case MilEmitter::U4: case MilEmitter::R4:
+                return CLayout(4,4);
+            case MilEmitter::I8: case MilEmitter::U8: case MilEmitter::R8:
+                return CLayout(8,8);
+            case MilEmitter::IntPtr: case MilEmitter::IPP:
+                return CLayout(ptr,ptr);
+            default:
+                return CLayout();
+            }
+        }
+        MilType* ty = mt.first;
+        if( layouts.contains(ty) )
+            return layouts.value(ty);
+        CLayout res;
+        switch( ty->kind )
+        {
+        case MilEmitter::Alias:
+            res = cLayout(mt.second, ty->base);
+            break;
+        case MilEmitter::Pointer:
+        case MilEmitter::ProcType:
+            res = CLayout(ptr,ptr);
+            break;
+        case MilEmitter::MethType:
+            res = CLayout(2 * ptr,ptr); // object and procedure
+            break;
+        case MilEmitter::Array:
+            {
+                const CLayout elem = cLayout(mt.second, ty->base);
+                res = CLayout(elem.size * ty->len, elem.align);
+            }
+            break;
+        case MilEmitter::Struct:
+        case MilEmitter::Object:
+            {
+                quint64 pos = 0;
+                cFields(mt.second, ty, pos, res.align);
+                res.size = ( pos + 7 ) / 8;
+                res.size = ( res.size + res.align - 1 ) / res.align * res.align;
+            }
+            break;
+        case MilEmitter::Union:
+            for( int i = 0; i < ty->fields.size(); i++ )
+            {
+                const MilVariable& f = ty->fields[i];
+                const CLayout fl = cLayout(mt.second, f.type);
+                res.size = qMax(res.size, f.bits ? ( f.bits + 7 ) / 8 : fl.size);
+                res.align = qMax(res.align, fl.align);
+            }
+            res.size = ( res.size + res.align - 1 ) / res.align * res.align;
+            break;
+        }
+        layouts.insert(ty,res);
+        return res;
+    }
+
     ProcData* getProc(ModuleData* module, const MilQuali& q)
     {
         ModuleData* m = q.first.isEmpty() ? module : loadModule(q.first);
@@ -753,147 +1748,169 @@ public:
                 return 0; // error?
             proc = &m->module->procs[what.second];
         }
-        res = new ProcData(proc, m);
+        res = getProcData(m, proc);
         m->procs.insert(q.second.constData(), res);
         return res;
     }
 
-    void prepareBytecode(ModuleData* module, MilProcedure* proc, qint32& pc, Labels& labels, LoopStack& loopStack)
+    ProcData* getProcData(ModuleData* module, MilProcedure* proc)
+    {
+        ProcData*& pd = procData[proc];
+        if( pd == 0 )
+            pd = new ProcData(proc, module);
+        return pd;
+    }
+
+    void prepareBytecode(ModuleData* module, MilProcedure* proc, qint32& pc, Branches& br,
+                         Labels& labels, LoopStack& loopStack)
     {
-        QList<MilOperation>& ops = proc->body;
+        // resolve the structured statements to jumps; br collects the jump targets in body indices
+        const QList<MilOperation>& ops = proc->body;
         const int start = pc;
         switch(ops[pc].op)
         {
         case IL_while:
             {
-                // end -> while+1, then -> end+1
+                // while -> nop, do -> brfalse end+1, end -> jump while+1
+                br[pc].op = IL_nop;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_do )
-                    prepareBytecode(module, proc,pc, labels, loopStack);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack);
                 assureValid(module,proc,start,pc,IL_do);
                 const int then = pc;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_end )
-                    prepareBytecode(module, proc, pc, labels, loopStack); // look for nested statements
+                    prepareBytecode(module, proc, pc, br, labels, loopStack); // look for nested statements
                 assureValid(module,proc,start,pc,IL_end);
-                ops[pc].index = start+1; // end jumps to while+1
+                br[pc] = Branch(LL_jump, start+1);
                 pc++;
-                ops[then].index = pc; // then jumps to end+1
+                br[then] = Branch(LL_brfalse, pc);
             }
             break;
         case IL_switch:
             {
                 // switch -> case -> case -> else -> end
+                // the switch value stays on the stack until a case matches or the last case fails;
+                // the label test is done by 'then', the first 'case' is dropped, the other 'case' and
+                // the 'else' are only reached from the end of the preceding case and jump to end
+                br[pc].op = IL_nop;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_case &&
                        ops[pc].op != IL_else && ops[pc].op != IL_end )
-                    prepareBytecode(module, proc,pc, labels, loopStack);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack);
                 assureValid(module,proc,start,pc,IL_case, IL_else, IL_end);
-                int prev = start;
-                QList<quint32> thenList;
+                QList<quint32> exits;
+                int test = -1;
+                bool hasElse = false;
                 while( ops[pc].op == IL_case )
                 {
-                    ops[prev].index = pc;
-                    prev = pc;
+                    if( test < 0 )
+                        br[pc].op = IL_nop;
+                    else
+                    {
+                        exits.append(pc);
+                        br[test].target = pc+1; // next test
+                    }
                     pc++;
                     assureValid(module,proc,start,pc,IL_then);
-                    thenList.append(pc);
+                    test = pc;
+                    br[pc].op = LL_case;
                     pc++;
                     while( pc < ops.size() && ops[pc].op != IL_case &&
                            ops[pc].op != IL_else && ops[pc].op != IL_end )
-                        prepareBytecode(module, proc, pc, labels, loopStack); // look for nested statements
+                        prepareBytecode(module, proc, pc, br, labels, loopStack); // look for nested statements
                     assureValid(module,proc,start,pc,IL_case, IL_else, IL_end);
                 }
                 if( ops[pc].op == IL_else )
                 {
-                    ops[prev].index = pc;
-                    prev = pc;
-                    thenList.append(pc);
+                    hasElse = true;
+                    if( test < 0 )
+                        br[pc].op = IL_pop; // no case, just drop the value
+                    else
+                    {
+                        exits.append(pc);
+                        br[test].target = pc+1;
+                        br[test].last = 1;
+                        test = -1;
+                    }
                     pc++;
                     while( pc < ops.size() && ops[pc].op != IL_end )
-                        prepareBytecode(module, proc, pc, labels, loopStack);
+                        prepareBytecode(module, proc, pc, br, labels, loopStack);
                 }
                 assureValid(module,proc,start,pc,IL_end);
-                foreach( quint32 off, thenList )
-                    ops[off].index = pc; // all then and else point to end
+                if( test >= 0 )
+                {
+                    br[test].target = pc;
+                    br[test].last = 1;
+                }
+                br[pc].op = !hasElse && exits.isEmpty() && test < 0 ? IL_pop : IL_nop;
+                foreach( quint32 off, exits )
+                    br[off] = Branch(LL_jump, pc);
                 pc++;
             }
             break;
         case IL_if:
+        case IL_iif:
             {
-                // if -> then -> else -> end
+                // if -> nop, then -> brfalse else+1 or end, else -> jump end, end -> nop
+                br[pc].op = IL_nop;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_then )
-                    prepareBytecode(module, proc,pc, labels, loopStack);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack);
                 assureValid(module,proc,start,pc, IL_then);
                 int then = pc;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_else && ops[pc].op != IL_end)
-                    prepareBytecode(module, proc, pc, labels, loopStack); // then statements
-                assureValid(module,proc,start,pc, IL_else, IL_end);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack); // then statements
+                if( ops[start].op == IL_iif )
+                    assureValid(module,proc,start,pc, IL_else);
+                else
+                    assureValid(module,proc,start,pc, IL_else, IL_end);
                 if( ops[pc].op == IL_else )
                 {
-                    ops[then].index = pc+1; // then -> else+1
+                    br[then] = Branch(LL_brfalse, pc+1);
                     const int else_ = pc;
                     pc++;
                     while( pc < ops.size() && ops[pc].op != IL_end )
-                        prepareBytecode(module, proc, pc, labels, loopStack); // else statements
-                    ops[else_].index = pc; // else -> end
+                        prepareBytecode(module, proc, pc, br, labels, loopStack); // else statements
+                    br[else_] = Branch(LL_jump, pc);
                 }else
-                    ops[then].index = pc; // then -> end
-                assureValid(module,proc,start,pc,IL_end);
-                pc++;
-            }
-            break;
-        case IL_iif:
-            {
-                // iif -> then -> else -> end
-                pc++;
-                while( pc < ops.size() && ops[pc].op != IL_then )
-                    prepareBytecode(module, proc,pc, labels, loopStack);
-                assureValid(module,proc,start,pc, IL_then);
-                int then = pc;
-                pc++;
-                while( pc < ops.size() && ops[pc].op != IL_else)
-                    prepareBytecode(module, proc, pc, labels, loopStack); // then statements
-                assureValid(module,proc,start,pc, IL_else);
-                ops[then].index = pc+1; // then -> else+1
-                const int else_ = pc;
-                pc++;
-                while( pc < ops.size() && ops[pc].op != IL_end )
-                    prepareBytecode(module, proc, pc, labels, loopStack); // else statements
-                ops[else_].index = pc; // else -> end
+                    br[then] = Branch(LL_brfalse, pc);
                 assureValid(module,proc,start,pc,IL_end);
+                br[pc].op = IL_nop;
                 pc++;
             }
             break;
         case IL_repeat:
             {
-                // end -> repeat+1
+                // repeat -> nop, until -> nop, end -> brfalse repeat+1
+                br[pc].op = IL_nop;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_until )
-                    prepareBytecode(module, proc, pc, labels, loopStack);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack);
                 assureValid(module,proc,start,pc, IL_until);
+                br[pc].op = IL_nop;
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_end )
-                    prepareBytecode(module, proc,pc, labels, loopStack);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack);
                 assureValid(module,proc,start,pc, IL_end);
-                ops[pc].index = start+1;
+                br[pc] = Branch(LL_brfalse, start+1);
                 pc++;
             }
             break;
         case IL_loop:
             {
-                // end -> loop
+                // loop -> nop, end -> jump loop+1, exit -> jump end+1
+                br[pc].op = IL_nop;
                 loopStack.push_back(QList<int>());
                 pc++;
                 while( pc < ops.size() && ops[pc].op != IL_end )
-                    prepareBytecode(module, proc, pc, labels, loopStack);
+                    prepareBytecode(module, proc, pc, br, labels, loopStack);
                 assureValid(module,proc,start,pc, IL_end);
-                ops[pc].index = start+1;
+                br[pc] = Branch(LL_jump, start+1);
                 pc++;
                 foreach( int exit_, loopStack.back() )
-                    ops[exit_].index = pc;
+                    br[exit_] = Branch(LL_jump, pc);
                 loopStack.pop_back();
             }
             break;
@@ -905,56 +1922,18 @@ public:
             break;
         case IL_label:
             labels[ops[pc].arg.toByteArray().constData()].labelPc = pc;
+            br[pc].op = IL_nop;
             pc++;
             break;
         case IL_goto:
             labels[ops[pc].arg.toByteArray().constData()].gotoPcs.append(pc);
+            br[pc].op = LL_jump;
             pc++;
             break;
-        case IL_ldfld:
-        case IL_ldflda:
-        case IL_stfld:
-            {
-                MilTrident td = ops[pc].arg.value<MilTrident>();
-                FlattenedType* ty = getFlattenedType(module, td.first);
-                if( ty == 0 )
-                    execError(module, proc, pc, QString("unknown type '%1'").
-                              arg(MilEmitter::toString(td.first).constData()));
-                const int idx = ty->type->indexOfField(td.second);
-                if( idx < 0 )
-                    break; // error?
-                ops[pc].index = ty->type->fields[idx].offset;;
-            }
-            pc++;
-            break;
-        case IL_ldmeth:
-            {
-                MilTrident td = ops[pc].arg.value<MilTrident>();
-                FlattenedType* ty = getFlattenedType(module, td.first);
-                if( ty == 0 )
-                    execError(module, proc, pc, QString("unknown type '%1'").
-                              arg(MilEmitter::toString(td.first).constData()));
-                const int idx = ty->lastIndexOfMethod(td.second); // TODO
-                if( idx < 0 )
-                    break; // error?
-                ops[pc].index = ty->vtable[idx].proc->offset;
-            }
-            pc++;
-            break;
-        case IL_ldvar:
-        case IL_ldvara:
-        case IL_stvar:
-            {
-                MilQuali q = ops[pc].arg.value<MilQuali>();
-                MilModule* m = q.first.isEmpty() ? module->module : loader->getModule(q.first);
-                if( m == 0 )
-                    break; // error?
-                const int idx = m->indexOfVar(q.second);
-                if( idx < 0 )
-                    break; // error?
-                // since the module is not a struct we don't flatten structs and the offset is the index in the field list
-                ops[pc].index = idx;
-            }
+        case IL_invalid:
+        case IL_line:
+        case IL_nop:
+            br[pc].op = IL_nop;
             pc++;
             break;
         default:
@@ -963,382 +1942,3320 @@ public:
         }
     }
 
-    void prepareBytecode(ModuleData* module, MilProcedure* proc, qint32& pc)
+    void prepareBytecode(ProcData* pd)
     {
+        ModuleData* module = pd->module;
+        MilProcedure* proc = pd->proc;
+        const QList<MilOperation>& body = proc->body;
+
+        Branches br(body.size());
         Labels labels; // name -> label pos, goto poss
         LoopStack loopStack;
-
-        while( pc < proc->body.size() )
-            prepareBytecode(module, proc, pc, labels, loopStack);
+        qint32 pc = 0;
+        while( pc < body.size() )
+            prepareBytecode(module, proc, pc, br, labels, loopStack);
 
         Labels::const_iterator i;
         for( i = labels.begin(); i != labels.end(); ++i )
         {
             for(int j = 0; j < i.value().gotoPcs.size(); j++ )
-                proc->body[i.value().gotoPcs[j]].index = i.value().labelPc;
+                br[i.value().gotoPcs[j]].target = i.value().labelPc;
+        }
+
+        pd->ops.clear();
+        pd->pcs.clear();
+        pd->labels.clear();
+        pd->switches.clear();
+        pd->sites.clear();
+        QVector<quint32> map(body.size() + 1); // body index -> ops index
+        for( pc = 0; pc < body.size(); pc++ )
+        {
+            map[pc] = pd->ops.size();
+            if( br[pc].op == IL_nop )
+                continue;
+            Operation op;
+            if( br[pc].op != IL_invalid )
+            {
+                op.op = br[pc].op;
+                op.val = br[pc].target;
+                op.len = br[pc].last;
+                if( op.op == LL_case )
+                {
+                    pd->labels.append(body[pc-1].arg.value<CaseLabelList>());
+                    op.i = pd->labels.size() - 1;
+                }
+            }else
+                decode(pd, pc, op);
+            pd->ops.append(op);
+            pd->pcs.append(pc);
+        }
+        map[body.size()] = pd->ops.size();
+        pd->ops.append(Operation(LL_leave));
+        pd->pcs.append(body.size());
+
+        for( pc = 0; pc < pd->ops.size(); pc++ )
+        {
+            Operation& op = pd->ops[pc];
+            if( op.op == LL_jump || op.op == LL_brfalse || op.op == LL_case )
+                op.val = map[op.val];
+        }
+        for( pc = 0; pc < pd->ops.size(); pc++ )
+        {
+            Operation& op = pd->ops[pc];
+            if( op.op != LL_jump && op.op != LL_brfalse && op.op != LL_case )
+                continue;
+            quint32 target = op.val;
+            for( int n = 0; n < pd->ops.size() && pd->ops[target].op == LL_jump; n++ )
+                target = pd->ops[target].val; // jump threading
+            op.val = target;
+        }
+        pd->localsInit = MemSlotList(proc->locals.size());
+        initVars(module, pd->localsInit.data(), proc->locals);
+        QVector<int> depth;
+        pd->stackDepth = qMax(computeStackDepth(pd->ops, depth), (int)proc->stackDepth);
+        if( ceeTier() )
+            pd->stackOps = pd->ops;
+        if( engine == RegisterEngine || jit )
+            toRegisterForm(pd);
+        fuse(pd);
+        buildSwitches(pd);
+        if( jit || ceeTier() )
+        {
+            for( pc = 0; pc < pd->ops.size(); pc++ )
+            {
+                if( pd->ops[pc].op == LL_jump && pd->ops[pc].val <= pc )
+                    pd->ops[pc].op = LL_loop;
+            }
         }
+#if 0
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        Mic::IlAsmRenderer r(&out);
+        Mic::MilLoader::render(&r,module->module);
+        out.putChar('\n');
+#endif
+        pd->prepared = true;
     }
 
-    void inline convertTo( QList<MemSlot>& stack, MemSlot::Type to, quint8 size )
+    static void buildSwitches(ProcData* pd)
     {
-        MemSlot s = stack.takeLast();
-        switch(s.t)
+        // replace the first LL_case of each case chain by an LL_switch over all labels of the chain;
+        // the other LL_case stay in place but are no longer reached
+        enum { MinLabels = 4 };
+        QVector<Operation>& ops = pd->ops;
+        QVector<bool> inner(ops.size(), false);
+        for( int pc = 0; pc < ops.size(); pc++ )
         {
-        case MemSlot::F:
-            if( to != s.t )
-                s.i = s.f;
-            break;
-        case MemSlot::I:
-        case MemSlot::U:
-            if( to == MemSlot::F )
-                s.f = s.i;
-            else if( to == MemSlot::I && size )
+            if( ops[pc].op == LL_case && !ops[pc].len && ops[pc].val < (quint32)ops.size() )
+                inner[ops[pc].val] = true;
+        }
+        for( int head = 0; head < ops.size(); head++ )
+        {
+            if( ops[head].op != LL_case || inner[head] )
+                continue;
+            QMap<qint64,quint32> map; // label -> target, the first case wins
+            int pc = head;
+            while( pc < ops.size() && ops[pc].op == LL_case )
             {
-                s.hw = size && size != 8;
-                switch(size)
+                const CaseLabelList& l = pd->labels[ops[pc].i];
+                for( int i = 0; i < l.size(); i++ )
                 {
-                case 1:
-                    {
-                        qint8 tmp = s.i;
-                        s.i = tmp;
-                        break;
-                    }
-                case 2:
-                    {
-                        qint16 tmp = s.i;
-                        s.i = tmp;
-                        break;
-                    }
-                case 4:
-                    {
-                        qint32 tmp = s.i;
-                        s.i = tmp;
-                        break;
-                    }
+                    if( !map.contains(l[i]) )
+                        map[l[i]] = pc + 1;
                 }
-            }else if( to == MemSlot::U && size )
+                if( ops[pc].len )
+                    break;
+                pc = ops[pc].val;
+            }
+            if( pc >= ops.size() || ops[pc].op != LL_case || map.size() < MinLabels )
+                continue;
+            SwitchTable st;
+            st.other = ops[pc].val;
+            st.low = map.firstKey();
+            const quint64 span = map.lastKey() - st.low;
+            if( span < 2 * (quint64)map.size() + 8 )
             {
-                s.hw = size && size != 8;
-                switch(size)
+                st.dense = QVector<quint32>(int(span) + 1, st.other);
+                QMap<qint64,quint32>::const_iterator i;
+                for( i = map.begin(); i != map.end(); ++i )
+                    st.dense[i.key() - st.low] = i.value();
+            }else
+            {
+                QMap<qint64,quint32>::const_iterator i;
+                for( i = map.begin(); i != map.end(); ++i )
                 {
-                case 1:
-                    {
-                        quint8 tmp = s.u;
-                        s.u = tmp;
-                        break;
-                    }
-                case 2:
-                    {
-                        quint16 tmp = s.u;
-                        s.u = tmp;
-                        break;
-                    }
-                case 4:
+                    if( !st.to.isEmpty() && st.to.last() + 1 == i.key() && st.targets.last() == i.value() )
+                        st.to.last() = i.key();
+                    else
                     {
-                        quint32 tmp = s.u;
-                        s.u = tmp;
-                        break;
+                        st.from.append(i.key());
+                        st.to.append(i.key());
+                        st.targets.append(i.value());
                     }
                 }
             }
-            break;
-        case MemSlot::Pointer:
-            if( to == MemSlot::F )
-                s.f = s.i;
-            break;
-        default:
-            s.u = 0;
-            if( size && size < 8 )
-                s.hw = true;
-            break;
+            Operation& op = ops[head];
+            op.op = LL_switch;
+            op.val = st.other;
+            op.len = 0;
+            op.i = pd->switches.size();
+            pd->switches.append(st);
         }
-        s.t = to;
-        stack.push_back(s);
     }
 
-    void convert(MemSlot& out, const QVariant& data )
+    static inline bool isBranch(quint8 op)
     {
-        out.clear();
-        if( data.canConvert<MilRecordLiteral>() )
+        return op == LL_jump || op == LL_brfalse || op == LL_case || op == LL_brtrue || op == LL_loop ||
+                op == LL_switch ||
+                ( op >= LL_clt_brfalse && op <= LL_ceq_brtrue ) ||
+                ( op >= LL_rclt_brfalse && op <= LL_rbrfalse );
+    }
+
+    static inline bool isStind(quint8 op)
+    {
+        return op == IL_stind_i1 || op == IL_stind_i2 || op == IL_stind_i4 || op == IL_stind_i8;
+    }
+
+    static int match(const QVector<Operation>& ops, const QVector<bool>& target, int pc, Operation& res)
+    {
+        // returns the number of ops fused into res, or 0
+        const int n = ops.size() - pc;
+        for( int i = 1; i < 5 && i < n; i++ )
         {
-            // TODO: flatten embedded elements
-            MilRecordLiteral m = data.value<MilRecordLiteral>();
-            out.p = createSequence(m.size());
-            out.t = MemSlot::Record;
-            for( int i = 0; i < m.size(); i++ )
-                convert(out.p[i], m[i].second);
-            return;
+            if( target[pc+i] )
+            {
+                if( i == 1 )
+                    return 0;
+                break;
+            }
         }
-        switch( data.type() )
+        const Operation* o = ops.constData() + pc;
+        if( n >= 5 && !target[pc+1] && !target[pc+2] && !target[pc+3] && !target[pc+4] &&
+                o[2].op == IL_ldc_i4 && (o[3].op == IL_add || o[3].op == IL_sub) && isStind(o[4].op) )
         {
-        case QVariant::List:
+            if( o[0].op == IL_ldvara && o[1].op == IL_ldvar && o[0].s == o[1].s )
             {
-                // TODO: flatten multi-dim arrays
-                QVariantList l = data.toList();
-                out.p = createSequence(l.size());
-                out.t = MemSlot::Array;
-                for( int i = 0; i < l.size(); i++ )
-                    convert(out.p[i], l[i]);
+                res.op = o[3].op == IL_add ? LL_incvar : LL_decvar;
+                res.s = o[0].s;
+                res.len = o[2].i;
+                return 5;
             }
-            break;
-        case QVariant::ByteArray:
-            out.p = internalize(data.toByteArray());
-            out.t = MemSlot::Pointer;
-            break;
-        case QVariant::String:
-            out.p = internalize(data.toString().toLatin1());
-            out.t = MemSlot::Pointer;
-            break;
-        case QVariant::LongLong:
-        case QVariant::Int:
-        case QVariant::Bool:
-            out.i = data.toLongLong();
+            if( o[0].op == IL_ldloca && o[1].op == IL_ldloc && o[0].val == o[1].val )
+            {
+                res.op = o[3].op == IL_add ? LL_incloc : LL_decloc;
+                res.val = o[0].val;
+                res.len = o[2].i;
+                return 5;
+            }
+        }
+        const bool cmp = o[0].op == IL_clt || o[0].op == IL_clt_un || o[0].op == IL_cgt ||
+                o[0].op == IL_cgt_un || o[0].op == IL_ceq;
+        const int cmpOp = o[0].op == IL_ceq ? LL_ceq_brfalse :
+                          ( o[0].op == IL_cgt || o[0].op == IL_cgt_un ) ? LL_cgt_brfalse : LL_clt_brfalse;
+        const int brtrue = cmp ? 1 : 0;
+        if( n >= 3 + brtrue && !target[pc+1] && !target[pc+2] && ( !brtrue || !target[pc+3] ) &&
+                o[brtrue].op == IL_ldc_i4 && o[brtrue].i == 0 && o[brtrue+1].op == IL_ceq &&
+                o[brtrue+2].op == LL_brfalse )
+        {
+            res.op = cmp ? cmpOp + 1 : LL_brtrue;
+            res.val = o[brtrue+2].val;
+            return 3 + brtrue;
+        }
+        if( cmp && n >= 2 && o[1].op == LL_brfalse )
+        {
+            res.op = cmpOp;
+            res.val = o[1].val;
+            return 2;
+        }
+        if( n >= 2 && o[0].op == IL_ldc_i4 && ( o[1].op == IL_add || o[1].op == IL_sub ) )
+        {
+            res.op = o[1].op == IL_add ? LL_addi : LL_subi;
+            res.i = o[0].i;
+            return 2;
+        }
+        if( n >= 2 && o[0].op == IL_ldarg && o[1].op == IL_ldfld && o[1].len == 0 )
+        {
+            res.op = LL_ldarg_ldfld;
+            res.val = o[0].val;
+            res.len = o[1].val;
+            return 2;
+        }
+        return 0;
+    }
+
+    void fuse(ProcData* pd)
+    {
+        // replace frequent op sequences by superinstructions; a jump target can only be the
+        // first op of a sequence
+        const QVector<Operation>& ops = pd->ops;
+        QVector<bool> target(ops.size() + 1, false);
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            if( isBranch(ops[pc].op) )
+                target[ops[pc].val] = true;
+        }
+        QVector<Operation> res;
+        QVector<quint32> pcs;
+        QVector<quint32> map(ops.size()); // old ops index -> new ops index
+        int pc = 0;
+        while( pc < ops.size() )
+        {
+            Operation op;
+            const int n = match(ops, target, pc, op);
+            if( n )
+            {
+                for( int i = 0; i < n; i++ )
+                    map[pc+i] = res.size();
+                pcs.append(pd->pcs[pc+n-1]);
+                res.append(op);
+                if( report )
+                    fusedCount[op.op]++;
+                pc += n;
+            }else
+            {
+                if( report && pc + 1 < ops.size() )
+                    pairCount[ops[pc].op << 16 | ops[pc+1].op]++;
+                map[pc] = res.size();
+                pcs.append(pd->pcs[pc]);
+                res.append(ops[pc]);
+                pc++;
+            }
+        }
+        for( pc = 0; pc < res.size(); pc++ )
+        {
+            if( isBranch(res[pc].op) )
+                res[pc].val = map[res[pc].val];
+        }
+        pd->ops = res;
+        pd->pcs = pcs;
+    }
+
+    struct RegEntry
+    {
+        // an operand stack position while translating to register form
+        enum Kind { Stack, // the value is on the VM operand stack
+                    Pending, // the push at ops index pos is not yet emitted, src reads it in place
+                    Result, // pushed by the register op at index pos
+                    NegCmp // as Result, but logically negated by ldc_i4 0, ceq
+                  };
+        quint8 kind;
+        quint16 src;
+        int pos;
+        RegEntry(quint8 k = Stack, quint16 s = RegPop, int p = -1):kind(k),src(s),pos(p) {}
+    };
+    struct RegGen
+    {
+        const QVector<Operation>* ops;
+        QVector<Operation> res;
+        QVector<quint32> pcs;
+        QList<RegEntry> stack;
+        int barrier; // res ops before this index are not modified any more
+        QHash<QPair<quint64,quint16>,quint16> consts; // value and type, hw -> source of ProcData::consts
+    };
+
+    static inline bool isScalarStore(quint8 op)
+    {
+        return op >= IL_stind_i1 && op <= IL_stind_ipp;
+    }
+
+    static int stackPops(const Operation& op)
+    {
+        // the number of operands consumed by op, or -1 if not known
+        switch( op.op )
+        {
+        case IL_ldarg: case IL_ldarga: case IL_ldc_i4: case IL_ldc_i8: case IL_ldc_r4: case IL_ldc_r8:
+        case IL_ldobj: case IL_ldloc: case IL_ldloca: case IL_ldnull: case IL_ldproc: case IL_ldstr:
+        case IL_ldvar: case IL_ldvara: case IL_sizeof: case IL_newobj:
+            return 0;
+        case IL_abs: case IL_neg: case IL_not: case IL_castptr: case IL_ldfld: case IL_ldflda:
+        case IL_conv_i1: case IL_conv_i2: case IL_conv_i4: case IL_conv_i8: case IL_conv_r4: case IL_conv_r8:
+        case IL_conv_u1: case IL_conv_u2: case IL_conv_u4: case IL_conv_u8: case IL_conv_ip:
+        case IL_ldind_i1: case IL_ldind_i2: case IL_ldind_i4: case IL_ldind_i8: case IL_ldind_u1:
+        case IL_ldind_u2: case IL_ldind_u4: case IL_ldind_r4: case IL_ldind_u8: case IL_ldind_r8:
+        case IL_ldind_ip: case IL_ldind_ipp: case IL_ldind:
+        case IL_initobj: case IL_free: case IL_pop: case IL_starg: case IL_stloc: case IL_stvar:
+            return 1;
+        case IL_add: case IL_and: case IL_ceq: case IL_cgt: case IL_cgt_un: case IL_clt: case IL_clt_un:
+        case IL_div: case IL_div_un: case IL_mul: case IL_or: case IL_rem: case IL_rem_un:
+        case IL_shl: case IL_shr: case IL_shr_un: case IL_sub: case IL_xor:
+        case IL_ldelem: case IL_ldelema: case IL_ptroff:
+        case IL_stfld: case IL_stind_i1: case IL_stind_i2: case IL_stind_i4: case IL_stind_i8:
+        case IL_stind_r4: case IL_stind_r8: case IL_stind_ip: case IL_stind_ipp: case IL_stind:
+            return 2;
+        case IL_stelem: case IL_stelem_i1:
+            return 3;
+        case IL_call:
+        case IL_callvirt:
+        case LL_setin: case LL_setdiv: case LL_relop: case LL_strlen: case LL_intrinsic:
+            if( op.pd )
+                return op.pd->proc->params.size();
+            return -1;
+        default:
+            return -1;
+        }
+    }
+
+    static quint8 regOp(quint8 op)
+    {
+        switch( op )
+        {
+        case IL_add: return LL_radd;
+        case IL_sub: return LL_rsub;
+        case IL_mul: return LL_rmul;
+        case IL_div: return LL_rdiv;
+        case IL_div_un: return LL_rdiv_un;
+        case IL_rem: case IL_rem_un: return LL_rrem;
+        case IL_and: return LL_rand;
+        case IL_or: return LL_ror;
+        case IL_xor: return LL_rxor;
+        case IL_shl: return LL_rshl;
+        case IL_shr: return LL_rshr;
+        case IL_shr_un: return LL_rshr_un;
+        case IL_ceq: return LL_rceq;
+        case IL_clt: case IL_clt_un: return LL_rclt;
+        case IL_cgt: case IL_cgt_un: return LL_rcgt;
+        default: return IL_invalid;
+        }
+    }
+
+    static int regConsumer(const QVector<Operation>& ops, const QVector<bool>& target, int pc)
+    {
+        // the scalar store which consumes the address pushed at pc in straight code, or -1
+        int depth = 1; // the address and everything above
+        for( int i = pc + 1; i < ops.size(); i++ )
+        {
+            const Operation& op = ops[i];
+            if( target[i] || isBranch(op.op) || op.op == LL_leave || op.op == IL_ret )
+                return -1;
+            const int pops = stackPops(op);
+            if( pops < 0 )
+                return -1;
+            if( pops >= depth )
+                return depth == 2 && pops == 2 && isScalarStore(op.op) ? i : -1;
+            depth += stackEffect(op);
+        }
+        return -1;
+    }
+
+    static inline bool isRetargetable(const RegGen& g, const RegEntry& e)
+    {
+        return ( e.kind == RegEntry::Result || e.kind == RegEntry::NegCmp ) &&
+                e.pos == g.res.size() - 1 && e.pos >= g.barrier && g.res[e.pos].val == RegPush;
+    }
+
+    static inline bool usesVar(const Operation& op)
+    {
+        return ( op.len >> 16 ) == RegVar || ( op.len & 0xffff ) == RegVar;
+    }
+
+    static inline MemSlot* varOf(const RegGen& g, const RegEntry& e)
+    {
+        return e.kind == RegEntry::Pending && e.src == RegVar ? (*g.ops)[e.pos].s : 0;
+    }
+
+    void regEmit(RegGen& g, const Operation& op, quint32 pc)
+    {
+        g.res.append(op);
+        g.pcs.append(pc);
+        if( report && op.op >= LL_radd )
+            fusedCount[op.op]++;
+    }
+
+    void regFlush(RegGen& g, ProcData* pd)
+    {
+        // emit the pending pushes, so that all positions are on the VM operand stack
+        for( int i = 0; i < g.stack.size(); i++ )
+        {
+            RegEntry& e = g.stack[i];
+            if( e.kind == RegEntry::Pending )
+                regEmit(g, (*g.ops)[e.pos], pd->pcs[e.pos]);
+            else if( e.kind == RegEntry::NegCmp )
+            {
+                Operation op(LL_rceq);
+                op.val = RegPush;
+                op.len = RegPop << 16 | regConst(g, pd, MemSlot(qint64(0),true));
+                regEmit(g, op, g.pcs[e.pos]);
+            }
+            e = RegEntry();
+        }
+    }
+
+    static quint16 regConst(RegGen& g, ProcData* pd, const MemSlot& v)
+    {
+        const QPair<quint64,quint16> key(v.u, v.t << 8 | v.hw);
+        const QHash<QPair<quint64,quint16>,quint16>::const_iterator i = g.consts.find(key);
+        if( i != g.consts.end() )
+            return i.value();
+        if( pd->consts.size() >= RegPop - RegConst )
+            return RegPop;
+        pd->consts.append(v);
+        g.consts.insert(key, RegConst + pd->consts.size() - 1);
+        return RegConst + pd->consts.size() - 1;
+    }
+
+    static inline RegEntry regPop(RegGen& g)
+    {
+        if( g.stack.isEmpty() )
+            return RegEntry();
+        return g.stack.takeLast();
+    }
+
+    MemSlot* regOperands(RegGen& g, ProcData* pd, RegEntry* e, int n)
+    {
+        // pop n operands which can be read in place unless they read two different variables;
+        // everything below them is flushed
+        MemSlot* var = 0;
+        bool flush = false;
+        for( int i = n - 1; i >= 0; i-- )
+            e[i] = regPop(g);
+        for( int i = 0; i < n; i++ )
+        {
+            MemSlot* v = varOf(g, e[i]);
+            if( e[i].kind == RegEntry::NegCmp || ( v && var && v != var ) )
+                flush = true;
+            else if( v )
+                var = v;
+        }
+        if( flush )
+        {
+            for( int i = 0; i < n; i++ )
+                g.stack.append(e[i]);
+            regFlush(g, pd);
+            for( int i = n - 1; i >= 0; i-- )
+                e[i] = regPop(g);
+            return 0;
+        }
+        regFlush(g, pd);
+        return var;
+    }
+
+    void regBinary(RegGen& g, ProcData* pd, int pc)
+    {
+        const Operation& op = (*g.ops)[pc];
+        if( op.op == IL_ceq && g.stack.size() >= 2 )
+        {
+            const RegEntry& b = g.stack.last();
+            const RegEntry& a = g.stack[g.stack.size()-2];
+            if( b.kind == RegEntry::Pending && (*g.ops)[b.pos].op == IL_ldc_i4 && (*g.ops)[b.pos].i == 0 &&
+                    a.kind == RegEntry::Result && isRetargetable(g, a) &&
+                    ( g.res[a.pos].op == LL_rclt || g.res[a.pos].op == LL_rcgt || g.res[a.pos].op == LL_rceq ) )
+            {
+                g.stack.removeLast();
+                g.stack.last().kind = RegEntry::NegCmp;
+                return;
+            }
+        }
+        RegEntry e[2];
+        Operation res(regOp(op.op));
+        res.s = regOperands(g, pd, e, 2);
+        res.val = RegPush;
+        res.len = e[0].src << 16 | e[1].src;
+        regEmit(g, res, pd->pcs[pc]);
+        g.stack.append(RegEntry(RegEntry::Result, RegPop, g.res.size() - 1));
+    }
+
+    bool regBranch(RegGen& g, ProcData* pd, int pc)
+    {
+        const Operation& op = (*g.ops)[pc];
+        if( g.stack.isEmpty() )
+            return false;
+        const RegEntry e = g.stack.last();
+        if( isRetargetable(g, e) )
+        {
+            Operation& res = g.res[e.pos];
+            const bool negate = e.kind == RegEntry::NegCmp;
+            switch( res.op )
+            {
+            case LL_rclt:
+                res.op = negate ? LL_rclt_brtrue : LL_rclt_brfalse;
+                break;
+            case LL_rcgt:
+                res.op = negate ? LL_rcgt_brtrue : LL_rcgt_brfalse;
+                break;
+            case LL_rceq:
+                res.op = negate ? LL_rceq_brtrue : LL_rceq_brfalse;
+                break;
+            default:
+                return false;
+            }
+            res.val = op.val;
+            g.stack.removeLast();
+            return true;
+        }
+        if( e.kind == RegEntry::Pending )
+        {
+            g.stack.removeLast();
+            regFlush(g, pd);
+            Operation res(LL_rbrfalse);
+            res.val = op.val;
+            res.len = e.src << 16;
+            res.s = varOf(g, e);
+            regEmit(g, res, pd->pcs[pc]);
+            return true;
+        }
+        return false;
+    }
+
+    bool regStore(RegGen& g, ProcData* pd, int pc, int addr)
+    {
+        // stloc, starg, stvar or a scalar store to the address pushed at addr
+        const Operation& op = (*g.ops)[pc];
+        const int params = pd->proc->params.size();
+        quint32 dest;
+        MemSlot* var = 0;
+        const Operation& to = addr < 0 ? op : (*g.ops)[addr];
+        switch( to.op )
+        {
+        case IL_stloc:
+        case IL_ldloca:
+            dest = params + to.val;
+            break;
+        case IL_starg:
+        case IL_ldarga:
+            dest = to.val;
+            break;
+        default: // IL_stvar, IL_ldvara
+            dest = RegVarDest;
+            var = to.s;
+            break;
+        }
+        if( dest >= RegConst && var == 0 )
+            return false;
+        const RegEntry e = regPop(g);
+        if( e.kind == RegEntry::Result && isRetargetable(g, e) )
+        {
+            Operation& res = g.res[e.pos];
+            if( var == 0 || !usesVar(res) || res.s == var )
+            {
+                res.val = dest;
+                if( var )
+                    res.s = var;
+                return true;
+            }
+        }
+        MemSlot* src = varOf(g, e);
+        if( e.kind == RegEntry::Pending && ( var == 0 || src == 0 || src == var ) )
+        {
+            regFlush(g, pd); // before the variable changes
+            Operation res(LL_rmov);
+            res.val = dest;
+            res.len = e.src << 16;
+            res.s = var ? var : src;
+            regEmit(g, res, pd->pcs[pc]);
+            return true;
+        }
+        g.stack.append(e);
+        if( addr < 0 )
+            return false;
+        regFlush(g, pd);
+        regPop(g);
+        Operation res(LL_rst);
+        res.val = dest;
+        res.s = var;
+        regEmit(g, res, pd->pcs[pc]);
+        return true;
+    }
+
+    void toRegisterForm(ProcData* pd)
+    {
+        // args, locals, constants and global variables are read in place by the arithmetic,
+        // comparison and branch ops, which also store directly to their destination; the operand
+        // stack only holds the temporaries of the remaining ops
+        const QVector<Operation> ops = pd->ops;
+        QVector<bool> target(ops.size() + 1, false);
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            if( isBranch(ops[pc].op) )
+                target[ops[pc].val] = true;
+        }
+        const int params = pd->proc->params.size();
+        QHash<int,int> deferred; // scalar store -> address push
+        QVector<quint32> map(ops.size()); // old ops index -> new ops index
+        RegGen g;
+        g.ops = &ops;
+        g.barrier = 0;
+        pd->consts.clear();
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            const Operation& op = ops[pc];
+            if( target[pc] )
+            {
+                regFlush(g, pd);
+                g.barrier = g.res.size();
+            }
+            map[pc] = g.res.size();
+            quint16 src = RegPop;
+            switch( op.op )
+            {
+            case IL_ldarg:
+                src = op.val < RegConst ? op.val : RegPop;
+                break;
+            case IL_ldloc:
+                src = params + op.val < RegConst ? params + op.val : RegPop;
+                break;
+            case IL_ldc_i4:
+                src = regConst(g, pd, MemSlot(op.i,true));
+                break;
+            case IL_ldc_i8:
+                src = regConst(g, pd, MemSlot(op.i));
+                break;
+            case IL_ldc_r4:
+                src = regConst(g, pd, MemSlot(op.f,true));
+                break;
+            case IL_ldc_r8:
+                src = regConst(g, pd, MemSlot(op.f,false));
+                break;
+            case IL_ldvar:
+                src = RegVar;
+                break;
+            case IL_ldvara:
+            case IL_ldloca:
+            case IL_ldarga:
+                if( op.op == IL_ldvara || ( op.op == IL_ldarga ? op.val : params + op.val ) < RegConst )
+                {
+                    const int store = regConsumer(ops, target, pc);
+                    if( store >= 0 )
+                    {
+                        deferred[store] = pc;
+                        continue;
+                    }
+                }
+                break;
+            case IL_add: case IL_and: case IL_ceq: case IL_cgt: case IL_cgt_un: case IL_clt: case IL_clt_un:
+            case IL_div: case IL_div_un: case IL_mul: case IL_or: case IL_rem: case IL_rem_un:
+            case IL_shl: case IL_shr: case IL_shr_un: case IL_sub: case IL_xor:
+                regBinary(g, pd, pc);
+                continue;
+            case LL_brfalse:
+                if( regBranch(g, pd, pc) )
+                    continue;
+                break;
+            case IL_stloc:
+            case IL_starg:
+            case IL_stvar:
+                if( regStore(g, pd, pc, -1) )
+                    continue;
+                break;
+            default:
+                if( isScalarStore(op.op) && deferred.contains(pc) )
+                {
+                    regStore(g, pd, pc, deferred.value(pc));
+                    continue;
+                }
+                break;
+            }
+            if( src != RegPop )
+            {
+                g.stack.append(RegEntry(RegEntry::Pending, src, pc));
+                continue;
+            }
+            regFlush(g, pd);
+            regEmit(g, op, pd->pcs[pc]);
+            const int pops = stackPops(op);
+            if( pops < 0 || isBranch(op.op) || op.op == LL_leave || op.op == IL_ret )
+                g.stack.clear(); // all on the VM stack anyway
+            else
+            {
+                for( int i = 0; i < pops; i++ )
+                    regPop(g);
+                for( int i = 0; i < pops + stackEffect(op); i++ )
+                    g.stack.append(RegEntry());
+            }
+        }
+        for( int pc = 0; pc < g.res.size(); pc++ )
+        {
+            if( isBranch(g.res[pc].op) )
+                g.res[pc].val = map[g.res[pc].val];
+        }
+        pd->ops = g.res;
+        pd->pcs = g.pcs;
+    }
+
+    static bool countGreater(const QPair<quint32,quint32>& lhs, const QPair<quint32,quint32>& rhs)
+    {
+        return lhs.second > rhs.second;
+    }
+
+    void reportFusion()
+    {
+        out << "*** fused sequences:" << endl;
+        QHash<quint32,quint32>::const_iterator i;
+        for( i = fusedCount.begin(); i != fusedCount.end(); ++i )
+            out << opName(i.key()) << ": " << i.value() << endl;
+        QList< QPair<quint32,quint32> > pairs;
+        for( i = pairCount.begin(); i != pairCount.end(); ++i )
+            pairs.append(qMakePair(i.key(),i.value()));
+        std::sort(pairs.begin(), pairs.end(), countGreater);
+        out << "*** most frequent remaining pairs:" << endl;
+        for( int j = 0; j < pairs.size() && j < 30; j++ )
+            out << opName(pairs[j].first >> 16) << " " << opName(pairs[j].first & 0xffff) << ": "
+                << pairs[j].second << endl;
+        out << flush;
+    }
+
+    bool ceeTier() const { return !cc.isEmpty(); }
+
+    bool compilableC(ProcData* pd, QList<ProcData*>& unit)
+    {
+        // only procedures on signed integers which call nothing but such procedures are translated to C;
+        // unit collects pd and its callees
+        if( unit.contains(pd) )
+            return true;
+        MilProcedure* proc = pd->proc;
+        if( proc->kind != MilProcedure::Normal || proc->params.size() > MaxCeeParams )
+            return false;
+        if( !pd->prepared )
+            prepareBytecode(pd);
+        if( !proc->retType.second.isEmpty() && fromSymbol(proc->retType) != MemSlot::I )
+            return false;
+        for( int i = 0; i < proc->params.size(); i++ )
+            if( fromSymbol(proc->params[i].type) != MemSlot::I )
+                return false;
+        for( int i = 0; i < proc->locals.size(); i++ )
+            if( fromSymbol(proc->locals[i].type) != MemSlot::I )
+                return false;
+        QVector<bool> target;
+        QVector<int> store;
+        if( !cStores(pd->stackOps, target, store) )
+            return false;
+        unit.append(pd);
+        for( int pc = 0; pc < pd->stackOps.size(); pc++ )
+        {
+            const Operation& op = pd->stackOps[pc];
+            switch( op.op )
+            {
+            case IL_ldloca: case IL_ldarga:
+                break;
+            case IL_stind_i1: case IL_stind_i2: case IL_stind_i4: case IL_stind_i8:
+                if( store[pc] < 0 )
+                    return false;
+                break;
+            case IL_ldarg: case IL_ldloc: case IL_starg: case IL_stloc: case IL_ldc_i4: case IL_ldc_i8:
+            case IL_add: case IL_sub: case IL_mul: case IL_div: case IL_rem: case IL_rem_un:
+            case IL_and: case IL_or: case IL_xor: case IL_shl: case IL_shr: case IL_neg: case IL_not:
+            case IL_ceq: case IL_clt: case IL_clt_un: case IL_cgt: case IL_cgt_un:
+            case IL_conv_i1: case IL_conv_i2: case IL_conv_i4: case IL_conv_i8:
+            case IL_dup: case IL_pop: case IL_ret: case LL_jump: case LL_brfalse: case LL_leave:
+                break;
+            case IL_ldvar: case IL_ldvara: case IL_stvar:
+                if( op.s == 0 || op.s->t != MemSlot::I )
+                    return false;
+                break;
+            case IL_call:
+                if( op.pd == 0 || !compilableC(op.pd, unit) )
+                    return false;
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool cStores(const QVector<Operation>& ops, QVector<bool>& target, QVector<int>& store)
+    {
+        // the addresses of locals, args and variables are only supported as the target of a
+        // scalar store in straight code; store maps the stind to the op pushing the address
+        target = QVector<bool>(ops.size() + 1, false);
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            if( isBranch(ops[pc].op) )
+                target[ops[pc].val] = true;
+        }
+        store = QVector<int>(ops.size(), -1);
+        for( int pc = 0; pc < ops.size(); pc++ )
+        {
+            const quint8 op = ops[pc].op;
+            if( op != IL_ldloca && op != IL_ldarga && op != IL_ldvara )
+                continue;
+            const int c = regConsumer(ops, target, pc);
+            if( c < 0 || ops[c].op > IL_stind_i8 )
+                return false;
+            store[c] = pc;
+        }
+        return true;
+    }
+
+    static QByteArray cname(const char* prefix, int i)
+    {
+        return prefix + QByteArray::number(i);
+    }
+
+    static QByteArray cprototype(const QList<ProcData*>& unit, int i)
+    {
+        QByteArray res = "static int64_t " + cname("p", i) + "(";
+        for( int j = 0; j < unit[i]->proc->params.size(); j++ )
+            res += "int64_t " + cname("a", j) + ", char " + cname("ah", j) + ", ";
+        return res + "char* rh)";
+    }
+
+    QByteArray generateC(const QList<ProcData*>& unit)
+    {
+        // unit[0] is exported as mic_entry, the others are its callees; operand stack slots become
+        // C variables, each with its half width flag, so the same 64 bit semantics as binary() apply
+        MemSlot probe;
+        QByteArray res = "#include <stdint.h>\n"
+                "#define VAL(a) (*(int64_t*)(uintptr_t)(a))\n"
+                "#define HW(a) (*(char*)(uintptr_t)((a) + " + QByteArray::number(int((char*)&probe.hw - (char*)&probe)) + "))\n";
+        for( int i = 0; i < unit.size(); i++ )
+            res += cprototype(unit, i) + ";\n";
+        for( int i = 0; i < unit.size(); i++ )
+        {
+            ProcData* pd = unit[i];
+            const QVector<Operation>& ops = pd->stackOps;
+            QVector<int> depth;
+            const int max = computeStackDepth(ops, depth);
+            QVector<bool> target;
+            QVector<int> store;
+            cStores(ops, target, store);
+            res += cprototype(unit, i) + "\n{\n    char c;\n";
+            for( int j = 0; j < pd->proc->locals.size(); j++ )
+                res += "    int64_t " + cname("l", j) + " = 0; char " + cname("lh", j) + " = 0;\n";
+            for( int j = 0; j < max; j++ )
+                res += "    int64_t " + cname("s", j) + "; char " + cname("h", j) + ";\n";
+            for( int pc = 0; pc < ops.size(); pc++ )
+            {
+                if( target[pc] )
+                    res += cname("L", pc) + ":;\n";
+                if( depth[pc] < 0 )
+                    continue;
+                const Operation& op = ops[pc];
+                const QByteArray s = cname("s", depth[pc]), h = cname("h", depth[pc]);
+                const QByteArray a = cname("s", depth[pc] - 2), ah = cname("h", depth[pc] - 2);
+                const QByteArray t = cname("s", depth[pc] - 1), th = cname("h", depth[pc] - 1);
+                QByteArray var = "(uintptr_t)" + QByteArray::number(quint64(op.s)) + "ull";
+                if( op.op == IL_conv_i8 || op.op == IL_pop )
+                    continue;
+                res += "    ";
+                switch( op.op )
+                {
+                case IL_ldarg:
+                    res += s + " = " + cname("a", op.val) + "; " + h + " = " + cname("ah", op.val) + ";";
+                    break;
+                case IL_ldloc:
+                    res += s + " = " + cname("l", op.val) + "; " + h + " = " + cname("lh", op.val) + ";";
+                    break;
+                case IL_ldvar:
+                    res += s + " = VAL(" + var + "); " + h + " = HW(" + var + ");";
+                    break;
+                case IL_starg:
+                    res += cname("a", op.val) + " = " + t + "; " + cname("ah", op.val) + " = " + th + ";";
+                    break;
+                case IL_stloc:
+                    res += cname("l", op.val) + " = " + t + "; " + cname("lh", op.val) + " = " + th + ";";
+                    break;
+                case IL_stvar:
+                    res += "VAL(" + var + ") = " + t + "; HW(" + var + ") = " + th + ";";
+                    break;
+                case IL_ldloca:
+                case IL_ldarga:
+                case IL_ldvara:
+                    res += "/* address of the store at " + QByteArray::number(regConsumer(ops, target, pc)) + " */";
+                    break;
+                case IL_stind_i1:
+                case IL_stind_i2:
+                case IL_stind_i4:
+                case IL_stind_i8:
+                    {
+                        const Operation& addr = ops[store[pc]];
+                        if( addr.op == IL_ldloca )
+                            res += cname("l", addr.val) + " = " + t + "; " + cname("lh", addr.val) + " = " + th + ";";
+                        else if( addr.op == IL_ldarga )
+                            res += cname("a", addr.val) + " = " + t + "; " + cname("ah", addr.val) + " = " + th + ";";
+                        else
+                        {
+                            var = "(uintptr_t)" + QByteArray::number(quint64(addr.s)) + "ull";
+                            res += "VAL(" + var + ") = " + t + "; HW(" + var + ") = " + th + ";";
+                        }
+                    }
+                    break;
+                case IL_ldc_i4:
+                case IL_ldc_i8:
+                    res += s + " = (int64_t)" + QByteArray::number(quint64(op.i)) + "ull; " + h +
+                            ( op.op == IL_ldc_i4 ? " = 1;" : " = 0;" );
+                    break;
+                case IL_add:
+                    res += a + " = (int64_t)((uint64_t)" + a + " + (uint64_t)" + t + ");";
+                    break;
+                case IL_sub:
+                    res += a + " = (int64_t)((uint64_t)" + a + " - (uint64_t)" + t + ");";
+                    break;
+                case IL_mul:
+                    res += a + " = (int64_t)((uint64_t)" + a + " * (uint64_t)" + t + ");";
+                    break;
+                case IL_div:
+                    res += a + " = " + a + " / " + t + ";";
+                    break;
+                case IL_rem:
+                case IL_rem_un:
+                    res += a + " = " + a + " % " + t + ";";
+                    break;
+                case IL_and:
+                    res += a + " = " + a + " & " + t + ";";
+                    break;
+                case IL_or:
+                    res += a + " = " + a + " | " + t + ";";
+                    break;
+                case IL_xor:
+                    res += a + " = " + a + " ^ " + t + ";";
+                    break;
+                case IL_shl:
+                    res += a + " = (int64_t)((uint64_t)" + a + " << (uint64_t)" + t + ");";
+                    break;
+                case IL_shr:
+                    res += a + " = " + ah + " ? (int64_t)((int32_t)" + a + " >> " + t + ") : " + a + " >> " + t + ";";
+                    break;
+                case IL_neg:
+                    res += t + " = (int64_t)(0 - (uint64_t)" + t + ");";
+                    break;
+                case IL_not:
+                    res += t + " = ~" + t + ";";
+                    break;
+                case IL_ceq:
+                    res += a + " = " + a + " == " + t + "; " + ah + " = 1;";
+                    break;
+                case IL_clt:
+                case IL_clt_un:
+                    res += a + " = " + a + " < " + t + "; " + ah + " = 1;";
+                    break;
+                case IL_cgt:
+                case IL_cgt_un:
+                    res += a + " = " + a + " > " + t + "; " + ah + " = 1;";
+                    break;
+                case IL_conv_i1:
+                    res += t + " = (int8_t)" + t + "; " + th + " = 1;";
+                    break;
+                case IL_conv_i2:
+                    res += t + " = (int16_t)" + t + "; " + th + " = 1;";
+                    break;
+                case IL_conv_i4:
+                    res += t + " = (int32_t)" + t + "; " + th + " = 1;";
+                    break;
+                case IL_dup:
+                    res += s + " = " + t + "; " + h + " = " + th + ";";
+                    break;
+                case IL_call:
+                    {
+                        const int n = op.pd->proc->params.size();
+                        const bool hasRet = !op.pd->proc->retType.second.isEmpty();
+                        const int first = depth[pc] - n;
+                        QByteArray call = cname("p", unit.indexOf(op.pd)) + "(";
+                        for( int j = 0; j < n; j++ )
+                            call += cname("s", first + j) + ", " + cname("h", first + j) + ", ";
+                        if( hasRet )
+                            res += cname("s", first) + " = " + call + "&" + cname("h", first) + ");";
+                        else
+                            res += call + "&c);";
+                    }
+                    break;
+                case IL_ret:
+                    if( !pd->proc->retType.second.isEmpty() )
+                        res += "*rh = " + th + "; return " + t + ";";
+                    else
+                        res += "return 0;";
+                    break;
+                case LL_jump:
+                    res += "goto " + cname("L", op.val) + ";";
+                    break;
+                case LL_brfalse:
+                    res += "if( " + t + " == 0 ) goto " + cname("L", op.val) + ";";
+                    break;
+                case LL_leave:
+                    res += "*rh = -1; return 0;";
+                    break;
+                }
+                res += "\n";
+            }
+            res += "}\n";
+        }
+        res += "int64_t mic_entry(const int64_t* a, const char* h, char* rh)\n{\n    return p0(";
+        for( int j = 0; j < unit[0]->proc->params.size(); j++ )
+            res += "a[" + QByteArray::number(j) + "], h[" + QByteArray::number(j) + "], ";
+        res += "rh);\n}\n";
+        return res;
+    }
+
+    void compileC(ProcData* pd)
+    {
+        // start the C compiler in the background, the interpreter continues meanwhile, see pollC
+        QList<ProcData*> unit;
+        if( !compilableC(pd, unit) )
+        {
+            pd->tier = ProcData::NotCompilable;
+            return;
+        }
+        if( ceeDir == 0 )
+            ceeDir = new QTemporaryDir();
+        if( !ceeDir->isValid() )
+        {
+            qWarning() << "cannot create a temporary directory for the C tier; continuing interpreted";
+            cc.clear();
+            pd->tier = ProcData::NotCompilable;
+            return;
+        }
+        CeeUnit* u = new CeeUnit();
+        u->pd = pd;
+        u->path = ceeDir->filePath(QString("unit%1").arg(ceeUnits.size()));
+        QFile f(u->path + ".c");
+        if( !f.open(QIODevice::WriteOnly) )
+        {
+            delete u;
+            pd->tier = ProcData::NotCompilable;
+            return;
+        }
+        f.write(generateC(unit));
+        f.close();
+        u->proc = new QProcess();
+        u->proc->start(cc, QStringList() << "-O2" << "-shared" << "-fPIC" << "-o" << u->path + ".so" << u->path + ".c");
+        pd->tier = ProcData::Compiling;
+        ceeUnits.append(u);
+        ceeRunning++;
+    }
+
+    void pollC()
+    {
+        for( int i = 0; i < ceeUnits.size(); i++ )
+        {
+            CeeUnit* u = ceeUnits[i];
+            if( u->proc == 0 || ( u->proc->state() != QProcess::NotRunning && !u->proc->waitForFinished(0) ) )
+                continue;
+            const bool started = u->proc->error() != QProcess::FailedToStart;
+            const bool ok = started && u->proc->exitStatus() == QProcess::NormalExit && u->proc->exitCode() == 0;
+            delete u->proc;
+            u->proc = 0;
+            ceeRunning--;
+            if( ok )
+            {
+                u->lib = new QLibrary(u->path + ".so");
+                u->pd->cee = (CeeProc)u->lib->resolve("mic_entry");
+            }
+            QFile::remove(u->path + ".c");
+            QFile::remove(u->path + ".so");
+            if( u->pd->cee )
+                u->pd->tier = ProcData::Compiled;
+            else
+            {
+                // only this unit stays interpreted, unless the compiler cannot be started at all
+                u->pd->tier = ProcData::NotCompilable;
+                if( started )
+                    qWarning() << "cannot compile" << u->pd->proc->name << "with" << cc << "; continuing interpreted";
+                else if( !cc.isEmpty() )
+                {
+                    qWarning() << "cannot start the C compiler" << cc << "; continuing interpreted";
+                    cc.clear();
+                }
+            }
+        }
+    }
+
+    static bool callC(ProcData* pd, MemSlot* args, MemSlot& ret)
+    {
+        // false if an actual parameter is not a signed integer, the procedure is interpreted then
+        qint64 a[MaxCeeParams];
+        char h[MaxCeeParams];
+        for( int i = 0; i < pd->proc->params.size(); i++ )
+        {
+            if( args[i].t != MemSlot::I )
+                return false;
+            a[i] = args[i].i;
+            h[i] = args[i].hw;
+        }
+        char rh = -1;
+        const qint64 r = pd->cee(a, h, &rh);
+        if( rh >= 0 )
+            ret = MemSlot(r, bool(rh));
+        return true;
+    }
+
+    static int stackEffect(const Operation& op)
+    {
+        switch( op.op )
+        {
+        case IL_ldarg: case IL_ldarga: case IL_ldc_i4: case IL_ldc_i8: case IL_ldc_r4: case IL_ldc_r8:
+        case IL_ldobj: case IL_ldloc: case IL_ldloca: case IL_ldnull: case IL_ldproc: case IL_ldstr:
+        case IL_ldvar: case IL_ldvara: case IL_dup: case IL_sizeof: case IL_newobj:
+            return 1;
+        case IL_add: case IL_and: case IL_ceq: case IL_cgt: case IL_cgt_un: case IL_clt: case IL_clt_un:
+        case IL_div: case IL_div_un: case IL_mul: case IL_or: case IL_rem: case IL_rem_un:
+        case IL_shl: case IL_shr: case IL_shr_un: case IL_sub: case IL_xor:
+        case IL_ldelem: case IL_ldelema: case IL_ptroff: case IL_initobj: case IL_free: case IL_pop:
+        case IL_starg: case IL_stloc: case IL_stvar:
+            return -1;
+        case IL_stfld: case IL_stind_i1: case IL_stind_i2: case IL_stind_i4: case IL_stind_i8:
+        case IL_stind_r4: case IL_stind_r8: case IL_stind_ip: case IL_stind_ipp: case IL_stind:
+            return -2;
+        case IL_stelem: case IL_stelem_i1:
+            return -3;
+        case IL_call:
+        case IL_callvirt:
+        case LL_setin: case LL_setdiv: case LL_relop: case LL_strlen: case LL_intrinsic:
+            if( op.pd )
+                return -op.pd->proc->params.size() + (op.pd->proc->retType.second.isEmpty() ? 0 : 1);
+            return 0;
+        default:
+            // calli and callvi are assumed to replace the procedure by the result
+            return 0;
+        }
+    }
+
+    static int computeStackDepth(const QVector<Operation>& ops, QVector<int>& depth)
+    {
+        // maximum operand stack depth, following both paths of each branch; depth is the
+        // operand stack depth before each op, or -1 if unreachable
+        depth = QVector<int>(ops.size(), -1);
+        QList<int> todo;
+        depth[0] = 0;
+        todo.append(0);
+        int res = 0;
+        while( !todo.isEmpty() )
+        {
+            int pc = todo.takeLast();
+            while( pc >= 0 && pc < ops.size() )
+            {
+                const Operation& op = ops[pc];
+                int d = depth[pc];
+                int next = pc + 1, other = -1, otherDepth = 0;
+                switch( op.op )
+                {
+                case LL_jump:
+                    next = op.val;
+                    break;
+                case LL_brfalse:
+                    d--;
+                    other = op.val;
+                    otherDepth = d;
+                    break;
+                case LL_case:
+                    other = op.val;
+                    otherDepth = op.len ? d - 1 : d;
+                    d--;
+                    break;
+                case LL_leave:
+                case IL_ret:
+                    next = -1;
+                    break;
+                default:
+                    d += stackEffect(op);
+                    break;
+                }
+                if( d < 0 )
+                    d = 0;
+                if( d > res )
+                    res = d;
+                if( other >= 0 && other < depth.size() && depth[other] == -1 )
+                {
+                    depth[other] = qMax(otherDepth,0);
+                    todo.append(other);
+                }
+                if( next < 0 || next >= depth.size() || depth[next] != -1 )
+                    break;
+                depth[next] = d;
+                pc = next;
+            }
+        }
+        return res;
+    }
+
+    static void lowerIntrinsic(Operation& op)
+    {
+        // calls of MIC$ procedures become ops which take their operands straight from the operand stack
+        switch( op.pd->proc->offset )
+        {
+        case 1: case 2: case 3: case 4:
+            op.op = LL_relop;
+            op.val = op.pd->proc->offset;
+            break;
+        case 5:
+            op.op = LL_setdiv;
+            break;
+        case 6:
+            op.op = LL_setin;
+            break;
+        case 16:
+            op.op = LL_strlen;
+            break;
+        default:
+            op.op = LL_intrinsic;
+            break;
+        }
+    }
+
+    void decode(ProcData* pd, int pc, Operation& op)
+    {
+        ModuleData* module = pd->module;
+        MilProcedure* proc = pd->proc;
+        const MilOperation& mo = proc->body[pc];
+        op.op = mo.op;
+        switch( mo.op )
+        {
+        case IL_call:
+        case IL_ldproc:
+            // an unresolved procedure is reported when executed
+            op.pd = getProc(module, mo.arg.value<MilQuali>());
+            if( mo.op == IL_call && op.pd && op.pd->proc->kind == MilProcedure::Intrinsic )
+                lowerIntrinsic(op);
+            else if( mo.op == IL_call && op.pd && op.pd->proc->kind == MilProcedure::Extern && op.pd->ext < 0 )
+                bindExtern(op.pd);
+            break;
+        case IL_callvirt:
+            {
+                MilTrident tri = mo.arg.value<MilTrident>();
+                FlattenedType* rec = getFlattenedType(module, tri.first);
+                if( rec == 0 )
+                    execError(module, proc, pc, "invalid object type");
+                const int midx = rec->lastIndexOfMethod(tri.second);
+                if( midx < 0 )
+                    execError(module, proc, pc, "unknown method");
+                op.pd = rec->vtable[midx]; // the static target, dispatched on the receiver when executed
+                op.val = midx;
+                op.len = pd->sites.size();
+                pd->sites.append(CallSite());
+            }
+            break;
+        case IL_calli:
+        case IL_callvi:
+            op.len = pd->sites.size();
+            pd->sites.append(CallSite());
+            break;
+        case IL_sizeof:
+            // the C layout size is a constant
+            op.op = IL_ldc_i4;
+            op.i = cLayout(module, mo.arg.value<MilQuali>()).size;
+            break;
+        case IL_isinst:
+            op.tt = getFlattenedType(module, mo.arg.value<MilQuali>());
+            if( op.tt == 0 )
+                execError(module, proc, pc, "invalid reference object type");
+            break;
+        case IL_ldarg:
+        case IL_ldarg_s:
+            op.op = IL_ldarg;
+            op.val = mo.arg.toUInt();
+            break;
+        case IL_ldarg_0:
+        case IL_ldarg_1:
+        case IL_ldarg_2:
+        case IL_ldarg_3:
+            op.op = IL_ldarg;
+            op.val = mo.op - IL_ldarg_0;
+            break;
+        case IL_ldarga:
+        case IL_ldarga_s:
+            op.op = IL_ldarga;
+            op.val = mo.arg.toUInt();
+            break;
+        case IL_ldloc:
+        case IL_ldloc_s:
+            op.op = IL_ldloc;
+            op.val = mo.arg.toUInt();
+            break;
+        case IL_ldloc_0:
+        case IL_ldloc_1:
+        case IL_ldloc_2:
+        case IL_ldloc_3:
+            op.op = IL_ldloc;
+            op.val = mo.op - IL_ldloc_0;
+            break;
+        case IL_ldloca:
+        case IL_ldloca_s:
+            op.op = IL_ldloca;
+            op.val = mo.arg.toUInt();
+            break;
+        case IL_stloc:
+        case IL_stloc_s:
+            op.op = IL_stloc;
+            op.val = mo.arg.toUInt();
+            break;
+        case IL_stloc_0:
+        case IL_stloc_1:
+        case IL_stloc_2:
+        case IL_stloc_3:
+            op.op = IL_stloc;
+            op.val = mo.op - IL_stloc_0;
+            break;
+        case IL_starg:
+        case IL_starg_s:
+            op.op = IL_starg;
+            op.val = mo.arg.toUInt();
+            break;
+        case IL_ldc_i4:
+        case IL_ldc_i4_s:
+            op.op = IL_ldc_i4;
+            op.i = (qint32)mo.arg.toLongLong();
+            break;
+        case IL_ldc_i4_0:
+        case IL_ldc_i4_1:
+        case IL_ldc_i4_2:
+        case IL_ldc_i4_3:
+        case IL_ldc_i4_4:
+        case IL_ldc_i4_5:
+        case IL_ldc_i4_6:
+        case IL_ldc_i4_7:
+        case IL_ldc_i4_8:
+            op.op = IL_ldc_i4;
+            op.i = mo.op - IL_ldc_i4_0;
+            break;
+        case IL_ldc_i4_m1:
+            op.op = IL_ldc_i4;
+            op.i = -1;
+            break;
+        case IL_ldc_i8:
+            op.i = mo.arg.toLongLong();
+            break;
+        case IL_ldc_r4:
+        case IL_ldc_r8:
+            op.f = mo.arg.toDouble();
+            break;
+        case IL_ldobj:
+            op.s = new MemSlot();
+            convert(*op.s, mo.arg.value<MilObject>().data);
+            module->constants.append(op.s);
+            break;
+        case IL_ldelem:
+        case IL_ldelema:
+        case IL_stelem:
+            op.tt = getFlattenedType(module, mo.arg.value<MilQuali>());
+            break;
+        case IL_ldelem_i1:
+        case IL_ldelem_i2:
+        case IL_ldelem_i4:
+        case IL_ldelem_i8:
+        case IL_ldelem_u1:
+        case IL_ldelem_u2:
+        case IL_ldelem_u4:
+        case IL_ldelem_u8:
+        case IL_ldelem_r4:
+        case IL_ldelem_r8:
+        case IL_ldelem_ip:
+            op.op = IL_ldelem;
+            break;
+        case IL_stelem_i1:
+        case IL_stelem_i2:
+        case IL_stelem_i4:
+        case IL_stelem_i8:
+        case IL_stelem_r4:
+        case IL_stelem_r8:
+        case IL_stelem_ip:
+            op.op = IL_stelem_i1;
+            break;
+        case IL_ldfld:
+        case IL_ldflda:
+            {
+                MilTrident td = mo.arg.value<MilTrident>();
+                FlattenedType* rec = getFlattenedType(module, td.first);
+                if( rec == 0 )
+                    execError(module, proc, pc, QString("unknown type '%1'").
+                              arg(MilEmitter::toString(td.first).constData()));
+                FlattenedType* decl = rec;
+                const MilVariable* field = decl->type->findField(td.second);
+                for( int i = rec->display.size() - 2; field == 0 && i >= 0; i-- )
+                {
+                    // an inherited field of an object, declared in one of its base types
+                    decl = rec->display[i];
+                    field = decl->type->findField(td.second);
+                }
+                if( field == 0 )
+                    execError(module, proc, pc, "unknown field");
+                FlattenedType* ft = getFlattenedType(decl->module, field->type);
+                op.val = fieldOffsets.value(field);
+                if( ft && !ft->fields.isEmpty() )
+                    op.len = ft->fields.size(); // embedded struct by value
+            }
+            break;
+        case IL_ldind:
+            {
+                MilQuali q = mo.arg.value<MilQuali>();
+                if( q.second.isEmpty() )
+                    op.len = 1; // intrinsic string
+                else
+                    op.tt = getFlattenedType(module, q); // invalid type is reported when executed
+            }
+            break;
+        case IL_ldmeth:
+            {
+                MilTrident td = mo.arg.value<MilTrident>();
+                FlattenedType* ty = getFlattenedType(module, td.first);
+                if( ty == 0 )
+                    execError(module, proc, pc, QString("unknown type '%1'").
+                              arg(MilEmitter::toString(td.first).constData()));
+                const int idx = ty->lastIndexOfMethod(td.second);
+                if( idx < 0 )
+                    execError(module, proc, pc, "unknown method");
+                op.val = idx; // subclass vtables extend the vtable of the static type
+                op.len = pd->sites.size();
+                pd->sites.append(CallSite());
+            }
+            break;
+        case IL_ldstr:
+            op.s = internalize(mo.arg.toByteArray());
+            break;
+        case IL_ldvar:
+        case IL_ldvara:
+        case IL_stvar:
+            {
+                MilQuali q = mo.arg.value<MilQuali>();
+                ModuleData* m = q.first.isEmpty() ? module : loadModule(q.first);
+                const int idx = m && m->module ? m->module->indexOfVar(q.second) : -1;
+                if( idx < 0 )
+                    execError(module, proc, pc, "invalid variable reference");
+                // since the module is not a struct we don't flatten structs and the offset is the index in the field list
+                op.s = &m->variables[idx];
+            }
+            break;
+        case IL_newarr:
+        case IL_newvla:
+            {
+                MilQuali q = mo.arg.value<MilQuali>();
+                FlattenedType* ty = getFlattenedType(module, q);
+                // multi-dim arrays are flattened
+                op.len = ty && ty->len ? ty->len : 1;
+                quint8 scalar;
+                op.tt = elementType(module, q, scalar);
+                op.val = scalar;
+            }
+            break;
+        case IL_newobj:
+            {
+                const MilQuali q = mo.arg.value<MilQuali>();
+                FlattenedType* ty = getFlattenedType(module, q);
+                if( ty == 0 )
+                    execError(module, proc, pc, QString("unknown type '%1'").
+                              arg(MilEmitter::toString(q).constData()));
+                if( ty->type->kind != MilEmitter::Struct && ty->type->kind != MilEmitter::Union
+                        && ty->type->kind != MilEmitter::Object)
+                    execError(module, proc, pc, "operation not available for given type");
+                op.tt = ty;
+                op.len = ty->fields.size();
+                if( ty->type->kind == MilEmitter::Object )
+                    op.len++;
+            }
+            break;
+        case IL_then:
+        case IL_else:
+        case IL_end:
+        case IL_do:
+        case IL_until:
+        case IL_case:
+            execError(module, proc, pc, "operation not expected here");
+            break;
+        }
+    }
+
+    void inline convertTo( MemSlot& s, MemSlot::Type to, quint8 size )
+    {
+        switch(s.t)
+        {
+        case MemSlot::F:
+            if( to != s.t )
+                s.i = s.f;
+            break;
+        case MemSlot::I:
+        case MemSlot::U:
+            if( to == MemSlot::F )
+                s.f = s.i;
+            else if( to == MemSlot::I && size )
+            {
+                s.hw = size && size != 8;
+                switch(size)
+                {
+                case 1:
+                    {
+                        qint8 tmp = s.i;
+                        s.i = tmp;
+                        break;
+                    }
+                case 2:
+                    {
+                        qint16 tmp = s.i;
+                        s.i = tmp;
+                        break;
+                    }
+                case 4:
+                    {
+                        qint32 tmp = s.i;
+                        s.i = tmp;
+                        break;
+                    }
+                }
+            }else if( to == MemSlot::U && size )
+            {
+                s.hw = size && size != 8;
+                switch(size)
+                {
+                case 1:
+                    {
+                        quint8 tmp = s.u;
+                        s.u = tmp;
+                        break;
+                    }
+                case 2:
+                    {
+                        quint16 tmp = s.u;
+                        s.u = tmp;
+                        break;
+                    }
+                case 4:
+                    {
+                        quint32 tmp = s.u;
+                        s.u = tmp;
+                        break;
+                    }
+                }
+            }
+            break;
+        case MemSlot::Pointer:
+            if( to == MemSlot::F )
+                s.f = s.i;
+            break;
+        default:
+            s.u = 0;
+            if( size && size < 8 )
+                s.hw = true;
+            break;
+        }
+        s.t = to;
+    }
+
+    void convert(MemSlot& out, const QVariant& data )
+    {
+        out.clear();
+        if( data.canConvert<MilRecordLiteral>() )
+        {
+            // TODO: flatten embedded elements
+            MilRecordLiteral m = data.value<MilRecordLiteral>();
+            out.p = createSequence(m.size());
+            out.t = MemSlot::Record;
+            for( int i = 0; i < m.size(); i++ )
+                convert(out.p[i], m[i].second);
+            return;
+        }
+        switch( data.type() )
+        {
+        case QVariant::List:
+            {
+                // TODO: flatten multi-dim arrays
+                QVariantList l = data.toList();
+                out.p = createSequence(l.size());
+                out.t = MemSlot::Array;
+                for( int i = 0; i < l.size(); i++ )
+                    convert(out.p[i], l[i]);
+            }
+            break;
+        case QVariant::ByteArray:
+            out.p = internalize(data.toByteArray());
+            out.t = MemSlot::Pointer;
+            break;
+        case QVariant::String:
+            out.p = internalize(data.toString().toLatin1());
+            out.t = MemSlot::Pointer;
+            break;
+        case QVariant::LongLong:
+        case QVariant::Int:
+        case QVariant::Bool:
+            out.i = data.toLongLong();
             out.t = MemSlot::I; // TODO: hw
             break;
-        case QVariant::ULongLong:
-        case QVariant::UInt:
-            out.u = data.toULongLong();
-            out.t = MemSlot::U; // TODO: hw
+        case QVariant::ULongLong:
+        case QVariant::UInt:
+            out.u = data.toULongLong();
+            out.t = MemSlot::U; // TODO: hw
+            break;
+        case QVariant::Double:
+            out.f = data.toDouble();
+            out.t = MemSlot::F;
+            break;
+        default:
+            Q_ASSERT(false);
+        }
+    }
+
+    static inline void quicken(Operation& op, quint8 t, quint8 i, quint8 u, quint8 f)
+    {
+        // replace a generic op by the variant specialized on the observed lhs type;
+        // the variant falls back to the generic op for good if it sees another type
+        if( op.len )
+            return;
+        switch( t )
+        {
+        case MemSlot::I:
+            if( i )
+                op.op = i;
+            break;
+        case MemSlot::U:
+            if( u )
+                op.op = u;
+            break;
+        case MemSlot::F:
+            if( f )
+                op.op = f;
+            break;
+        }
+    }
+
+    static inline void leaveFrame(MemSlot* args, MemSlot* end, MemSlot& ret, bool hasRet)
+    {
+        for( MemSlot* s = args; s < end; s++ )
+            s->clear();
+        if( hasRet )
+            args->move(ret);
+    }
+
+    void enterFrame(Frame* f, ProcData* pd, MemSlot* args)
+    {
+        // the actual parameters are already in place; pd is prepared
+        MilProcedure* proc = pd->proc;
+        f->pd = pd;
+        f->args = args;
+        f->locals = args + proc->params.size();
+        f->stack = f->locals + proc->locals.size();
+        f->pc = 0;
+        MemSlot* end = f->stack + pd->stackDepth;
+        if( end > vmEnd || f >= vmFramesEnd )
+            execError(pd->module, proc, "stack overflow");
+        f->outer = vmTop;
+        if( end > vmTop )
+            vmTop = end;
+        vmFrame = f + 1;
+        const MemSlot* init = pd->localsInit.constData();
+        for( MemSlot* s = f->locals; s < f->stack; s++ )
+            *s = *init++;
+    }
+
+    static inline const MemSlot* chars(const MemSlot& s)
+    {
+        // a string is passed by value, as a pointer to the chars, or as a pointer to the array variable
+        Q_ASSERT( (s.t == MemSlot::Pointer || s.t == MemSlot::Array) && s.p );
+        if( s.t == MemSlot::Pointer && !s.embedded && s.p->t == MemSlot::Array )
+            return s.p->p;
+        return s.p;
+    }
+
+    static inline quint32 strLen(const MemSlot* s)
+    {
+        const MemSlot* p = s;
+        while( p->u )
+            p++;
+        return p - s;
+    }
+
+    static inline QByteArray toStr(const MemSlot& s)
+    {
+        const MemSlot* p = chars(s);
+        QByteArray str;
+        str.resize(strLen(p));
+        for( int i = 0; i < str.size(); i++ )
+            str[i] = (char)(quint8)p[i].u;
+        return str;
+    }
+
+    void writeStr(const MemSlot& s)
+    {
+        // in chunks, without building the whole string first
+        char buf[256];
+        const MemSlot* p = chars(s);
+        int n = 0;
+        while( p->u )
+        {
+            buf[n++] = (char)(quint8)p->u;
+            p++;
+            if( n == sizeof(buf) - 1 )
+            {
+                buf[n] = 0;
+                out << buf;
+                n = 0;
+            }
+        }
+        buf[n] = 0;
+        out << buf;
+    }
+
+    static inline int compareStr(const MemSlot* l, const MemSlot* r)
+    {
+        // zero terminated strings of char slots, like strcmp
+        while( true )
+        {
+            const quint8 a = l->u;
+            const quint8 b = r->u;
+            if( a != b || a == 0 )
+                return a - b;
+            l++;
+            r++;
+        }
+    }
+
+    static quint64 relop(int variant, const MemSlot* args)
+    {
+        // MIC$ relop1..4: args are string or char operands depending on the variant and the relation
+        MemSlot lc[2], rc[2]; // a char operand as a string
+        const MemSlot* l;
+        const MemSlot* r;
+        if( variant == 3 || variant == 4 )
+        {
+            lc[0].u = (quint8)args[0].u;
+            l = lc;
+        }else
+            l = chars(args[0]);
+        if( variant == 2 || variant == 4 )
+        {
+            rc[0].u = (quint8)args[1].u;
+            r = rc;
+        }else
+            r = chars(args[1]);
+        const int c = compareStr(l, r);
+        switch( args[2].u )
+        {
+        case 1: // EQ
+            return c == 0;
+        case 2: // NEQ
+            return c != 0;
+        case 3: // LT
+            return c < 0;
+        case 4: // LEQ
+            return c <= 0;
+        case 5: // GT
+            return c > 0;
+        case 6: // GEQ
+            return c >= 0;
+        }
+        return 0;
+    }
+
+    void nyiError(ModuleData* module, MilProcedure* proc)
+    {
+        throw QString("%1!%2 not yet implemented")
+                .arg(module->module->fullName.constData())
+                .arg(proc->name.constData());
+    }
+
+    struct Foreign;
+    struct Extern
+    {
+        // the native implementation of an external procedure, see registerExterns
+        typedef void (Imp::*Handler)(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret);
+        Handler handler;
+        double (*fn)(double); // the unary Math and MathL functions
+        double (*fn2)(double,double); // the binary ones
+        const Foreign* ffi; // a C function, see bindForeign
+        quint8 code; // a variant of the handler
+        bool hw; // Math, i.e. REAL instead of LONGREAL
+        Extern(Handler h = 0, quint8 c = 0):handler(h),fn(0),fn2(0),ffi(0),code(c),hw(false) {}
+    };
+    QVector<Extern> externs;
+    typedef QHash<QPair<const char*,const char*>,qint16> ExternIndex;
+    ExternIndex externIndex; // module and procedure symbol -> externs
+
+    struct OakFile
+    {
+        // a Files.File is a pointer to a sequence of one slot holding the index in files
+        QFile* file;
+        MemSlot* handle;
+    };
+    QList<OakFile> files; // owned
+    struct OakRider
+    {
+        int file; // index in files or -1
+        qint64 pos;
+        OakRider(int f = -1, qint64 p = 0):file(f),pos(p) {}
+    };
+    QHash<MemSlot*,OakRider> riders; // the hidden state of each Files.Rider, by its first field
+    QBitArray plane; // XYplane, there is no window, so the dots are only remembered
+    QList<QLibrary*> libraries; // owned, see addLibrary
+    struct CoSegment
+    {
+        // a VM stack and its frames
+        MemSlot* stack;
+        MemSlot* end;
+        Frame* frames;
+        Frame* framesEnd;
+        CoSegment():stack(0),end(0),frames(0),framesEnd(0) {}
+    };
+    struct Coroutine
+    {
+        // a Coroutines.Coroutine; each one which was initialized runs on its own segment, the one
+        // the program started with runs on the VM stack
+        CoSegment seg; // owned
+        ProcData* body;
+        // the suspended state: frame is the innermost frame, its pc the pending Transfer, or 0 if
+        // the body was not entered yet; sp, top, next, end and framesEnd are the VM registers
+        Frame* frame;
+        MemSlot* sp;
+        MemSlot* top;
+        Frame* next;
+        MemSlot* end;
+        Frame* framesEnd;
+        Coroutine():body(0),frame(0),sp(0),top(0),next(0),end(0),framesEnd(0) {}
+    };
+    typedef QHash<MemSlot*,Coroutine*> Coroutines;
+    Coroutines coroutines; // owned
+    QList<CoSegment> coPool; // the segments of reinitialized coroutines
+    Coroutine* current; // 0 until the first transfer
+    Frame* coBottom; // the first frame of the segment of current, 0 if it runs on the VM stack
+    Coroutine* switchFrom; // the transfer to perform when Transfer returns
+    Coroutine* switchTo;
+    enum { CoroutineSlots = 16 * 1024 }; // the minimum segment size
+    QList<Foreign*> foreign; // owned
+
+    enum { FileByte, FileInt, FileLInt, FileReal, FileLReal, FileNum, FileString, FileSet, FileBool, FileBytes };
+
+    void addExtern(const char* module, const char* proc, const Extern& e)
+    {
+        externs.append(e);
+        externIndex.insert(qMakePair(Token::getSymbol(module).constData(), Token::getSymbol(proc).constData()),
+                           externs.size() - 1);
+    }
+
+    void addMath(const char* proc, double (*fn)(double), double (*fn2)(double,double) = 0)
+    {
+        Extern e(fn2 ? &Imp::mathBinary : &Imp::mathUnary);
+        e.fn = fn;
+        e.fn2 = fn2;
+        addExtern("MathL", proc, e);
+        e.hw = true;
+        addExtern("Math", proc, e);
+    }
+
+    static double mathPower(double x, double base) { return pow(base, x); }
+    static double mathLog(double x, double base) { return log(x) / log(base); }
+
+    void registerExterns()
+    {
+        addExtern("Out", "Open", Extern(&Imp::nop));
+        addExtern("Out", "Char", Extern(&Imp::outChar));
+        addExtern("Out", "String", Extern(&Imp::outString));
+        addExtern("Out", "Int", Extern(&Imp::outInt));
+        addExtern("Out", "Real", Extern(&Imp::outReal));
+        addExtern("Out", "LongReal", Extern(&Imp::outReal));
+        addExtern("Out", "Ln", Extern(&Imp::outLn));
+
+        addExtern("In", "Open", Extern(&Imp::inOpen));
+        addExtern("In", "Char", Extern(&Imp::inChar));
+        addExtern("In", "Int", Extern(&Imp::inInt));
+        addExtern("In", "LongInt", Extern(&Imp::inInt, 1));
+        addExtern("In", "Real", Extern(&Imp::inReal));
+        addExtern("In", "LongReal", Extern(&Imp::inReal, 1));
+        addExtern("In", "String", Extern(&Imp::inString));
+        addExtern("In", "Name", Extern(&Imp::inString, 1));
+
+        addExtern("Input", "Available", Extern(&Imp::inputAvailable));
+        addExtern("Input", "Read", Extern(&Imp::inputRead));
+        addExtern("Input", "Mouse", Extern(&Imp::inputMouse));
+        addExtern("Input", "SetMouseLimits", Extern(&Imp::nop));
+        addExtern("Input", "Time", Extern(&Imp::inputTime));
+
+        addMath("sqrt", ::sqrt);
+        addMath("power", 0, mathPower);
+        addMath("exp", ::exp);
+        addMath("ln", ::log);
+        addMath("log", 0, mathLog);
+        addMath("round", ::round);
+        addMath("sin", ::sin);
+        addMath("cos", ::cos);
+        addMath("tan", ::tan);
+        addMath("arcsin", ::asin);
+        addMath("arccos", ::acos);
+        addMath("arctan", ::atan);
+        addMath("arctan2", 0, ::atan2);
+        addMath("sinh", ::sinh);
+        addMath("cosh", ::cosh);
+        addMath("tanh", ::tanh);
+        addMath("arcsinh", ::asinh);
+        addMath("arccosh", ::acosh);
+        addMath("arctanh", ::atanh);
+
+        addExtern("Strings", "Length", Extern(&Imp::strLength));
+        addExtern("Strings", "Insert", Extern(&Imp::strInsert));
+        addExtern("Strings", "Append", Extern(&Imp::strAppend));
+        addExtern("Strings", "Delete", Extern(&Imp::strDelete));
+        addExtern("Strings", "Replace", Extern(&Imp::strReplace));
+        addExtern("Strings", "Extract", Extern(&Imp::strExtract));
+        addExtern("Strings", "Pos", Extern(&Imp::strPos));
+        addExtern("Strings", "Cap", Extern(&Imp::strCap));
+
+        addExtern("Files", "Old", Extern(&Imp::filesOpen));
+        addExtern("Files", "New", Extern(&Imp::filesOpen, 1));
+        addExtern("Files", "Register", Extern(&Imp::filesFlush));
+        addExtern("Files", "Close", Extern(&Imp::filesFlush));
+        addExtern("Files", "Purge", Extern(&Imp::filesPurge));
+        addExtern("Files", "Delete", Extern(&Imp::filesDelete));
+        addExtern("Files", "Rename", Extern(&Imp::filesRename));
+        addExtern("Files", "Length", Extern(&Imp::filesLength));
+        addExtern("Files", "GetDate", Extern(&Imp::filesGetDate));
+        addExtern("Files", "Set", Extern(&Imp::filesSet));
+        addExtern("Files", "Pos", Extern(&Imp::filesPos));
+        addExtern("Files", "Base", Extern(&Imp::filesBase));
+        const char* kinds[] = { "", "Int", "LInt", "Real", "LReal", "Num", "String", "Set", "Bool", "Bytes" };
+        for( int i = FileByte; i <= FileBytes; i++ )
+        {
+            addExtern("Files", QByteArray("Read").append(kinds[i]).constData(), Extern(&Imp::filesRead, i));
+            addExtern("Files", QByteArray("Write").append(kinds[i]).constData(), Extern(&Imp::filesWrite, i));
+        }
+
+        addExtern("XYplane", "Open", Extern(&Imp::xyOpen));
+        addExtern("XYplane", "Clear", Extern(&Imp::xyClear));
+        addExtern("XYplane", "Dot", Extern(&Imp::xyDot));
+        addExtern("XYplane", "IsDot", Extern(&Imp::xyIsDot));
+        addExtern("XYplane", "Key", Extern(&Imp::xyKey));
+
+        addExtern("Coroutines", "Init", Extern(&Imp::coInit));
+        addExtern("Coroutines", "Transfer", Extern(&Imp::coTransfer));
+    }
+
+    void bindExtern(ProcData* pd)
+    {
+        // the built-in implementations take precedence over the libraries
+        pd->ext = externIndex.value(qMakePair(pd->module->module->fullName.constData(),
+                                              pd->proc->name.constData()), -1);
+        if( pd->ext < 0 )
+            pd->ext = bindForeign(pd);
+    }
+
+    void callExtern(ProcData* pd, MemSlot* args, MemSlot& ret)
+    {
+        if( pd->ext < 0 )
+            bindExtern(pd); // not called from prepared code
+        if( pd->ext < 0 )
+            nyiError(pd->module,pd->proc);
+        const Extern& e = externs[pd->ext];
+        (this->*e.handler)(e, pd->module, args, ret);
+    }
+
+    // the integer and floating point argument registers used by callForeign
+    enum { ForeignInts = 6, ForeignReals = 8 };
+
+    struct Foreign
+    {
+        // a procedure in a shared library; the arguments are marshalled as the MIL parameter types
+        // say and passed in registers through one trampoline, see callForeign
+        enum Kind { Value, Ref, Buffer }; // scalar, POINTER TO scalar, POINTER TO ARRAY OF scalar
+        struct Arg
+        {
+            quint8 kind;
+            quint8 type; // MilEmitter::Type of the scalar or the element
+        };
+        void* fn;
+        QVector<Arg> args;
+        quint8 ret; // MilEmitter::Type, Unknown if there is no result
+    };
+
+    MilQuali resolveAlias(ModuleData*& module, MilQuali q)
+    {
+        QPair<MilType*,ModuleData*> mt = getType(module,q);
+        while( mt.first && mt.first->kind == MilEmitter::Alias )
+        {
+            module = mt.second;
+            q = mt.first->base;
+            mt = getType(module,q);
+        }
+        return q;
+    }
+
+    static inline bool isReal(quint8 type)
+    {
+        return type == MilEmitter::R4 || type == MilEmitter::R8;
+    }
+
+    static quint8 foreignType(const QByteArray& sym)
+    {
+        // char and bool are bytes in C, the other scalars have their own MilEmitter::Type
+        static const QByteArray ch = Token::getSymbol("char");
+        static const QByteArray b = Token::getSymbol("bool");
+        if( sym.constData() == ch.constData() || sym.constData() == b.constData() )
+            return MilEmitter::U1;
+        return MilEmitter::fromSymbol(sym);
+    }
+
+    bool foreignArg(ModuleData* module, const MilQuali& type, Foreign::Arg& arg)
+    {
+        MilQuali q = resolveAlias(module, type);
+        QPair<MilType*,ModuleData*> mt = getType(module,q);
+        arg.kind = Foreign::Value;
+        arg.type = MilEmitter::Unknown;
+        if( mt.first == 0 )
+            arg.type = foreignType(q.second);
+        else if( mt.first->kind == MilEmitter::Pointer )
+        {
+            module = mt.second;
+            q = resolveAlias(module, mt.first->base);
+            mt = getType(module,q);
+            arg.kind = Foreign::Ref;
+            if( mt.first && mt.first->kind == MilEmitter::Array )
+            {
+                module = mt.second;
+                q = resolveAlias(module, mt.first->base);
+                mt = getType(module,q);
+                arg.kind = Foreign::Buffer;
+            }
+            if( mt.first == 0 )
+                arg.type = foreignType(q.second);
+        }
+        // there is no C representation of the other types
+        return arg.type != MilEmitter::Unknown && arg.type <= MilEmitter::U8;
+    }
+
+    qint16 bindForeign(ProcData* pd)
+    {
+        // looks up the origName or module$name of pd in the libraries added with addLibrary
+        MilProcedure* proc = pd->proc;
+        if( libraries.isEmpty() || proc->isVararg )
+            return -1;
+        QByteArray sym = proc->origName;
+        if( sym.isEmpty() )
+            sym = pd->module->module->fullName + "$" + proc->name;
+        void* fn = 0;
+        for( int i = 0; i < libraries.size() && fn == 0; i++ )
+            fn = (void*)libraries[i]->resolve(sym.constData());
+        if( fn == 0 )
+            return -1;
+        Foreign* f = new Foreign();
+        foreign.append(f);
+        f->fn = fn;
+        f->ret = MilEmitter::Unknown;
+        int ints = 0, reals = 0;
+        for( int i = 0; i < proc->params.size(); i++ )
+        {
+            Foreign::Arg a;
+            if( !foreignArg(pd->module, proc->params[i].type, a) )
+                throw QString("%1: parameter %2 cannot be passed to a C function").arg(sym.constData()).arg(i+1);
+            if( a.kind == Foreign::Value && isReal(a.type) )
+                reals++;
+            else
+                ints++;
+            f->args.append(a);
+        }
+        if( ints > ForeignInts || reals > ForeignReals )
+            throw QString("%1: too many parameters for a C function").arg(sym.constData());
+        if( !proc->retType.second.isEmpty() )
+        {
+            Foreign::Arg a;
+            if( !foreignArg(pd->module, proc->retType, a) || a.kind != Foreign::Value )
+                throw QString("%1: the result cannot be returned from a C function").arg(sym.constData());
+            f->ret = a.type;
+        }
+        Extern e(&Imp::callForeign);
+        e.ffi = f;
+        externs.append(e);
+        externIndex.insert(qMakePair(pd->module->module->fullName.constData(), proc->name.constData()),
+                           externs.size() - 1);
+        return externs.size() - 1;
+    }
+
+    static quint32 scalarSize(quint8 type)
+    {
+        switch( type )
+        {
+        case MilEmitter::I1: case MilEmitter::U1:
+            return 1;
+        case MilEmitter::I2: case MilEmitter::U2:
+            return 2;
+        case MilEmitter::I4: case MilEmitter::U4: case MilEmitter::R4:
+            return 4;
+        default:
+            return 8;
+        }
+    }
+
+    static void storeScalar(char* p, quint8 type, const MemSlot& s)
+    {
+        // the C representation of s, little endian
+        if( type == MilEmitter::R4 )
+        {
+            const float f = s.f;
+            memcpy(p, &f, 4);
+        }else if( type == MilEmitter::R8 )
+            memcpy(p, &s.f, 8);
+        else
+            memcpy(p, &s.u, scalarSize(type));
+    }
+
+    static MemSlot loadScalar(const char* p, quint8 type)
+    {
+        switch( type )
+        {
+        case MilEmitter::I1:
+            return MemSlot(qint64(*(const qint8*)p), true);
+        case MilEmitter::I2:
+            {
+                qint16 v;
+                memcpy(&v, p, 2);
+                return MemSlot(qint64(v), true);
+            }
+        case MilEmitter::I4:
+            {
+                qint32 v;
+                memcpy(&v, p, 4);
+                return MemSlot(qint64(v), true);
+            }
+        case MilEmitter::I8:
+            {
+                qint64 v;
+                memcpy(&v, p, 8);
+                return MemSlot(v, false);
+            }
+        case MilEmitter::U1:
+            return MemSlot(quint64(*(const quint8*)p), true);
+        case MilEmitter::U2:
+            {
+                quint16 v;
+                memcpy(&v, p, 2);
+                return MemSlot(quint64(v), true);
+            }
+        case MilEmitter::U4:
+            {
+                quint32 v;
+                memcpy(&v, p, 4);
+                return MemSlot(quint64(v), true);
+            }
+        case MilEmitter::R4:
+            {
+                float v;
+                memcpy(&v, p, 4);
+                return MemSlot(double(v), true);
+            }
+        case MilEmitter::R8:
+            {
+                double v;
+                memcpy(&v, p, 8);
+                return MemSlot(v, false);
+            }
+        default:
+            {
+                quint64 v;
+                memcpy(&v, p, 8);
+                return MemSlot(v, false);
+            }
+        }
+    }
+
+#ifdef _MIC_FFI
+    // all argument registers are loaded, the callee only looks at the ones of its parameters
+    typedef quint64 (*ForeignInt)(quint64, quint64, quint64, quint64, quint64, quint64,
+                                  double, double, double, double, double, double, double, double);
+    typedef double (*ForeignReal)(quint64, quint64, quint64, quint64, quint64, quint64,
+                                  double, double, double, double, double, double, double, double);
+    union RealReg
+    {
+        // a float is passed and returned in the low half of the floating point register
+        double d;
+        float f;
+        quint64 u;
+    };
+#endif
+
+    void callForeign(const Extern& e, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+#ifdef _MIC_FFI
+        const Foreign* f = e.ffi;
+        quint64 ints[ForeignInts] = { 0 };
+        RealReg reals[ForeignReals];
+        for( int i = 0; i < ForeignReals; i++ )
+            reals[i].u = 0;
+        int ni = 0, nr = 0;
+        QVarLengthArray<quint64, 8> refs(f->args.size());
+        QVarLengthArray<QByteArray, 4> buffers(f->args.size());
+        for( int i = 0; i < f->args.size(); i++ )
+        {
+            const Foreign::Arg& a = f->args[i];
+            switch( a.kind )
+            {
+            case Foreign::Value:
+                if( a.type == MilEmitter::R4 )
+                    reals[nr++].f = args[i].f;
+                else if( a.type == MilEmitter::R8 )
+                    reals[nr++].d = args[i].f;
+                else
+                {
+                    char tmp[8];
+                    storeScalar(tmp, a.type, args[i]);
+                    ints[ni++] = loadScalar(tmp, a.type).u; // sign or zero extended as C expects
+                }
+                break;
+            case Foreign::Ref:
+                refs[i] = 0;
+                storeScalar((char*)&refs[i], a.type, target(args[i]));
+                ints[ni++] = (quint64)&refs[i];
+                break;
+            case Foreign::Buffer:
+                {
+                    // a copy of the elements, copied back after the call
+                    quint32 cap;
+                    const MemSlot* s = charsToWrite(args[i], cap);
+                    const quint32 size = scalarSize(a.type);
+                    buffers[i].resize(cap * size);
+                    for( quint32 j = 0; j < cap; j++ )
+                        storeScalar(buffers[i].data() + j * size, a.type, s[j]);
+                    ints[ni++] = (quint64)buffers[i].data();
+                }
+                break;
+            }
+        }
+        out.flush(); // the callee might write to stdout too
+        if( isReal(f->ret) )
+        {
+            RealReg r;
+            r.d = ((ForeignReal)f->fn)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5],
+                    reals[0].d, reals[1].d, reals[2].d, reals[3].d, reals[4].d, reals[5].d, reals[6].d, reals[7].d);
+            ret = f->ret == MilEmitter::R4 ? MemSlot(double(r.f), true) : MemSlot(r.d, false);
+        }else
+        {
+            const quint64 r = ((ForeignInt)f->fn)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5],
+                    reals[0].d, reals[1].d, reals[2].d, reals[3].d, reals[4].d, reals[5].d, reals[6].d, reals[7].d);
+            if( f->ret != MilEmitter::Unknown )
+                ret = loadScalar((const char*)&r, f->ret);
+        }
+        for( int i = 0; i < f->args.size(); i++ )
+        {
+            const Foreign::Arg& a = f->args[i];
+            if( a.kind == Foreign::Ref )
+                target(args[i]) = loadScalar((const char*)&refs[i], a.type);
+            else if( a.kind == Foreign::Buffer )
+            {
+                quint32 cap;
+                MemSlot* d = charsToWrite(args[i], cap);
+                const quint32 size = scalarSize(a.type);
+                for( quint32 j = 0; j < cap; j++ )
+                    d[j] = loadScalar(buffers[i].constData() + j * size, a.type);
+            }
+        }
+#else
+        Q_UNUSED(e);
+        Q_UNUSED(args);
+        Q_UNUSED(ret);
+        throw QString("calling C functions is not supported on this platform");
+#endif
+    }
+
+    QString error; // of the last call through the MilInterpreter API
+    QHash<ProcData*,Foreign*> hostProcs; // the signatures of the procedures resolved by the host
+
+    bool charArray(ModuleData* module, const MilQuali& type)
+    {
+        // an ARRAY OF CHAR or BYTE by value, which the host reads and writes as a QByteArray
+        MilQuali q = resolveAlias(module, type);
+        QPair<MilType*,ModuleData*> mt = getType(module,q);
+        if( mt.first == 0 || mt.first->kind != MilEmitter::Array )
+            return false;
+        module = mt.second;
+        q = resolveAlias(module, mt.first->base);
+        if( getType(module,q).first )
+            return false;
+        const quint8 t = foreignType(q.second);
+        return t == MilEmitter::U1 || t == MilEmitter::I1;
+    }
+
+    static MemSlot fromHost(quint8 type, const QVariant& v)
+    {
+        MemSlot s;
+        if( isReal(type) )
+            s = MemSlot(v.toDouble(), type == MilEmitter::R4);
+        else if( type >= MilEmitter::U1 && type <= MilEmitter::U8 )
+            s = MemSlot(quint64(v.toULongLong()));
+        else
+            s = MemSlot(qint64(v.toLongLong()));
+        char tmp[8];
+        storeScalar(tmp, type, s);
+        return loadScalar(tmp, type); // truncated to the width of type
+    }
+
+    static QVariant toHost(quint8 type, const MemSlot& s)
+    {
+        if( isReal(type) )
+            return s.f;
+        else if( type >= MilEmitter::U1 && type <= MilEmitter::U8 )
+            return qulonglong(s.u);
+        else
+            return qlonglong(s.i);
+    }
+
+    Foreign* hostSignature(ProcData* pd)
+    {
+        // the parameters and the result of pd as the host sees them; strings are POINTER TO ARRAY OF CHAR
+        Foreign*& f = hostProcs[pd];
+        if( f )
+            return f;
+        MilProcedure* proc = pd->proc;
+        Foreign* sig = new Foreign();
+        foreign.append(sig);
+        sig->fn = 0;
+        sig->ret = MilEmitter::Unknown;
+        for( int i = 0; i < proc->params.size(); i++ )
+        {
+            Foreign::Arg a;
+            if( !foreignArg(pd->module, proc->params[i].type, a) ||
+                    ( a.kind == Foreign::Buffer && a.type != MilEmitter::U1 && a.type != MilEmitter::I1 ) )
+                throw QString("parameter %1 of %2 cannot be passed by the host").arg(i+1).arg(proc->name.constData());
+            sig->args.append(a);
+        }
+        if( !proc->retType.second.isEmpty() )
+        {
+            Foreign::Arg a;
+            if( !foreignArg(pd->module, proc->retType, a) || a.kind != Foreign::Value )
+                throw QString("the result of %1 cannot be returned to the host").arg(proc->name.constData());
+            sig->ret = a.type;
+        }
+        f = sig;
+        return f;
+    }
+
+    ProcData* resolveFromHost(const QByteArray& module, const QByteArray& name)
+    {
+        ModuleData* md = loadModule(Token::getSymbol(module));
+        if( md == 0 || md->module == 0 )
+            throw QString("module %1 not found").arg(module.constData());
+        ProcData* pd = getProc(md, MilQuali(QByteArray(), Token::getSymbol(name)));
+        if( pd == 0 || !pd->proc->isPublic ||
+                ( pd->proc->kind != MilProcedure::Normal && pd->proc->kind != MilProcedure::Extern ) )
+            throw QString("%1.%2 is not an exported procedure").arg(module.constData()).arg(name.constData());
+        hostSignature(pd);
+        if( pd->proc->kind == MilProcedure::Normal && !pd->prepared )
+            prepareBytecode(pd);
+        return pd;
+    }
+
+    QVariant callFromHost(ProcData* pd, const QVariantList& args, QVariantList* back)
+    {
+        // the arguments are put where a caller would have pushed them; strings and the variables
+        // behind POINTER TO scalar parameters only live during the call, the latter are copied to back
+        const Foreign* sig = hostSignature(pd);
+        const int n = sig->args.size();
+        if( args.size() != n )
+            throw QString("%1 expects %2 arguments").arg(pd->proc->name.constData()).arg(n);
+        if( back == 0 )
+            for( int i = 0; i < n; i++ )
+                if( sig->args[i].kind == Foreign::Ref )
+                    throw QString("parameter %1 of %2 is a POINTER TO scalar and needs a modifiable argument list").
+                        arg(i+1).arg(pd->proc->name.constData());
+        MemSlot* a = vmTop;
+        if( a + n + 1 > vmEnd )
+            throw QString("stack overflow");
+        QVarLengthArray<MemSlot, 4> refs(n);
+        QVarLengthArray<MemSlot*, 4> strs;
+        for( int i = 0; i < n; i++ )
+        {
+            const Foreign::Arg& t = sig->args[i];
+            switch( t.kind )
+            {
+            case Foreign::Value:
+                a[i] = fromHost(t.type, args[i]);
+                break;
+            case Foreign::Ref:
+                refs[i] = fromHost(t.type, args[i]);
+                a[i] = MemSlot(&refs[i]);
+                break;
+            case Foreign::Buffer:
+                {
+                    const QByteArray str = args[i].toByteArray();
+                    MemSlot* s = createSequence(str.size() + 1);
+                    for( int j = 0; j < str.size(); j++ )
+                        s[j] = charSlot(str[j]);
+                    s[str.size()] = charSlot(0);
+                    strs.append(s);
+                    a[i] = MemSlot(s);
+                    a[i].embedded = true; // points directly to the chars, like ldstr
+                }
+                break;
+            }
+        }
+        QVariant res;
+        try
+        {
+            execute(pd, a);
+            if( sig->ret != MilEmitter::Unknown )
+            {
+                res = toHost(sig->ret, a[0]);
+                a[0].clear();
+            }
+        }catch(...)
+        {
+            for( int i = 0; i < strs.size(); i++ )
+                MemSlot::dispose(strs[i]);
+            throw;
+        }
+        for( int i = 0; i < strs.size(); i++ )
+            MemSlot::dispose(strs[i]);
+        if( back )
+            for( int i = 0; i < n; i++ )
+                if( sig->args[i].kind == Foreign::Ref )
+                    (*back)[i] = toHost(sig->args[i].type, refs[i]);
+        return res;
+    }
+
+    MemSlot& hostVariable(const QByteArray& module, const QByteArray& name, ModuleData*& md, const MilVariable*& var)
+    {
+        md = loadModule(Token::getSymbol(module));
+        if( md == 0 || md->module == 0 )
+            throw QString("module %1 not found").arg(module.constData());
+        const int i = md->module->indexOfVar(Token::getSymbol(name));
+        if( i < 0 || !md->module->vars[i].isPublic )
+            throw QString("%1.%2 is not an exported variable").arg(module.constData()).arg(name.constData());
+        var = &md->module->vars[i];
+        return md->variables[i];
+    }
+
+    QVariant getFromHost(const QByteArray& module, const QByteArray& name)
+    {
+        ModuleData* md;
+        const MilVariable* var;
+        const MemSlot& v = hostVariable(module, name, md, var);
+        Foreign::Arg t;
+        if( foreignArg(md, var->type, t) && t.kind == Foreign::Value )
+            return toHost(t.type, v);
+        if( charArray(md, var->type) && v.t == MemSlot::Array && v.p )
+            return toStr(v);
+        throw QString("%1.%2 cannot be read by the host").arg(module.constData()).arg(name.constData());
+    }
+
+    void setFromHost(const QByteArray& module, const QByteArray& name, const QVariant& value)
+    {
+        ModuleData* md;
+        const MilVariable* var;
+        MemSlot& v = hostVariable(module, name, md, var);
+        Foreign::Arg t;
+        if( foreignArg(md, var->type, t) && t.kind == Foreign::Value )
+            v = fromHost(t.type, value);
+        else if( charArray(md, var->type) && v.t == MemSlot::Array && v.p )
+        {
+            // truncated to the length of the array
+            v.unshare();
+            const QByteArray str = value.toByteArray();
+            const int len = qMin(str.size(), int(header(v.p, 0)->u) - 1);
+            for( int i = 0; i < len; i++ )
+                v.p[i] = charSlot(str[i]);
+            if( len >= 0 )
+                v.p[len] = charSlot(0);
+        }else
+            throw QString("%1.%2 cannot be written by the host").arg(module.constData()).arg(name.constData());
+    }
+
+    bool enterFromHost()
+    {
+        // an EXTERN procedure bound to the host runs on top of the stack of the caller, which must stay intact
+        if( vmTop != vmStack || vmFrame != vmFrames )
+        {
+            error = "the interpreter is already running";
+            return false;
+        }
+        resetStack();
+        return true;
+    }
+
+    QVariant call(void* proc, const QVariantList& args, QVariantList* back)
+    {
+        error.clear();
+        if( proc == 0 )
+        {
+            error = "invalid procedure";
+            return QVariant();
+        }
+        if( !enterFromHost() )
+            return QVariant();
+        try
+        {
+            QVariant res = callFromHost((ProcData*)proc, args, back);
+            out.flush();
+            return res;
+        }catch(const QString& str)
+        {
+            out.flush();
+            resetStack();
+            error = str;
+        }
+        return QVariant();
+    }
+
+    static MemSlot& variable(ModuleData* module, const char* name)
+    {
+        const int i = module->module->indexOfVar(Token::getSymbol(name));
+        if( i < 0 )
+            throw QString("%1.%2 not declared").arg(module->module->fullName.constData()).arg(name);
+        return module->variables[i];
+    }
+
+    static MemSlot& target(const MemSlot& s)
+    {
+        // the variable a POINTER TO parameter points to
+        if( s.t != MemSlot::Pointer || s.p == 0 )
+            throw QString("invalid pointer argument");
+        return *s.p;
+    }
+
+    static MemSlot* charsToWrite(const MemSlot& s, quint32& cap)
+    {
+        // the elements of a POINTER TO ARRAY OF CHAR or BYTE parameter and their number
+        MemSlot* p = &target(s);
+        quint32 off = s.off;
+        if( !s.embedded && p->t == MemSlot::Array )
+        {
+            p = p->expose();
+            off = 0;
+        }
+        cap = p ? header(p, off)->u - off : 0;
+        return p;
+    }
+
+    static MemSlot* fieldsOf(const MemSlot& s)
+    {
+        // the fields of a POINTER TO record parameter
+        MemSlot* p = &target(s);
+        if( !s.embedded && p->t == MemSlot::Record )
+            p = p->expose();
+        if( p == 0 )
+            throw QString("invalid record argument");
+        return p;
+    }
+
+    static inline MemSlot charSlot(int ch)
+    {
+        return MemSlot(quint64((quint8)ch));
+    }
+
+    void nop(const Extern&, ModuleData*, MemSlot*, MemSlot&)
+    {
+    }
+
+    void outChar(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        // stdout is only flushed at line ends, before reading stdin and when the program ends
+        if( args[0].u == '\n' )
+            out << endl;
+        else
+            out << (char)(quint8)args[0].u;
+    }
+
+    void outString(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        writeStr(args[0]);
+    }
+
+    void outInt(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        out << QByteArray::number(args[0].i).rightJustified(args[1].i).constData();
+    }
+
+    void outReal(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        char buf[64];
+        qsnprintf(buf, sizeof(buf), "%*e", int(qBound(qint64(0), args[1].i, qint64(sizeof(buf) - 1))), args[0].f);
+        out << buf;
+    }
+
+    void outLn(const Extern&, ModuleData*, MemSlot*, MemSlot&)
+    {
+        out << endl;
+    }
+
+    int readChar()
+    {
+        // stdin is read through the C library buffer; a prompt must be visible before waiting
+        out.flush();
+        return getc(stdin);
+    }
+
+    QByteArray readToken(bool quoted)
+    {
+        int ch = readChar();
+        while( ch != EOF && isspace(ch) )
+            ch = readChar();
+        QByteArray res;
+        if( quoted )
+        {
+            if( ch != '"' )
+                return res;
+            ch = readChar();
+            while( ch != EOF && ch != '"' && ch != '\n' )
+            {
+                res += (char)ch;
+                ch = readChar();
+            }
+            if( ch != '"' )
+                res.clear();
+            return res;
+        }
+        while( ch != EOF && !isspace(ch) )
+        {
+            res += (char)ch;
+            ch = readChar();
+        }
+        if( ch != EOF )
+            ungetc(ch, stdin);
+        return res;
+    }
+
+    void inOpen(const Extern&, ModuleData* module, MemSlot*, MemSlot&)
+    {
+        variable(module, "Done") = MemSlot(quint64(1));
+    }
+
+    void inChar(const Extern&, ModuleData* module, MemSlot* args, MemSlot&)
+    {
+        const int ch = readChar();
+        if( ch != EOF )
+            target(args[0]) = charSlot(ch);
+        variable(module, "Done") = MemSlot(quint64(ch != EOF));
+    }
+
+    void inInt(const Extern& e, ModuleData* module, MemSlot* args, MemSlot&)
+    {
+        // decimal, or hexadecimal with an H suffix
+        QByteArray tok = readToken(false);
+        bool ok = false;
+        qint64 i;
+        if( tok.endsWith('H') )
+        {
+            tok.chop(1);
+            i = tok.toULongLong(&ok, 16);
+        }else
+            i = tok.toLongLong(&ok);
+        if( ok )
+            target(args[0]) = MemSlot(i, e.code == 0);
+        variable(module, "Done") = MemSlot(quint64(ok));
+    }
+
+    void inReal(const Extern& e, ModuleData* module, MemSlot* args, MemSlot&)
+    {
+        bool ok = false;
+        const double d = readToken(false).toDouble(&ok);
+        if( ok )
+            target(args[0]) = MemSlot(d, e.code == 0);
+        variable(module, "Done") = MemSlot(quint64(ok));
+    }
+
+    void inString(const Extern& e, ModuleData* module, MemSlot* args, MemSlot&)
+    {
+        // String reads a quoted string, Name a sequence of non-blank chars
+        const QByteArray tok = readToken(e.code == 0);
+        quint32 cap;
+        MemSlot* d = charsToWrite(args[0], cap);
+        const bool ok = !tok.isEmpty() && quint32(tok.size()) < cap;
+        if( ok )
+        {
+            for( int i = 0; i < tok.size(); i++ )
+                d[i] = charSlot(tok[i]);
+            d[tok.size()] = charSlot(0);
+        }
+        variable(module, "Done") = MemSlot(quint64(ok));
+    }
+
+    void inputAvailable(const Extern&, ModuleData*, MemSlot*, MemSlot& ret)
+    {
+        ret = MemSlot(qint64(0), true); // there is no keyboard, only stdin which cannot be polled portably
+    }
+
+    void inputRead(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        const int ch = readChar();
+        target(args[0]) = charSlot(ch == EOF ? 0 : ch);
+    }
+
+    void inputMouse(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        target(args[0]) = MemSlot(quint64(0), true);
+        target(args[1]) = MemSlot(qint64(0), true);
+        target(args[2]) = MemSlot(qint64(0), true);
+    }
+
+    void inputTime(const Extern&, ModuleData*, MemSlot*, MemSlot& ret)
+    {
+        ret.t = MemSlot::I;
+#ifdef _USE_GETTIMEOFDAY
+        struct timeval now;
+        gettimeofday(&now, 0);
+        const long seconds = now.tv_sec - start.tv_sec;
+        const long microseconds = now.tv_usec - start.tv_usec;
+        ret.i = seconds*1000000 + microseconds;
+#else
+        ret.i = timer.nsecsElapsed() / 1000;
+#endif
+    }
+
+    void mathUnary(const Extern& e, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(e.fn(args[0].f), e.hw);
+    }
+
+    void mathBinary(const Extern& e, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(e.fn2(args[0].f, args[1].f), e.hw);
+    }
+
+    void strLength(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(qint64(strLen(chars(args[0]))), true);
+    }
+
+    static void insert(const MemSlot* s, qint64 pos, MemSlot* d, quint32 cap)
+    {
+        // the result is truncated to the capacity of d
+        const quint32 len = strLen(d);
+        if( cap == 0 || pos < 0 || pos > len )
+            return;
+        quint32 n = strLen(s);
+        if( pos + n > cap - 1 )
+            n = cap - 1 - pos;
+        const quint32 newLen = qMin(len + n, cap - 1);
+        for( quint32 i = newLen; i > pos + n; i-- )
+            d[i-1] = d[i-1-n];
+        for( quint32 i = 0; i < n; i++ )
+            d[pos+i] = s[i];
+        d[newLen] = charSlot(0);
+    }
+
+    void strInsert(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        quint32 cap;
+        MemSlot* d = charsToWrite(args[2], cap);
+        insert(chars(args[0]), args[1].i, d, cap);
+    }
+
+    void strAppend(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        quint32 cap;
+        MemSlot* d = charsToWrite(args[1], cap);
+        insert(chars(args[0]), strLen(d), d, cap);
+    }
+
+    void strDelete(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        quint32 cap;
+        MemSlot* d = charsToWrite(args[0], cap);
+        const qint64 len = strLen(d);
+        const qint64 pos = args[1].i;
+        if( pos < 0 || pos >= len || args[2].i <= 0 )
+            return;
+        const qint64 n = qMin(args[2].i, len - pos);
+        for( qint64 i = pos; i + n <= len; i++ )
+            d[i] = d[i+n];
+    }
+
+    void strReplace(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        quint32 cap;
+        MemSlot* d = charsToWrite(args[2], cap);
+        const quint32 len = strLen(d);
+        if( args[1].i < 0 || args[1].i > len )
+            return;
+        quint32 pos = args[1].i;
+        for( const MemSlot* s = chars(args[0]); s->u && pos + 1 < cap; s++, pos++ )
+            d[pos] = *s;
+        if( pos > len )
+            d[pos] = charSlot(0);
+    }
+
+    void strExtract(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        quint32 cap;
+        MemSlot* d = charsToWrite(args[3], cap);
+        const MemSlot* s = chars(args[0]);
+        const qint64 len = strLen(s);
+        if( cap == 0 )
+            return;
+        const qint64 pos = qBound(qint64(0), args[1].i, len);
+        const qint64 n = qBound(qint64(0), args[2].i, qMin(len - pos, qint64(cap) - 1));
+        for( qint64 i = 0; i < n; i++ )
+            d[i] = s[pos+i];
+        d[n] = charSlot(0);
+    }
+
+    void strPos(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        const MemSlot* pat = chars(args[0]);
+        const MemSlot* s = chars(args[1]);
+        const qint64 len = strLen(s);
+        const qint64 n = strLen(pat);
+        for( qint64 i = qMax(args[2].i, qint64(0)); i + n <= len; i++ )
+        {
+            qint64 j = 0;
+            while( j < n && s[i+j].u == pat[j].u )
+                j++;
+            if( j == n )
+            {
+                ret = MemSlot(i, true);
+                return;
+            }
+        }
+        ret = MemSlot(qint64(-1), true);
+    }
+
+    void strCap(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        quint32 cap;
+        for( MemSlot* d = charsToWrite(args[0], cap); d->u; d++ )
+        {
+            if( d->u >= 'a' && d->u <= 'z' )
+                *d = charSlot(d->u - 'a' + 'A');
+        }
+    }
+
+    int fileOf(const MemSlot& f)
+    {
+        if( f.t != MemSlot::Pointer || f.p == 0 || f.p->i < 0 || f.p->i >= files.size() || files[f.p->i].file == 0 )
+            throw QString("invalid file");
+        return f.p->i;
+    }
+
+    OakRider& riderOf(MemSlot* r)
+    {
+        QHash<MemSlot*,OakRider>::iterator i = riders.find(r);
+        if( i == riders.end() || i.value().file < 0 )
+            throw QString("rider is not set to a file");
+        return i.value();
+    }
+
+    static void setRider(MemSlot* r, bool eof, qint64 res)
+    {
+        // the visible fields of a Files.Rider: eof, res
+        r[0] = MemSlot(quint64(eof));
+        r[1] = MemSlot(res, true);
+    }
+
+    void filesOpen(const Extern& e, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        // Old opens an existing file, New creates the file right away so Register only has to flush it
+        ret = MemSlot((MemSlot*)0);
+        QFile* f = new QFile(QString::fromLocal8Bit(toStr(args[0])));
+        bool ok;
+        if( e.code )
+            ok = f->open(QIODevice::ReadWrite | QIODevice::Truncate);
+        else
+            ok = f->exists() && ( f->open(QIODevice::ReadWrite) || f->open(QIODevice::ReadOnly) );
+        if( !ok )
+        {
+            delete f;
+            return;
+        }
+        OakFile of;
+        of.file = f;
+        of.handle = createSequence(1);
+        of.handle[0] = MemSlot(qint64(files.size()));
+        files.append(of);
+        ret = MemSlot(of.handle);
+    }
+
+    void filesFlush(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        files[fileOf(args[0])].file->flush();
+    }
+
+    void filesPurge(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        files[fileOf(args[0])].file->resize(0);
+    }
+
+    void filesDelete(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        const bool ok = QFile::remove(QString::fromLocal8Bit(toStr(args[0])));
+        target(args[1]) = MemSlot(qint64(ok ? 0 : 1), true);
+    }
+
+    void filesRename(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        const bool ok = QFile::rename(QString::fromLocal8Bit(toStr(args[0])), QString::fromLocal8Bit(toStr(args[1])));
+        target(args[2]) = MemSlot(qint64(ok ? 0 : 1), true);
+    }
+
+    void filesLength(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(qint64(files[fileOf(args[0])].file->size()), true);
+    }
+
+    void filesGetDate(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        // Oberon encoding: t = hour*4096 + min*64 + sec, d = (year-1900)*512 + month*32 + day
+        const QDateTime dt = QFileInfo(*files[fileOf(args[0])].file).lastModified();
+        const QTime t = dt.time();
+        const QDate d = dt.date();
+        target(args[1]) = MemSlot(qint64(t.hour() * 4096 + t.minute() * 64 + t.second()), true);
+        target(args[2]) = MemSlot(qint64((d.year() - 1900) * 512 + d.month() * 32 + d.day()), true);
+    }
+
+    void filesSet(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        MemSlot* r = fieldsOf(args[0]);
+        const MemSlot& f = args[1];
+        if( f.t == MemSlot::Pointer && f.p == 0 )
+            riders[r] = OakRider();
+        else
+        {
+            const int i = fileOf(f);
+            riders[r] = OakRider(i, qBound(qint64(0), args[2].i, files[i].file->size()));
+        }
+        setRider(r, false, 0);
+    }
+
+    void filesPos(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(riderOf(fieldsOf(args[0])).pos, true);
+    }
+
+    void filesBase(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(files[riderOf(fieldsOf(args[0])).file].handle);
+    }
+
+    int readBytes(MemSlot* r, char* buf, int n)
+    {
+        // sets eof and res of the rider if less than n bytes were available
+        OakRider& rd = riderOf(r);
+        QFile* f = files[rd.file].file;
+        int got = 0;
+        if( f->seek(rd.pos) )
+            got = qMax(qint64(0), f->read(buf, n));
+        rd.pos += got;
+        if( got < n )
+        {
+            memset(buf + got, 0, n - got);
+            setRider(r, true, n - got);
+        }
+        return got;
+    }
+
+    void writeBytes(MemSlot* r, const char* buf, int n)
+    {
+        OakRider& rd = riderOf(r);
+        QFile* f = files[rd.file].file;
+        int put = 0;
+        if( f->seek(rd.pos) )
+            put = qMax(qint64(0), f->write(buf, n));
+        rd.pos += put;
+        if( put < n )
+            setRider(r, false, n - put);
+    }
+
+    quint64 readInt(MemSlot* r, int n)
+    {
+        // little endian
+        quint8 buf[8];
+        readBytes(r, (char*)buf, n);
+        quint64 x = 0;
+        for( int i = n - 1; i >= 0; i-- )
+            x = x << 8 | buf[i];
+        return x;
+    }
+
+    void writeInt(MemSlot* r, quint64 x, int n)
+    {
+        char buf[8];
+        for( int i = 0; i < n; i++, x >>= 8 )
+            buf[i] = (char)(x & 0xff);
+        writeBytes(r, buf, n);
+    }
+
+    void filesRead(const Extern& e, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        MemSlot* r = fieldsOf(args[0]);
+        switch( e.code )
+        {
+        case FileByte:
+            target(args[1]) = MemSlot(readInt(r, 1));
+            break;
+        case FileBool:
+            target(args[1]) = MemSlot(quint64(readInt(r, 1) != 0));
             break;
-        case QVariant::Double:
-            out.f = data.toDouble();
-            out.t = MemSlot::F;
+        case FileInt:
+            target(args[1]) = MemSlot(qint64((qint32)readInt(r, 4)), true);
+            break;
+        case FileLInt:
+            target(args[1]) = MemSlot(qint64(readInt(r, 8)));
+            break;
+        case FileSet:
+            target(args[1]) = MemSlot(readInt(r, 4), true);
+            break;
+        case FileReal:
+            {
+                const quint32 x = readInt(r, 4);
+                float f;
+                memcpy(&f, &x, 4);
+                target(args[1]) = MemSlot(double(f), true);
+            }
+            break;
+        case FileLReal:
+            {
+                const quint64 x = readInt(r, 8);
+                double d;
+                memcpy(&d, &x, 8);
+                target(args[1]) = MemSlot(d, false);
+            }
+            break;
+        case FileNum:
+            {
+                // Oberon compact encoding, 7 bits per byte, the last byte carries the sign
+                qint64 n = 0;
+                int s = 0;
+                quint8 ch = readInt(r, 1);
+                while( ch >= 128 && s < 64 )
+                {
+                    n += qint64(ch - 128) << s;
+                    s += 7;
+                    ch = readInt(r, 1);
+                }
+                n += qint64((ch & 63) - (ch & 64)) << s;
+                target(args[1]) = MemSlot(n, true);
+            }
+            break;
+        case FileString:
+            {
+                // up to and including the terminating zero, which is also written if the string is truncated
+                quint32 cap;
+                MemSlot* d = charsToWrite(args[1], cap);
+                quint32 i = 0;
+                char ch;
+                while( readBytes(r, &ch, 1) == 1 && ch != 0 )
+                {
+                    if( i + 1 < cap )
+                        d[i++] = charSlot(ch);
+                }
+                if( cap )
+                    d[i] = charSlot(0);
+            }
+            break;
+        case FileBytes:
+            {
+                quint32 cap;
+                MemSlot* d = charsToWrite(args[1], cap);
+                const int n = qBound(qint64(0), args[2].i, qint64(cap));
+                QByteArray buf(n, 0);
+                readBytes(r, buf.data(), n);
+                for( int i = 0; i < n; i++ )
+                    d[i] = charSlot(buf[i]);
+            }
+            break;
+        }
+    }
+
+    void filesWrite(const Extern& e, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        MemSlot* r = fieldsOf(args[0]);
+        switch( e.code )
+        {
+        case FileByte:
+        case FileBool:
+            writeInt(r, args[1].u, 1);
+            break;
+        case FileInt:
+        case FileSet:
+            writeInt(r, args[1].u, 4);
+            break;
+        case FileLInt:
+            writeInt(r, args[1].u, 8);
+            break;
+        case FileReal:
+            {
+                const float f = args[1].f;
+                quint32 x;
+                memcpy(&x, &f, 4);
+                writeInt(r, x, 4);
+            }
+            break;
+        case FileLReal:
+            writeInt(r, args[1].u, 8);
+            break;
+        case FileNum:
+            {
+                qint64 x = args[1].i;
+                while( x < -64 || x > 63 )
+                {
+                    writeInt(r, (x & 127) + 128, 1);
+                    x >>= 7;
+                }
+                writeInt(r, x & 127, 1);
+            }
+            break;
+        case FileString:
+            {
+                const QByteArray str = toStr(args[1]);
+                writeBytes(r, str.constData(), str.size() + 1); // including the terminating zero
+            }
+            break;
+        case FileBytes:
+            {
+                quint32 cap;
+                const MemSlot* s = charsToWrite(args[1], cap);
+                const int n = qBound(qint64(0), args[2].i, qint64(cap));
+                QByteArray buf(n, 0);
+                for( int i = 0; i < n; i++ )
+                    buf[i] = (char)(quint8)s[i].u;
+                writeBytes(r, buf.constData(), n);
+            }
             break;
-        default:
-            Q_ASSERT(false);
         }
     }
 
-    inline void makeCall(QList<MemSlot>& stack, MilProcedure* proc, ModuleData* md, MemSlot* self = 0)
+    enum { PlaneWidth = 640, PlaneHeight = 480 };
+
+    void xyOpen(const Extern&, ModuleData* module, MemSlot*, MemSlot&)
     {
-        // TODO: support varargs
-        MemSlotList args(proc->params.size());
-        for( int i = proc->params.size()-1; i >= 0; i-- )
-        {
-            if(self && i == 0)
-            {
-                // NOTE: a bound proc comes with receiver as explicit first param
-                Q_ASSERT(!proc->binding.isEmpty());
-                args[i] = MemSlot(self);
-                break;
-            }
-            if( stack.isEmpty() )
-                execError(md,proc,"not enough actual parameters");
-            args[i].move(stack.back());
-            stack.pop_back();
-        }
-        MemSlot ret;
-        execute(md, proc, args, ret);
-        if( !proc->retType.second.isEmpty() )
-        {
-            stack.push_back(MemSlot());
-            stack.back().move(ret);
-        }
+        plane = QBitArray(PlaneWidth * PlaneHeight);
+        variable(module, "X") = MemSlot(qint64(0), true);
+        variable(module, "Y") = MemSlot(qint64(0), true);
+        variable(module, "W") = MemSlot(qint64(PlaneWidth), true);
+        variable(module, "H") = MemSlot(qint64(PlaneHeight), true);
     }
 
-    static inline QByteArray toStr(const MemSlot& s)
+    void xyClear(const Extern&, ModuleData*, MemSlot*, MemSlot&)
     {
-        Q_ASSERT( (s.t == MemSlot::Pointer || s.t == MemSlot::Array) && s.p );
-#if 0
-        MemSlot* header = s.sp - 1;
-        Q_ASSERT( header->t == MemSlot::Header );
-        QByteArray str(header->u, ' ');
-        for( int i = 0; i < str.size(); i++ )
-            str[i] = (char)(quint8)s.sp[i].u;
-#else
-        QByteArray str;
-        MemSlot* p = s.p;
-        while( p->u )
-        {
-            str += (char)(quint8)p->u;
-            p++;
-        }
-#endif
-        return str;
+        plane.fill(false);
     }
 
-    static int MIC_relop1(const char* l, const char* r, int op)
+    static inline bool onPlane(const QBitArray& plane, qint64 x, qint64 y)
     {
-        switch( op )
-        {
-        case 1: // EQ
-            return strcmp(l,r) == 0;
-        case 2: // NEQ
-            return strcmp(l,r) != 0;
-        case 3: // LT
-            return strcmp(l,r) < 0;
-        case 4: // LEQ
-            return strcmp(l,r) <= 0;
-        case 5: // GT
-            return strcmp(l,r) > 0;
-        case 6: // GEQ
-            return strcmp(l,r) >= 0;
-        }
-        return 0;
+        return !plane.isEmpty() && x >= 0 && x < PlaneWidth && y >= 0 && y < PlaneHeight;
     }
 
-    void nyiError(ModuleData* module, MilProcedure* proc)
+    void xyDot(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
     {
-        throw QString("%1!%2 not yet implemented")
-                .arg(module->module->fullName.constData())
-                .arg(proc->name.constData());
+        if( onPlane(plane, args[0].i, args[1].i) )
+            plane.setBit(args[1].i * PlaneWidth + args[0].i, args[2].i != 0);
+    }
+
+    void xyIsDot(const Extern&, ModuleData*, MemSlot* args, MemSlot& ret)
+    {
+        ret = MemSlot(quint64(onPlane(plane, args[0].i, args[1].i) &&
+                              plane.testBit(args[1].i * PlaneWidth + args[0].i)));
+    }
+
+    void xyKey(const Extern&, ModuleData*, MemSlot*, MemSlot& ret)
+    {
+        ret = charSlot(0); // no key is ever pressed
     }
 
-    void callExtern(ModuleData* module, MilProcedure* proc, MemSlotList& args, MemSlot& ret)
+    Coroutine* coroutine(const MemSlot& cor, bool create)
     {
-        static QByteArray symbols[10];
-        if( symbols[0].isEmpty() )
+        // the state of a Coroutines.Coroutine, by the address of the record
+        MemSlot* key = &target(cor);
+        Coroutines::iterator i = coroutines.find(key);
+        if( i != coroutines.end() )
+            return i.value();
+        if( !create )
+            throw QString("transfer to a coroutine which was not initialized");
+        return coroutines.insert(key, new Coroutine()).value();
+    }
+
+    void coInit(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        // stackSize is in bytes, but interpreted frames need more space than native ones
+        if( args[0].t != MemSlot::Procedure || args[0].pp == 0 || args[0].pp->proc->kind != MilProcedure::Normal
+                || !args[0].pp->proc->params.isEmpty() )
+            throw QString("the body of a coroutine must be a procedure without parameters");
+        Coroutine* co = coroutine(args[2], true);
+        if( co == current )
+            throw QString("cannot initialize the running coroutine");
+        if( co->frame && co->seg.stack )
         {
-            symbols[0] = Token::getSymbol("Open");
-            symbols[1] = Token::getSymbol("Char");
-            symbols[2] = Token::getSymbol("String");
-            symbols[3] = Token::getSymbol("Int");
-            symbols[4] = Token::getSymbol("Real");
-            symbols[5] = Token::getSymbol("LongReal");
-            symbols[6] = Token::getSymbol("Ln");
-            symbols[7] = Token::getSymbol("Time");
-            symbols[8] = Token::getSymbol("sqrt");
+            // drop the frames of the previous body
+            for( MemSlot* s = co->seg.stack; s < co->top; s++ )
+                s->clear();
         }
-        const char* mn = module->module->fullName.constData();
-        const char* pn = proc->name.constData();
-        if( mn == outMod.constData() )
+        const quint32 slots = qMax(quint64(qMax(args[1].i, qint64(0))) / sizeof(MemSlot), quint64(CoroutineSlots));
+        if( co->seg.stack && quint32(co->seg.end - co->seg.stack) < slots )
         {
-            if( pn == symbols[2].constData() ) // Out.String(const str: POINTER TO ARRAY OF CHAR)
-            {
-                Q_ASSERT(args.size() == 1);
-                out << toStr(args.first()).constData() << flush;
-            }else if( pn == symbols[1].constData() ) // Out.Char(c: CHAR)
-            {
-                Q_ASSERT(args.size() == 1);
-                out << (char)(quint8)args.first().i << flush;
-            }else if( pn == symbols[3].constData() ) // Out.Int(i: INT64;n: INT32)
-            {
-                Q_ASSERT(args.size() == 2);
-                out << args.first().i << flush;
-            }else if( pn == symbols[6].constData() ) // Out.Ln
-            {
-                out << endl << flush;
-            }else
-                nyiError(module,proc);
-        }else if( mn == inputMod.constData() )
+            coPool.append(co->seg);
+            co->seg = CoSegment();
+        }
+        for( int i = 0; i < coPool.size() && co->seg.stack == 0; i++ )
         {
-            if( pn == symbols[7].constData() ) // Input.Time
-            {
-                ret.t = MemSlot::I;
-#ifdef _USE_GETTIMEOFDAY
-                static struct timeval now;
-                gettimeofday(&now, 0);
-                const long seconds = now.tv_sec - start.tv_sec;
-                const long microseconds = now.tv_usec - start.tv_usec;
-                ret.i = seconds*1000000 + microseconds;
-#else
-                ret.i = timer.nsecsElapsed() / 1000;
-#endif
-            }else
-                nyiError(module,proc);
-        }else if( mn == mathlMod.constData() )
+            if( quint32(coPool[i].end - coPool[i].stack) >= slots )
+                co->seg = coPool.takeAt(i);
+        }
+        if( co->seg.stack == 0 )
         {
-            if( pn == symbols[8].constData() ) // MathL.sqrt (x : LONGREAL) : LONGREAL
-            {
-                Q_ASSERT(args.size() == 1);
-                ret.t = MemSlot::F;
-                ret.f = sqrt(args.first().f);
-            }else
-                nyiError(module,proc);
-        }else
-            nyiError(module,proc);
+            co->seg.stack = new MemSlot[slots];
+            co->seg.end = co->seg.stack + slots;
+            co->seg.frames = new Frame[slots / 4 + 1];
+            co->seg.framesEnd = co->seg.frames + slots / 4 + 1;
+        }
+        co->body = args[0].pp;
+        co->frame = 0;
+    }
+
+    void coTransfer(const Extern&, ModuleData*, MemSlot* args, MemSlot&)
+    {
+        // only records the switch, which the dispatch loop performs when the call returns, see do_transfer
+        Coroutine* to = coroutine(args[1], false);
+        Coroutine* from = coroutine(args[0], true);
+        if( from != to )
+        {
+            switchFrom = from;
+            switchTo = to;
+        }
     }
 
-    void callIntrinsic(MilProcedure* proc, MemSlotList& args, MemSlot& ret)
+    void callIntrinsic(MilProcedure* proc, MemSlot* args, MemSlot& ret)
     {
         switch(proc->offset)
         {
         case 1: // relop1
-            Q_ASSERT(args.size()==3);
-            ret.t = MemSlot::U;
-            ret.u = MIC_relop1(toStr(args[0]).constData(), toStr(args[1]).constData(), args[2].u);
-            break;
         case 2: // relop2
-            {
-                Q_ASSERT(args.size()==3);
-                char tmp[2] = ".";
-                tmp[0] = (char)(quint8)args[1].u;
-                ret.t = MemSlot::U;
-                ret.u = MIC_relop1(toStr(args[0]).constData(), tmp, args[2].u);
-            }
-            break;
         case 3: // relop3
-            {
-                Q_ASSERT(args.size()==3);
-                char tmp[2] = ".";
-                tmp[0] = (char)(quint8)args[0].u;
-                ret.t = MemSlot::U;
-                ret.u = MIC_relop1(tmp, toStr(args[1]).constData(), args[2].u);
-            }
-            break;
         case 4: // relop4
-            {
-                Q_ASSERT(args.size()==3);
-                char l[2] = ".";
-                l[0] = (char)(quint8)args[0].u;
-                char r[2] = ".";
-                r[0] = (char)(quint8)args[1].u;
-                ret.t = MemSlot::U;
-                ret.u = MIC_relop1(l, r, args[2].u);
-            }
+            Q_ASSERT(proc->params.size()==3);
+            ret.t = MemSlot::U;
+            ret.u = relop(proc->offset, args);
             break;
         case 5: // SetDiv
-            Q_ASSERT(args.size()==2);
+            Q_ASSERT(proc->params.size()==2);
             ret.t = MemSlot::U;
-            ret.u = ~(quint32)( args.first().u & args.last().u ) & ( args.first().u | args.last().u );
+            ret.u = ~(quint32)( args[0].u & args[proc->params.size()-1].u ) & ( args[0].u | args[proc->params.size()-1].u );
             break;
         case 6: // SetIn
-            Q_ASSERT(args.size()==2);
+            Q_ASSERT(proc->params.size()==2);
             ret.t = MemSlot::U;
-            ret.u = ((1 << args.first().u) & args.last().u) != 0;
+            ret.u = ((1 << args[0].u) & args[proc->params.size()-1].u) != 0;
             break;
         case 7: // printI8
-            Q_ASSERT(args.size()==1);
-            out << args.first().i << flush;
+            Q_ASSERT(proc->params.size()==1);
+            out << args[0].i;
             break;
         case 8: // printU8
-            Q_ASSERT(args.size()==1);
-            out << args.first().u << flush;
+            Q_ASSERT(proc->params.size()==1);
+            out << args[0].u;
             break;
         case 9: // printF8
-            Q_ASSERT(args.size()==1);
-            out << args.first().f << flush;
+            Q_ASSERT(proc->params.size()==1);
+            out << args[0].f;
             break;
         case 10: // printStr
-            Q_ASSERT(args.size()==1 );
-            out << toStr(args.first()).constData() << flush;
+            Q_ASSERT(proc->params.size()==1 );
+            writeStr(args[0]);
             break;
         case 11: // printCh
-            Q_ASSERT(args.size()==1);
-            out << (char)(quint8)args.first().u << flush;
+            Q_ASSERT(proc->params.size()==1);
+            if( args[0].u == '\n' )
+                out << endl;
+            else
+                out << (char)(quint8)args[0].u;
             break;
         case 12: // printBool
-            Q_ASSERT(args.size()==1);
-            out << (args.first().u ? "true" : "false") << flush;
+            Q_ASSERT(proc->params.size()==1);
+            out << (args[0].u ? "true" : "false");
             break;
         case 13: // printSet
-            Q_ASSERT(args.size()==1);
-            out << QByteArray::number(args.first().u,2).constData() << flush;
+            Q_ASSERT(proc->params.size()==1);
+            out << QByteArray::number(args[0].u,2).constData();
             break;
         case 14: // strcopy
-            Q_ASSERT(args.size()==2 && args.first().p && args.last().p );
-            for( int i = 0; ; i++ )
             {
-                args.first().p[i] = args.last().p[i];
-                if( args.last().p[i].u == 0 )
-                    break;
+                Q_ASSERT(proc->params.size()==2 && args[0].p && args[1].p );
+                // the destination is a pointer, either directly to the chars or to the array variable
+                MemSlot* lhs = args[0].p;
+                if( !args[0].embedded && lhs->t == MemSlot::Array )
+                    lhs = lhs->expose();
+                const MemSlot* rhs = chars(args[1]);
+                for( int i = 0; ; i++ )
+                {
+                    lhs[i] = rhs[i];
+                    if( rhs[i].u == 0 )
+                        break;
+                }
             }
             break;
         case 15: // assert
-            Q_ASSERT(args.size()==3);
-            if( args.first().u == 0 )
+            Q_ASSERT(proc->params.size()==3);
+            if( args[0].u == 0 )
                 throw QString("assertion failed at %1:%2").arg(toStr(args[2]).constData()).arg(args[1].u);
             break;
+        case 16: // strlen
+            Q_ASSERT(proc->params.size()==1);
+            ret = MemSlot(quint64(strLen(chars(args[0]))), true);
+            break;
         default:
             throw QString("intrinsic proc 'MIC$!%1' not yet implemented").arg(proc->name.constData());
         }
@@ -1360,48 +5277,217 @@ public:
                 lhs.move(rhs);
             else
             {
-                for( int i = 0; i < rh->u; i++ )
-                    lhs.p[i].move(rhs.p[i]);
+                lhs.unshare();
+                moveElements(lhs.p, rhs.p, rh);
             }
         }else
             lhs = rhs;
     }
 
-    static inline MemSlot* findHeader(MemSlot* s)
+    static inline MemSlot* header(MemSlot* s, quint32 off)
     {
-        while( s && s->t != MemSlot::Header )
-            s--;
-        return s;
+        return s - off - 1;
+    }
+
+    static inline void moveElements(MemSlot* lhs, MemSlot* rhs, const MemSlot* rh)
+    {
+        // rh is the header of rhs; the elements of a shared sequence still belong to the other owners
+        if( rh->off )
+        {
+            for( int i = 0; i < rh->u; i++ )
+                lhs[i] = rhs[i];
+        }else
+        {
+            for( int i = 0; i < rh->u; i++ )
+                lhs[i].move(rhs[i]);
+        }
+    }
+
+    static inline bool lessThan(const MemSlot& lhs, const MemSlot& rhs)
+    {
+        switch( lhs.t )
+        {
+        case MemSlot::I:
+            return lhs.i < rhs.i;
+        case MemSlot::F:
+            return lhs.f < rhs.f;
+        default:
+            return lhs.u < rhs.u;
+        }
+    }
+
+    static inline bool greaterThan(const MemSlot& lhs, const MemSlot& rhs)
+    {
+        switch( lhs.t )
+        {
+        case MemSlot::I:
+            return lhs.i > rhs.i;
+        case MemSlot::F:
+            return lhs.f > rhs.f;
+        default:
+            return lhs.u > rhs.u;
+        }
+    }
+
+    static inline void setResult(MemSlot& d, quint8 t, quint64 u, bool hw)
+    {
+        if( d.t == MemSlot::Record || d.t == MemSlot::Array || d.t == MemSlot::Method )
+            d.clear();
+        d.u = u;
+        d.t = (MemSlot::Type)t;
+        d.hw = hw;
+        d.embedded = false;
+        d.off = 0;
+    }
+
+    static inline void setResult(MemSlot& d, double f, bool hw)
+    {
+        union { double f; quint64 u; } v;
+        v.f = f;
+        setResult(d, MemSlot::F, v.u, hw);
+    }
+
+    static inline void binary(quint8 op, MemSlot& d, const MemSlot& a, const MemSlot& b)
+    {
+        // the generic arithmetic and comparison ops on operands in place; d may be a or b
+        const quint8 t = a.t;
+        const bool hw = a.hw;
+        switch( op )
+        {
+        case IL_add:
+            if( t == MemSlot::F )
+                setResult(d, a.f + b.f, hw);
+            else
+                setResult(d, t, a.u + b.u, hw);
+            break;
+        case IL_sub:
+            if( t == MemSlot::F )
+                setResult(d, a.f - b.f, hw);
+            else
+                setResult(d, t, a.u - b.u, hw);
+            break;
+        case IL_mul:
+            if( t == MemSlot::F )
+                setResult(d, a.f * b.f, hw);
+            else
+                setResult(d, t, a.u * b.u, hw);
+            break;
+        case IL_div:
+            if( t == MemSlot::F )
+                setResult(d, a.f / b.f, hw);
+            else if( t == MemSlot::I )
+                setResult(d, t, a.i / b.i, hw);
+            else
+                setResult(d, t, a.u / b.u, hw);
+            break;
+        case IL_div_un:
+            setResult(d, t, a.u / b.u, hw);
+            break;
+        case IL_rem:
+            if( t == MemSlot::I )
+                setResult(d, t, a.i % b.i, hw);
+            else
+                setResult(d, t, a.u % b.u, hw);
+            break;
+        case IL_and:
+            setResult(d, t, a.u & b.u, hw);
+            break;
+        case IL_or:
+            setResult(d, t, a.u | b.u, hw);
+            break;
+        case IL_xor:
+            setResult(d, t, a.u ^ b.u, hw);
+            break;
+        case IL_shl:
+            setResult(d, t, a.u << b.u, hw);
+            break;
+        case IL_shr:
+            if( t == MemSlot::I )
+                setResult(d, t, hw ? qint64(qint32(a.i) >> b.i) : a.i >> b.i, hw);
+            else
+                setResult(d, t, a.u >> b.u, hw);
+            break;
+        case IL_shr_un:
+            setResult(d, MemSlot::U, a.u >> b.u, hw);
+            break;
+        case IL_ceq:
+            setResult(d, MemSlot::I, a.u == b.u, true);
+            break;
+        case IL_clt:
+            setResult(d, MemSlot::I, lessThan(a,b), true);
+            break;
+        case IL_cgt:
+            setResult(d, MemSlot::I, greaterThan(a,b), true);
+            break;
+        default:
+            Q_ASSERT(false);
+        }
+    }
+
+    static inline void addConst(MemSlot& lhs, qint64 i)
+    {
+        // same as ldc_i4 i, add
+        switch( lhs.t )
+        {
+        case MemSlot::I:
+            lhs.i += i;
+            break;
+        case MemSlot::U:
+            lhs.u += MemSlot(i,true).u;
+            break;
+        case MemSlot::F:
+            lhs.f += MemSlot(i,true).f;
+            break;
+        default:
+            Q_ASSERT(false);
+        }
+    }
+
+    static inline void subConst(MemSlot& lhs, qint64 i)
+    {
+        // same as ldc_i4 i, sub
+        switch( lhs.t )
+        {
+        case MemSlot::I:
+            lhs.i -= i;
+            break;
+        case MemSlot::U:
+            lhs.u -= MemSlot(i,true).u;
+            break;
+        case MemSlot::F:
+            lhs.f -= MemSlot(i,true).f;
+            break;
+        default:
+            Q_ASSERT(false);
+        }
     }
 
-    void boundsCheck(ModuleData* module, MilProcedure* proc, quint32 pc, MemSlot* array, int index)
+    void boundsCheck(ProcData* pd, quint32 pc, const MemSlot& array, quint64 index)
     {
-        MemSlot* lh = findHeader(array);
-        Q_ASSERT(lh != 0 && lh->t == MemSlot::Header);
-        const quint32 start = array - lh - 1;
-        if( index + start >= lh->u )
-            execError(module,proc,pc,"index out of upper bound");
+        const MemSlot* lh = header(array.p, array.off);
+        Q_ASSERT(lh->t == MemSlot::Header);
+        if( index + array.off >= lh->u )
+            execError(pd,pc,"index out of upper bound");
     }
 
-    void store(ModuleData* module, MilProcedure* proc, quint32 pc, MemSlot* lhs, bool embedded, MemSlot& rhs)
+    void store(ProcData* pd, quint32 pc, MemSlot* lhs, quint32 border, bool embedded, MemSlot& rhs)
     {
+        // border is the offset of lhs in its sequence
         if( rhs.t == MemSlot::Record || rhs.t == MemSlot::Array )
         {
             if( embedded )
             {
-                MemSlot* lh = findHeader(lhs);
-                Q_ASSERT(lh != 0 && lh->t == MemSlot::Header);
-                const quint32 border = lhs - lh - 1;
+                const MemSlot* lh = header(lhs, border);
+                Q_ASSERT(lh->t == MemSlot::Header);
                 MemSlot* rh = rhs.p - 1;
                 Q_ASSERT(rh->t == MemSlot::Header);
                 if( rh->u > (lh->u - border) )
-                    execError(module,proc,pc,"value slot width too large");
-                for( int i = 0; i < rh->u; i++ )
-                    lhs[i].move(rhs.p[i]);
+                    execError(pd,pc,"value slot width too large");
+                moveElements(lhs, rhs.p, rh);
             }else if(lhs->t == MemSlot::Record || lhs->t == MemSlot::Array)
-                storeVariable(module, proc, *lhs,rhs);
+                storeVariable(pd->module, pd->proc, *lhs,rhs);
             else
-                execError(module,proc,pc,"cannot copy a structured to a scalar value");
+                execError(pd,pc,"cannot copy a structured to a scalar value");
         }else
             lhs->move(rhs);
     }
@@ -1410,33 +5496,28 @@ public:
 #define vmcase(l)	case l:
 #define vmbreak		break
 
-    void execute(ModuleData* module, MilProcedure* proc, MemSlotList& args, MemSlot& ret)
+    void execute(ProcData* pd, MemSlot* args)
     {
+        // args points to the actual parameters on the VM stack; the result replaces them.
+        // Calls within pd are executed by the same dispatch loop using explicit frames.
+        ModuleData* module = pd->module;
+        MilProcedure* proc = pd->proc;
+        bool hasRet = !proc->retType.second.isEmpty();
+        MemSlot ret;
         if( proc->kind == MilProcedure::Intrinsic )
         {
             callIntrinsic(proc,args,ret);
+            leaveFrame(args, args + proc->params.size(), ret, hasRet);
             return;
         }
         if( proc->kind == MilProcedure::Extern )
         {
-            callExtern(module, proc,args,ret);
+            callExtern(pd,args,ret);
+            leaveFrame(args, args + proc->params.size(), ret, hasRet);
             return;
         }
-        qint32 pc = 0;
-        if( !proc->compiled )
-        {
-            prepareBytecode(module, proc, pc);
-
-#if 0
-            QFile out;
-            out.open(stdout, QIODevice::WriteOnly);
-            Mic::IlAsmRenderer r(&out);
-            Mic::MilLoader::render(&r,module->module);
-            out.putChar('\n');
-#endif
-
-            proc->compiled = true;
-        }
+        if( !pd->prepared )
+            prepareBytecode(pd);
 
 #define _USE_JUMP_TABLE
         // the debugger becomes veeeery slow because of local var display
@@ -1451,9 +5532,9 @@ public:
 
 #define vmcase(l)     L_##l:
 
-#define vmbreak		 if( pc >= proc->body.size() ) return; vmdispatch(proc->body[pc].op);
+#define vmbreak		 vmdispatch(code[pc].op);
 
-        static const void *const disptab[IL_NUM_OF_OPS] = {
+        static const void *const disptab[LL_NUM_OF_OPS] = {
             &&L_IL_invalid,
             &&L_IL_add, &&L_IL_abs, &&L_IL_and,
             &&L_IL_call, &&L_IL_calli,
@@ -1461,100 +5542,127 @@ public:
             &&L_IL_ceq, &&L_IL_cgt, &&L_IL_cgt_un, &&L_IL_clt, &&L_IL_clt_un,
             &&L_IL_conv_i1, &&L_IL_conv_i2, &&L_IL_conv_i4, &&L_IL_conv_i8, &&L_IL_conv_r4, &&L_IL_conv_r8,
             &&L_IL_conv_u1, &&L_IL_conv_u2, &&L_IL_conv_u4, &&L_IL_conv_u8, &&L_IL_conv_ip,
-            &&L_IL_div, &&L_IL_div_un, &&L_IL_dup, &&L_IL_iif, &&L_IL_initobj, &&L_IL_isinst, &&L_IL_ldarg, &&L_IL_ldarg_s,
-            &&L_IL_ldarg_0, &&L_IL_ldarg_1, &&L_IL_ldarg_2, &&L_IL_ldarg_3,
-            &&L_IL_ldarga, &&L_IL_ldarga_s,
-            &&L_IL_ldc_i4, &&L_IL_ldc_i8, &&L_IL_ldc_i4_s, &&L_IL_ldc_r4, &&L_IL_ldc_r8,
-            &&L_IL_ldc_i4_0, &&L_IL_ldc_i4_1, &&L_IL_ldc_i4_2, &&L_IL_ldc_i4_3, &&L_IL_ldc_i4_4, &&L_IL_ldc_i4_5,
-            &&L_IL_ldc_i4_6, &&L_IL_ldc_i4_7, &&L_IL_ldc_i4_8, &&L_IL_ldc_i4_m1, &&L_IL_ldobj,
-            &&L_IL_ldelem, &&L_IL_ldelema, &&L_IL_ldelem_i1, &&L_IL_ldelem_i2,
-            &&L_IL_ldelem_i4, &&L_IL_ldelem_i8, &&L_IL_ldelem_u1, &&L_IL_ldelem_u2,
-            &&L_IL_ldelem_u4, &&L_IL_ldelem_u8, &&L_IL_ldelem_r4, &&L_IL_ldelem_r8, &&L_IL_ldelem_ip,
+            &&L_IL_div, &&L_IL_div_un, &&L_IL_dup, &&L_IL_invalid, &&L_IL_initobj, &&L_IL_isinst, &&L_IL_ldarg, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_ldarga, &&L_IL_invalid,
+            &&L_IL_ldc_i4, &&L_IL_ldc_i8, &&L_IL_invalid, &&L_IL_ldc_r4, &&L_IL_ldc_r8,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_ldobj,
+            &&L_IL_ldelem, &&L_IL_ldelema, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
             &&L_IL_ldfld, &&L_IL_ldflda,
             &&L_IL_ldind_i1, &&L_IL_ldind_i2, &&L_IL_ldind_i4, &&L_IL_ldind_i8, &&L_IL_ldind_u1, &&L_IL_ldind_u2,
             &&L_IL_ldind_u4, &&L_IL_ldind_r4, &&L_IL_ldind_u8, &&L_IL_ldind_r8, &&L_IL_ldind_ip, &&L_IL_ldind_ipp,
-            &&L_IL_ldloc, &&L_IL_ldloc_s, &&L_IL_ldloca, &&L_IL_ldloca_s,
-            &&L_IL_ldloc_0, &&L_IL_ldloc_1, &&L_IL_ldloc_2, &&L_IL_ldloc_3, &&L_IL_ldnull,
+            &&L_IL_ldloc, &&L_IL_invalid, &&L_IL_ldloca, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_ldnull,
             &&L_IL_ldind, &&L_IL_ldproc, &&L_IL_ldmeth, &&L_IL_ldstr,
             &&L_IL_ldvar, &&L_IL_ldvara, &&L_IL_mul, &&L_IL_neg,
             &&L_IL_newarr, &&L_IL_newvla, &&L_IL_newobj,
             &&L_IL_not, &&L_IL_or, &&L_IL_rem, &&L_IL_rem_un, &&L_IL_shl, &&L_IL_shr, &&L_IL_shr_un,
-            &&L_IL_sizeof, &&L_IL_sub, &&L_IL_xor, &&L_IL_ptroff, &&L_IL_nop,
-            &&L_IL_free, &&L_IL_repeat, &&L_IL_until,
-            &&L_IL_exit, &&L_IL_goto, &&L_IL_if, &&L_IL_then, &&L_IL_else, &&L_IL_end,
-            &&L_IL_label, &&L_IL_line, &&L_IL_loop, &&L_IL_pop, &&L_IL_ret,
-            &&L_IL_starg, &&L_IL_starg_s,
-            &&L_IL_stelem, &&L_IL_stelem_i1, &&L_IL_stelem_i2, &&L_IL_stelem_i4, &&L_IL_stelem_i8,
-            &&L_IL_stelem_r4, &&L_IL_stelem_r8, &&L_IL_stelem_ip, &&L_IL_stfld,
+            &&L_IL_invalid, &&L_IL_sub, &&L_IL_xor, &&L_IL_ptroff, &&L_IL_invalid,
+            &&L_IL_free, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_pop, &&L_IL_ret,
+            &&L_IL_starg, &&L_IL_invalid,
+            &&L_IL_stelem, &&L_IL_stelem_i1, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_stfld,
             &&L_IL_stind_i1, &&L_IL_stind_i2, &&L_IL_stind_i4, &&L_IL_stind_i8, &&L_IL_stind_r4, &&L_IL_stind_r8, &&L_IL_stind_ip, &&L_IL_stind_ipp,
-            &&L_IL_stloc, &&L_IL_stloc_s, &&L_IL_stloc_0, &&L_IL_stloc_1, &&L_IL_stloc_2, &&L_IL_stloc_3,
-            &&L_IL_stind, &&L_IL_stvar, &&L_IL_switch, &&L_IL_case, &&L_IL_while, &&L_IL_do
+            &&L_IL_stloc, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_IL_stind, &&L_IL_stvar, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid, &&L_IL_invalid,
+            &&L_LL_jump, &&L_LL_brfalse, &&L_LL_case, &&L_LL_leave,
+            &&L_LL_add_i, &&L_LL_add_u, &&L_LL_add_f, &&L_LL_sub_i, &&L_LL_sub_u, &&L_LL_sub_f,
+            &&L_LL_mul_i, &&L_LL_mul_u, &&L_LL_mul_f, &&L_LL_div_i, &&L_LL_div_f, &&L_LL_rem_i, &&L_LL_rem_u,
+            &&L_LL_clt_i, &&L_LL_clt_u, &&L_LL_clt_f, &&L_LL_cgt_i, &&L_LL_cgt_u, &&L_LL_cgt_f,
+            &&L_LL_brtrue, &&L_LL_clt_brfalse, &&L_LL_clt_brtrue, &&L_LL_cgt_brfalse, &&L_LL_cgt_brtrue,
+            &&L_LL_ceq_brfalse, &&L_LL_ceq_brtrue, &&L_LL_addi, &&L_LL_subi,
+            &&L_LL_incvar, &&L_LL_decvar, &&L_LL_incloc, &&L_LL_decloc, &&L_LL_ldarg_ldfld,
+            &&L_LL_radd, &&L_LL_rsub, &&L_LL_rmul, &&L_LL_rdiv, &&L_LL_rdiv_un, &&L_LL_rrem,
+            &&L_LL_rand, &&L_LL_ror, &&L_LL_rxor, &&L_LL_rshl, &&L_LL_rshr, &&L_LL_rshr_un,
+            &&L_LL_rceq, &&L_LL_rclt, &&L_LL_rcgt,
+            &&L_LL_rclt_brfalse, &&L_LL_rclt_brtrue, &&L_LL_rcgt_brfalse, &&L_LL_rcgt_brtrue,
+            &&L_LL_rceq_brfalse, &&L_LL_rceq_brtrue, &&L_LL_rbrfalse, &&L_LL_rmov, &&L_LL_rst,
+            &&L_LL_loop, &&L_LL_switch, &&L_LL_setin, &&L_LL_setdiv, &&L_LL_relop, &&L_LL_strlen, &&L_LL_intrinsic
         };
 
 #endif
-        MemSlotList locals(proc->locals.size());
-        initVars(module, locals.data(), proc->locals);
-        ret = MemSlot();
-        pc = 0;
-        QList<MemSlot> stack;
+        Frame* frame = vmFrame;
+        Frame* const base = frame;
+        enterFrame(frame, pd, args);
+        MemSlot* locals = frame->locals;
+        MemSlot* stack = frame->stack;
+        MemSlot* sp = stack;
+        Operation* code = pd->ops.data();
+        MemSlot* consts = pd->consts.data();
+        qint32 pc = 0;
+        ProcData* callee;
+#define vmguard(type, generic) if( sp[-2].t != type ) { code[pc].op = generic; code[pc].len = 1; vmbreak; }
+#ifdef _MIC_JIT
+#define vmnative() if( jit ) { if( ++pd->hot == HotLimit ) pd->native = compileNative(pd); \
+                        if( pd->native && pd->native->entries[pc] >= 0 ) { \
+                            pc = pd->native->run(args, sp, pc, &nativeSp); sp = nativeSp; } }
+#else
+#define vmnative()
+#endif
+#define vmtier() if( ceeTier() ) { if( pd->tier == ProcData::Interpreted && ++pd->calls == HotLimit ) compileC(pd); \
+                        if( ceeRunning && ( ++ceeTick & 0x3ff ) == 0 ) pollC(); }
+// a taken backward branch closes a loop, e.g. the test at the end of REPEAT, and counts like LL_loop
+#define vmtaken() do { const qint32 from = pc; pc = code[pc].val; \
+                        if( pc <= from ) { vmtier(); vmnative(); } } while( false )
+#define vmsrc(x) ( (x) < RegConst ? args + (x) : (x) < RegPop ? consts + (x) - RegConst : \
+                        (x) == RegPop ? --sp : code[pc].s )
+#define vmdst(x) ( (x) < RegConst ? args + (x) : (x) == RegPush ? sp++ : code[pc].s )
+#define vmbinary(o) { MemSlot* b = vmsrc(code[pc].len & 0xffff); MemSlot* a = vmsrc(code[pc].len >> 16); \
+                        binary(o, *vmdst(code[pc].val), *a, *b); pc++; }
+#define vmcompare(cond) { MemSlot* b = vmsrc(code[pc].len & 0xffff); MemSlot* a = vmsrc(code[pc].len >> 16); \
+                        if( cond ) vmtaken(); else pc++; }
         MemSlot lhs, rhs;
-        MilObject mo;
-        QList<MemSlot> switchExpr;
-        QList<quint8> curStatement;
 
         //out << "***** " << module->module->fullName << "!" << proc->name << ":" << endl;
         //dump(args,"args");
 
+        vmtier();
+        vmnative();
         while(true)
         {
-            if( pc >= proc->body.size() )
-            {
-#if 0
-                out << "***** " << module->module->fullName << "!" << proc->name << ":" << endl;
-                //dump(module->variables,"module");
-                dump(args,"args");
-                //dump(locals,"locals");
-#endif
-                return;
-            }
-
             // NOTE: jump tables (i.e. &&label, computed gotos) makes little sense, since GCC is able
             // to derive it automatically in principle; e.g. Lua 5.4.7 has exactly same
             // performance with or without jump tables; but the VM has a different architecture than
             // the present one.
-            vmdispatch(proc->body[pc].op)
+            vmdispatch(code[pc].op)
             {
             vmcase(IL_invalid)
-                    pc++;
-                    vmbreak;
+                execError(pd, pc, "invalid operation");
+                vmbreak;
             vmcase(IL_add)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i + rhs.i, lhs.hw));
+                    *sp++ = MemSlot(lhs.i + rhs.i, lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u + rhs.u, lhs.hw));
+                    *sp++ = MemSlot(lhs.u + rhs.u, lhs.hw);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(lhs.f + rhs.f, lhs.hw));
+                    *sp++ = MemSlot(lhs.f + rhs.f, lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
                 }
+                quicken(code[pc], lhs.t, LL_add_i, LL_add_u, LL_add_f);
                 pc++;
                 vmbreak;
             vmcase(IL_abs)
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(qAbs(lhs.i),lhs.hw));
+                    *sp++ = MemSlot(qAbs(lhs.i),lhs.hw);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(qAbs(lhs.f),lhs.hw));
+                    *sp++ = MemSlot(qAbs(lhs.f),lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -1562,15 +5670,15 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_and) // TODO short-circuit evaluation
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i & rhs.i, lhs.hw));
+                    *sp++ = MemSlot(lhs.i & rhs.i, lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u & rhs.u, lhs.hw));
+                    *sp++ = MemSlot(lhs.u & rhs.u, lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -1578,159 +5686,244 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_call)
-                {
-                    ProcData* pd = getProc(module, proc->body[pc].arg.value<MilQuali>());
-                    if( pd == 0 )
-                        execError(module, proc, pc, QString("cannot resolve procedure %1").
-                                  arg(MilEmitter::toString(proc->body[pc].arg.value<MilQuali>()).constData()));
-                    makeCall(stack, pd->proc, pd->module);
-                }
-                pc++;
-                vmbreak;
+                if( code[pc].pd == 0 )
+                    execError(pd, pc, QString("cannot resolve procedure %1").
+                              arg(MilEmitter::toString(proc->body[pd->pcs[pc]].arg.value<MilQuali>()).constData()));
+                callee = code[pc].pd;
+                goto do_call;
             vmcase(IL_calli)
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Procedure || lhs.pp == 0 )
-                    execError(module, proc, pc, "top of stack is not a procedure");
-                makeCall(stack, lhs.pp->proc, lhs.pp->module);
-                pc++;
-                vmbreak;
+                    execError(pd, pc, "top of stack is not a procedure");
+                callee = lhs.pp;
+                if( pd->sites[code[pc].len].target == callee && callee->cee == 0 )
+                    goto do_enter;
+                goto do_call;
             vmcase(IL_callvi)
-                lhs = stack.takeLast();
-                if( lhs.t != MemSlot::Method || lhs.m == 0 || lhs.m->proc == 0 ||
-                        lhs.m->obj == 0 || lhs.m->obj->t != MemSlot::Record )
-                    execError(module, proc, pc, "top of stack is not a valid methref");
-                makeCall(stack, lhs.m->proc->proc, lhs.m->proc->module, lhs.m->obj);
-                pc++;
-                vmbreak;
+                lhs.move(*--sp);
+                if( lhs.t != MemSlot::Method || lhs.m == 0 || lhs.m->proc == 0 || lhs.m->obj == 0 ||
+                        ( lhs.m->obj->t != MemSlot::Record && lhs.m->obj->t != MemSlot::TypeTag ) )
+                    execError(pd, pc, "top of stack is not a valid methref");
+                callee = lhs.m->proc;
+                {
+                    // NOTE: a bound proc comes with receiver as explicit first param
+                    Q_ASSERT(!callee->proc->binding.isEmpty());
+                    MemSlot* self = sp - callee->proc->params.size() + 1;
+                    if( self < stack )
+                        execError(callee->module,callee->proc,"not enough actual parameters");
+                    for( MemSlot* s = sp; s > self; s-- )
+                        s->move(*(s-1));
+                    *self = MemSlot(lhs.m->obj);
+                    sp++;
+                }
+                if( pd->sites[code[pc].len].target == callee && callee->cee == 0 )
+                    goto do_enter;
+                goto do_call;
             vmcase(IL_callvirt)
+                callee = code[pc].pd;
                 {
-                    MilTrident tri = proc->body[pc].arg.value<MilTrident>();
-                    FlattenedType* rec = getFlattenedType(module, tri.first);
-                    if( rec == 0 )
-                        execError(module, proc, pc, "invalid object type");
-                    const int midx = rec->lastIndexOfMethod(tri.second);
-                    if( midx < 0 )
-                        execError(module, proc, pc, "unknown method");
-                    else
+                    // dispatch on the dynamic type of the receiver, i.e. the first actual parameter
+                    const MemSlot* self = sp - callee->proc->params.size();
+                    FlattenedType* tt = self >= stack ? typeOfObject(*self) : 0;
+                    if( tt )
                     {
-                        MilProcedure* proc = rec->vtable[midx].proc;
-                        makeCall(stack, proc, rec->module);
+                        CallSite& site = pd->sites[code[pc].len];
+                        if( site.tt == tt && site.target->cee == 0 )
+                        {
+                            callee = site.target;
+                            goto do_enter;
+                        }
+                        if( code[pc].val < tt->vtable.size() )
+                            callee = tt->vtable[code[pc].val];
                     }
                 }
-                pc++;
+            do_call:
+                {
+                    // the actual parameters on top of the operand stack become the args of the callee
+                    // TODO: support varargs
+                    MemSlot* a = sp - callee->proc->params.size();
+                    if( a < stack )
+                        execError(callee->module,callee->proc,"not enough actual parameters");
+                    if( callee->proc->kind == MilProcedure::Intrinsic ||
+                            callee->proc->kind == MilProcedure::Extern )
+                    {
+                        ret.clear();
+                        if( callee->proc->kind == MilProcedure::Intrinsic )
+                            callIntrinsic(callee->proc,a,ret);
+                        else
+                            callExtern(callee,a,ret);
+                        const bool r = !callee->proc->retType.second.isEmpty();
+                        leaveFrame(a, sp, ret, r);
+                        sp = a + (r ? 1 : 0);
+                        if( switchTo )
+                            goto do_transfer;
+                        pc++;
+                        vmbreak;
+                    }
+                    if( callee->cee )
+                    {
+                        ret.clear();
+                        if( callC(callee, a, ret) )
+                        {
+                            const bool r = !callee->proc->retType.second.isEmpty();
+                            leaveFrame(a, sp, ret, r);
+                            sp = a + (r ? 1 : 0);
+                            pc++;
+                            vmbreak;
+                        }
+                    }
+                    if( !callee->prepared )
+                        prepareBytecode(callee);
+                    switch( code[pc].op )
+                    {
+                    case IL_calli:
+                    case IL_callvi:
+                    case IL_callvirt:
+                        {
+                            // only interpreted targets are cached, so a hit can enter the frame directly
+                            CallSite& site = pd->sites[code[pc].len];
+                            site.target = callee;
+                            site.tt = code[pc].op == IL_callvirt ? typeOfObject(*a) : 0;
+                        }
+                        break;
+                    }
+                }
+            do_enter:
+                {
+                    MemSlot* a = sp - callee->proc->params.size();
+                    frame->pc = pc;
+                    frame++;
+                    enterFrame(frame, callee, a);
+                    pd = callee;
+                    module = pd->module;
+                    proc = pd->proc;
+                    hasRet = !proc->retType.second.isEmpty();
+                    code = pd->ops.data();
+                    consts = pd->consts.data();
+                    args = a;
+                    locals = frame->locals;
+                    stack = frame->stack;
+                    sp = stack;
+                    pc = 0;
+                    vmtier();
+                    vmnative();
+                }
                 vmbreak;
             vmcase(IL_castptr)
                 // NOP
-                if( stack.back().t != MemSlot::Pointer || stack.back().p == 0 )
-                    execError(module, proc, pc, "top of stack is not a pointer");
+                if( sp[-1].t != MemSlot::Pointer || sp[-1].p == 0 )
+                    execError(pd, pc, "top of stack is not a pointer");
                 pc++;
                 vmbreak;
             vmcase(IL_ceq)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
-                stack.push_back(MemSlot(qint64(lhs.u == rhs.u),true));
+                rhs.move(*--sp);
+                lhs.move(*--sp);
+                *sp++ = MemSlot(qint64(lhs.u == rhs.u),true);
                 pc++;
                 vmbreak;
             vmcase(IL_cgt)
             vmcase(IL_cgt_un)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(qint64(lhs.i > rhs.i),true));
+                    *sp++ = MemSlot(qint64(lhs.i > rhs.i),true);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(qint64(lhs.f > rhs.f),true));
+                    *sp++ = MemSlot(qint64(lhs.f > rhs.f),true);
                     break;
                 default:
-                    stack.push_back(MemSlot(qint64(lhs.u > rhs.u),true));
+                    *sp++ = MemSlot(qint64(lhs.u > rhs.u),true);
                     break;
                 }
+                quicken(code[pc], lhs.t, LL_cgt_i, LL_cgt_u, LL_cgt_f);
                 pc++;
                 vmbreak;
             vmcase(IL_clt)
             vmcase(IL_clt_un)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(qint64(lhs.i < rhs.i),true));
+                    *sp++ = MemSlot(qint64(lhs.i < rhs.i),true);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(qint64(lhs.f < rhs.f),true));
+                    *sp++ = MemSlot(qint64(lhs.f < rhs.f),true);
                     break;
                 default:
-                    stack.push_back(MemSlot(qint64(lhs.u < rhs.u),true));
+                    *sp++ = MemSlot(qint64(lhs.u < rhs.u),true);
                     break;
                 }
+                quicken(code[pc], lhs.t, LL_clt_i, LL_clt_u, LL_clt_f);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_i1)
-                convertTo(stack, MemSlot::I, 1);
+                convertTo(sp[-1], MemSlot::I, 1);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_i2)
-                convertTo(stack, MemSlot::I, 2);
+                convertTo(sp[-1], MemSlot::I, 2);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_i4)
-                convertTo(stack, MemSlot::I, 4);
+                convertTo(sp[-1], MemSlot::I, 4);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_i8)
-                convertTo(stack, MemSlot::I, 0);
+                convertTo(sp[-1], MemSlot::I, 0);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_r4)
             vmcase(IL_conv_r8)
-                convertTo(stack, MemSlot::F, 0);
+                convertTo(sp[-1], MemSlot::F, 0);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_u1)
-                convertTo(stack, MemSlot::U, 1);
+                convertTo(sp[-1], MemSlot::U, 1);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_u2)
-                convertTo(stack, MemSlot::U, 2);
+                convertTo(sp[-1], MemSlot::U, 2);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_u4)
-                convertTo(stack, MemSlot::U, 4);
+                convertTo(sp[-1], MemSlot::U, 4);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_u8)
-                convertTo(stack, MemSlot::U, 0);
+                convertTo(sp[-1], MemSlot::U, 0);
                 pc++;
                 vmbreak;
             vmcase(IL_conv_ip)
-                convertTo(stack, MemSlot::Pointer, 0);
+                convertTo(sp[-1], MemSlot::Pointer, 0);
                 pc++;
                 vmbreak;
             vmcase(IL_div)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i / rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i / rhs.i,lhs.hw);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(lhs.f / rhs.f,lhs.hw));
+                    *sp++ = MemSlot(lhs.f / rhs.f,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
                 }
+                quicken(code[pc], lhs.t, LL_div_i, 0, LL_div_f);
                 pc++;
                 vmbreak;
             vmcase(IL_div_un)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u / rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u / rhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -1738,248 +5931,151 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_dup)
-                stack.push_back(stack.back());
+                *sp = sp[-1];
+                sp++;
                 pc++;
                 vmbreak;
             vmcase(IL_initobj)
                 // NOP
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                    execError(module, proc, pc, "top of stack is not a pointer");
+                    execError(pd, pc, "top of stack is not a pointer");
                 pc++;
                 vmbreak;
             vmcase(IL_isinst) {
-                    lhs.move(stack.back());
-                    stack.pop_back();
+                    lhs.move(*--sp);
                     if( (lhs.t != MemSlot::Pointer) )
-                        execError(module, proc, pc, "invalid pointer");
+                        execError(pd, pc, "invalid pointer");
                     if( lhs.p == 0 )
-                        stack.push_back(MemSlot(0)); // IS of null is false
+                        *sp++ = MemSlot(0); // IS of null is false
                     else
                     {
-                        MilQuali q = proc->body[pc].arg.value<MilQuali>();
-                        FlattenedType* reftype = getFlattenedType(module, q);
-                        if( reftype == 0 )
-                            execError(module, proc, pc, "invalid reference object type");
-                        const bool res = isA(module, lhs.p[0].tt, reftype);
-                        stack.push_back(MemSlot(res));
+                        const bool res = isA(typeOfObject(lhs), code[pc].tt);
+                        *sp++ = MemSlot(res);
                     }
                 }
                 pc++;
                 vmbreak;
             vmcase(IL_ldarg)
-            vmcase(IL_ldarg_s)
-                stack.push_back(args.at(proc->body[pc].arg.toUInt()));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldarg_0)
-                stack.push_back(args.at(0));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldarg_1)
-                stack.push_back(args.at(1));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldarg_2)
-                stack.push_back(args.at(2));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldarg_3)
-                stack.push_back(args.at(3));
+                *sp++ = args[code[pc].val];
                 pc++;
                 vmbreak;
             vmcase(IL_ldarga)
-            vmcase(IL_ldarga_s)
-                stack.push_back(&args[proc->body[pc].arg.toUInt()]);
+                *sp++ = &args[code[pc].val];
                 pc++;
                 vmbreak;
             vmcase(IL_ldc_i4)
-            vmcase(IL_ldc_i4_s)
-                stack.push_back(MemSlot(proc->body[pc].arg.toLongLong(),true));
+                *sp++ = MemSlot(code[pc].i,true);
                 pc++;
                 vmbreak;
             vmcase(IL_ldc_i8)
-                stack.push_back(MemSlot(proc->body[pc].arg.toLongLong()));
+                *sp++ = MemSlot(code[pc].i);
                 pc++;
                 vmbreak;
             vmcase(IL_ldc_r4)
-                stack.push_back(MemSlot(proc->body[pc].arg.toDouble(),true));
+                *sp++ = MemSlot(code[pc].f,true);
                 pc++;
                 vmbreak;
             vmcase(IL_ldc_r8)
-                stack.push_back(MemSlot(proc->body[pc].arg.toDouble(),false));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_0)
-                stack.push_back(MemSlot(0));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_1)
-                stack.push_back(MemSlot(1));
+                *sp++ = MemSlot(code[pc].f,false);
                 pc++;
                 vmbreak;
-            vmcase(IL_ldc_i4_2)
-                stack.push_back(MemSlot(2));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_3)
-                stack.push_back(MemSlot(3));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_4)
-                stack.push_back(MemSlot(4));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_5)
-                stack.push_back(MemSlot(5));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_6)
-                stack.push_back(MemSlot(6));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_7)
-                stack.push_back(MemSlot(7));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_8)
-                stack.push_back(MemSlot(8));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldc_i4_m1)
-                stack.push_back(MemSlot(-1));
+            vmcase(IL_ldobj)
+                *sp++ = *code[pc].s; // shares the constant until it is written
                 pc++;
                 vmbreak;
-            vmcase(IL_ldobj)
-                mo = proc->body[pc].arg.value<MilObject>();
-                convert(lhs, mo.data);
-                stack.push_back(MemSlot());
-                stack.back().move(lhs);
-                // now a direct seqval is on the stack
-                pc++;
-                vmbreak;
-            vmcase(IL_ldelem)
-            vmcase(IL_ldelem_i1)
-            vmcase(IL_ldelem_i2)
-            vmcase(IL_ldelem_i4)
-            vmcase(IL_ldelem_i8)
-            vmcase(IL_ldelem_u1)
-            vmcase(IL_ldelem_u2)
-            vmcase(IL_ldelem_u4)
-            vmcase(IL_ldelem_u8)
-            vmcase(IL_ldelem_r4)
-            vmcase(IL_ldelem_r8)
-            vmcase(IL_ldelem_ip)
-                rhs = stack.takeLast();
-                lhs.move(stack.back());
-                stack.pop_back();
+            vmcase(IL_ldelem) {
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 if( (lhs.t != MemSlot::Pointer) || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid array");
+                    execError(pd, pc, "invalid array");
                 if( !lhs.embedded && lhs.p->t == MemSlot::Array )
+                {
                     lhs.p = lhs.p->p;
-                // TODO: bounds check
+                    lhs.off = 0;
+                }
                 if( rhs.i < 0 )
-                    execError(module,proc,pc,"index out of lower bound");
-                if( proc->body[pc].op == IL_ldelem )
-                {
-                    FlattenedType* ety = getFlattenedType(module, proc->body[pc].arg.value<MilQuali>());
-                    if( ety && ety->len )
-                        rhs.u *= ety->len; // multi-dim elem types are here by value
-                    boundsCheck(module,proc,pc,lhs.p,rhs.u);
-                    if( ety && ety->len > 1 )
-                    {
-                        // in case of an array by value element make a value copy
-                        // TODO: why don't we use ldobj here?
-                        stack.push_back(MemSlot());
-                        boundsCheck(module,proc,pc,lhs.p,rhs.u + ety->len - 1);
-                        stack.back().copyOf(lhs.p, rhs.u, ety->len, false);
-                    }else
-                        stack.push_back(lhs.p[rhs.u]);
-                }else
+                    execError(pd,pc,"index out of lower bound");
+                FlattenedType* ety = code[pc].tt;
+                if( ety && ety->len )
+                    rhs.u *= ety->len; // multi-dim elem types are here by value
+                boundsCheck(pd,pc,lhs,rhs.u);
+                if( ety && ety->len > 1 )
                 {
-                    boundsCheck(module,proc,pc,lhs.p,rhs.u);
-                    stack.push_back(lhs.p[rhs.u]);
-                }
+                    // in case of an array by value element make a value copy
+                    // TODO: why don't we use ldobj here?
+                    boundsCheck(pd,pc,lhs,rhs.u + ety->len - 1);
+                    sp->copyOf(lhs.p, rhs.u, ety->len, false);
+                    sp++;
+                }else
+                    *sp++ = lhs.p[rhs.u];
                 pc++;
                 vmbreak;
+            }
             vmcase(IL_ldelema) {
-                rhs.move(stack.back());
-                stack.pop_back();
-                lhs.move(stack.back());
-                stack.pop_back();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid array");
+                    execError(pd, pc, "invalid array");
                 if( !lhs.embedded && lhs.p->t == MemSlot::Array )
-                    lhs.p = lhs.p->p;
-                MilQuali ety = proc->body[pc].arg.value<MilQuali>();
-                FlattenedType* ty = getFlattenedType(module, ety);
+                {
+                    lhs.p = lhs.p->expose();
+                    lhs.off = 0;
+                }
+                if( rhs.i < 0 )
+                    execError(pd, pc, "index out of lower bound");
+                FlattenedType* ty = code[pc].tt;
                 if( ty && ty->len )
                     rhs.u *= ty->len; // multi-dim elem types are all in the same flattened array
-                if( rhs.u < 0 )
-                    execError(module, proc, pc, "index out of lower bound");
-                boundsCheck(module,proc,pc, lhs.p,rhs.u);
-                stack.push_back(&lhs.p[rhs.u]);
+                boundsCheck(pd,pc,lhs,rhs.u);
+                *sp++ = MemSlot(&lhs.p[rhs.u], lhs.off + rhs.u);
                 /* if the array is multi-dim and the terminal array element is a struct, the pointer to a
                  * single element in the flattened array is ambiguous, i.e. we don't know if the actual
                  * target of the pointer is represented by the SlotPtr on the stack, or the SeqVal pointed
                  * to by the SlotPtr. We therefore mark the SlotPtr on the stack, if it directly represents
                  * the target value */
-                stack.back().embedded = ty && ty->type->kind == MilEmitter::Array;
+                sp[-1].embedded = ty && ty->type->kind == MilEmitter::Array;
                 pc++;
                 vmbreak;
             }
-            vmcase(IL_ldfld) {
-                lhs.move(stack.back());
-                stack.pop_back();
+            vmcase(IL_ldfld)
+                lhs.move(*--sp);
                 if( (lhs.t != MemSlot::Pointer) || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid record or field");
+                    execError(pd, pc, "invalid record or field");
                 if( !lhs.embedded && lhs.p->t == MemSlot::Record )
+                {
                     lhs.p = lhs.p->p;
-                MilTrident tri = proc->body[pc].arg.value<MilTrident>();
-                FlattenedType* rec = getFlattenedType(module, tri.first);
-                if( rec == 0 )
-                    execError(module, proc, pc, "invalid record or union type");
-                const MilVariable* field = rec->type->findField(tri.second);
-                if( field == 0 )
-                    execError(module, proc, pc, "unknown field");
-                FlattenedType* ft = getFlattenedType(module, field->type);
-                boundsCheck(module,proc,pc,lhs.p,proc->body[pc].index);
-                if( ft && !ft->fields.isEmpty() )
+                    lhs.off = 0;
+                }
+                boundsCheck(pd,pc,lhs,code[pc].val);
+                if( code[pc].len )
                 {
                     // embedded struct by value
-                    stack.push_back(MemSlot());
-                    boundsCheck(module,proc,pc,lhs.p,proc->body[pc].index+ft->fields.size()-1);
-                    stack.back().copyOf(lhs.p, proc->body[pc].index, ft->fields.size(), true);
+                    boundsCheck(pd,pc,lhs,code[pc].val+code[pc].len-1);
+                    sp->copyOf(lhs.p, code[pc].val, code[pc].len, true);
+                    sp++;
                 }else
-                    stack.push_back(lhs.p[proc->body[pc].index]);
+                    *sp++ = lhs.p[code[pc].val];
                 pc++;
                 vmbreak;
-            }
-            vmcase(IL_ldflda) {
-                lhs.move(stack.back());
-                stack.pop_back();
+            vmcase(IL_ldflda)
+                lhs.move(*--sp);
                 if( (lhs.t != MemSlot::Pointer) || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid record or field");
+                    execError(pd, pc, "invalid record or field");
                 if( !lhs.embedded && lhs.p->t == MemSlot::Record )
-                    lhs.p = lhs.p->p;
-                MilTrident tri = proc->body[pc].arg.value<MilTrident>();
-                FlattenedType* rec = getFlattenedType(module, tri.first);
-                if( rec == 0 )
-                    execError(module, proc, pc, "invalid record or union type");
-                const MilVariable* field = rec->type->findField(tri.second);
-                if( field == 0 )
-                    execError(module, proc, pc, "unknown field");
-                FlattenedType* ft = getFlattenedType(module, field->type);
-                boundsCheck(module,proc,pc,lhs.p,proc->body[pc].index);
-                stack.push_back(&lhs.p[proc->body[pc].index]);
+                {
+                    lhs.p = lhs.p->expose();
+                    lhs.off = 0;
+                }
+                boundsCheck(pd,pc,lhs,code[pc].val);
+                *sp++ = MemSlot(&lhs.p[code[pc].val], lhs.off + code[pc].val);
                 /* if the struct/union has embedded structs/unions and the (flattened) field pointed to is an
                  * embedded array, the pointer is ambigous, i.e. we don't know if the actual target of the
                  * pointer is represented by the SlotPtr on the stack, or the SeqVal pointed to by the SlotPtr.
                  * We therefore mark the SlotPtr on the stack, if it directly represents the target value */
-                stack.back().embedded = ft && !ft->fields.isEmpty();
+                sp[-1].embedded = code[pc].len != 0;
                 pc++;
                 vmbreak;
-            }
             vmcase(IL_ldind_i1)
             vmcase(IL_ldind_i2)
             vmcase(IL_ldind_i4)
@@ -1992,151 +6088,131 @@ public:
             vmcase(IL_ldind_r8)
             vmcase(IL_ldind_ip)
             vmcase(IL_ldind_ipp)
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 if( lhs.p == 0 || lhs.t != MemSlot::Pointer)
-                    execError(module, proc, pc, "invalid pointer on stack");
+                    execError(pd, pc, "invalid pointer on stack");
                 if( lhs.embedded || lhs.p->t == MemSlot::Record || lhs.p->t == MemSlot::Array )
-                    execError(module, proc, pc, "incompatible type on stack");
-                stack.push_back(*lhs.p);
+                    execError(pd, pc, "incompatible type on stack");
+                *sp++ = *lhs.p;
                 pc++;
                 vmbreak;
             vmcase(IL_ldloc)
-            vmcase(IL_ldloc_s)
-                stack.push_back(locals.at(proc->body[pc].arg.toUInt()));
+                *sp++ = locals[code[pc].val];
                 pc++;
                 vmbreak;
             vmcase(IL_ldloca)
-            vmcase(IL_ldloca_s)
-                stack.push_back(&locals[proc->body[pc].arg.toUInt()]);
-                pc++;
-                vmbreak;
-            vmcase(IL_ldloc_0)
-                stack.push_back(locals.at(0));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldloc_1)
-                stack.push_back(locals.at(1));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldloc_2)
-                stack.push_back(locals.at(2));
-                pc++;
-                vmbreak;
-            vmcase(IL_ldloc_3)
-                stack.push_back(locals.at(3));
+                *sp++ = &locals[code[pc].val];
                 pc++;
                 vmbreak;
             vmcase(IL_ldmeth) {
-                    lhs.move(stack.back());
-                    stack.pop_back();
+                    lhs.move(*--sp);
                     if( (lhs.t != MemSlot::Pointer) || lhs.p == 0 )
-                        execError(module, proc, pc, "invalid pointer to object");
-                    if( (lhs.p->t != MemSlot::Record) || lhs.p->p == 0 || lhs.p->p->t != MemSlot::TypeTag )
-                        execError(module, proc, pc, "invalid record");
-                    if( proc->body[pc].index >= lhs.p->p->tt->vtable.size() )
-                        execError(module, proc, pc, "invalid vtable index");
+                        execError(pd, pc, "invalid pointer to object");
+                    FlattenedType* tt = typeOfObject(lhs);
+                    if( tt == 0 )
+                        execError(pd, pc, "invalid record");
+                    CallSite& site = pd->sites[code[pc].len];
+                    if( site.tt != tt )
+                    {
+                        if( code[pc].val >= tt->vtable.size() )
+                            execError(pd, pc, "invalid vtable index");
+                        site.tt = tt;
+                        site.target = site.tt->vtable[code[pc].val];
+                    }
                     MethRef* m = new MethRef();
                     m->obj = lhs.p;
-                    m->proc = &lhs.p->p->tt->vtable[proc->body[pc].index];
-                    stack.push_back(MemSlot(m));
+                    m->proc = site.target;
+                    *sp++ = MemSlot(m);
                 }
                 pc++;
                 vmbreak;
             vmcase(IL_ldnull)
-                stack.push_back(MemSlot((MemSlot*)0));
+                *sp++ = MemSlot((MemSlot*)0);
                 pc++;
                 vmbreak;
             vmcase(IL_ldind)
-                lhs.move(stack.back());
-                stack.pop_back();
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid pointer on stack");
+                    execError(pd, pc, "invalid pointer on stack");
                 /* the structured value is either in a SeqVal pointed to by the SlotPtr on the stack,
                  * or directly represented by the SlotPtr on the stack; the latter case is marked by
                  * "embedded" */
                 if( lhs.embedded )
                 {
-                    MilQuali q = proc->body[pc].arg.value<MilQuali>();
-                    if( q.second.isEmpty() )
+                    if( code[pc].len )
                     {
                         // we expect an intrinsic string on the stack
-                        stack.push_back(MemSlot());
-                        stack.back().copyOf(lhs.p, 0, 0, false );
+                        sp->copyOf(lhs.p, 0, 0, false );
                     }else
                     {
-                        FlattenedType* ty = getFlattenedType(module, q);
+                        FlattenedType* ty = code[pc].tt;
                         if( ty == 0 )
-                            execError(module, proc, pc, "invalid type");
-                        stack.push_back(MemSlot());
+                            execError(pd, pc, "invalid type");
                         if( ty->type->kind == MilEmitter::Struct || ty->type->kind == MilEmitter::Union
                                 || ty->type->kind == MilEmitter::Object)
-                            stack.back().copyOf(lhs.p, 0, ty->fields.size(), true );
+                            sp->copyOf(lhs.p, 0, ty->fields.size(), true );
                         else
                         {
                             Q_ASSERT( ty->type->kind == MilEmitter::Array && ty->type->len != 0 );
-                            stack.back().copyOf(lhs.p, 0, ty->len, false );
+                            sp->copyOf(lhs.p, 0, ty->len, false );
                         }
                     }
+                    sp++;
                 }else
                 {
                     if( (lhs.p->t != MemSlot::Record && lhs.p->t != MemSlot::Array) || lhs.p->p == 0 )
-                        execError(module, proc, pc, "the pointer doesn't point to a structured value");
-                    stack.push_back(MemSlot());
-                    stack.back().copyOf(lhs.p->p, lhs.p->t == MemSlot::Record);
+                        execError(pd, pc, "the pointer doesn't point to a structured value");
+                    sp->copyOf(lhs.p->p, lhs.p->t == MemSlot::Record);
+                    sp++;
                 }
                 pc++;
                 vmbreak;
             vmcase(IL_ldproc)
-                stack.push_back(MemSlot(getProc(module,proc->body[pc].arg.value<MilQuali>())));
+                *sp++ = MemSlot(code[pc].pd);
                 pc++;
                 vmbreak;
-            vmcase(IL_ldstr) {
-                MemSlot* str = internalize(proc->body[pc].arg.toByteArray());
-                stack.push_back(str);
-                stack.back().embedded = true; // the SeqPtr on the stack points directly to the string value
+            vmcase(IL_ldstr)
+                *sp++ = code[pc].s;
+                sp[-1].embedded = true; // the SeqPtr on the stack points directly to the string value
                 pc++;
                 vmbreak;
-            }
             vmcase(IL_ldvar)
-                if( module->variables.size() <= proc->body[pc].index )
-                    execError(module, proc, pc, "invalid variable reference");
-                stack.push_back(module->variables.at(proc->body[pc].index));
+                *sp++ = *code[pc].s;
                 pc++;
                 vmbreak;
             vmcase(IL_ldvara)
-                if( module->variables.size() <= proc->body[pc].index )
-                    execError(module, proc, pc, "invalid variable reference");
-                stack.push_back(&module->variables[proc->body[pc].index]);
+                *sp++ = code[pc].s;
                 pc++;
                 vmbreak;
             vmcase(IL_mul)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i * rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i * rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u * rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u * rhs.u,lhs.hw);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(lhs.f * rhs.f,lhs.hw));
+                    *sp++ = MemSlot(lhs.f * rhs.f,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
                 }
+                quicken(code[pc], lhs.t, LL_mul_i, LL_mul_u, LL_mul_f);
                 pc++;
                 vmbreak;
             vmcase(IL_neg)
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(-lhs.i,lhs.hw));
+                    *sp++ = MemSlot(-lhs.i,lhs.hw);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(-lhs.f,lhs.hw));
+                    *sp++ = MemSlot(-lhs.f,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -2146,48 +6222,35 @@ public:
             vmcase(IL_newarr)
             vmcase(IL_newvla)
                 {
-                    lhs = stack.takeLast();
+                    lhs.move(*--sp);
                     if( lhs.u == 0 )
-                        execError(module, proc, pc, "invalid array size");
-                    MilQuali ety = proc->body[pc].arg.value<MilQuali>();
-                    FlattenedType* ty = getFlattenedType(module, ety);
-                    // multi-dim arrays are flattened
-                    MemSlot* array = createSequence(lhs.u * ( ty && ty->len ? ty->len : 1 ) );
-                    initArray(module, array, ety);
-                    stack.push_back(MemSlot(array));
+                        execError(pd, pc, "invalid array size");
+                    MemSlot* array = createSequence(lhs.u * code[pc].len);
+                    initArray(array, code[pc].tt, code[pc].val);
+                    *sp++ = MemSlot(array);
                 }
                 pc++;
                 vmbreak;
             vmcase(IL_newobj)
                 {
-                    const MilQuali q = proc->body[pc].arg.value<MilQuali>();
-                    FlattenedType* ty = getFlattenedType(module, q);
-                    if( ty == 0 )
-                        execError(module, proc, pc, QString("unknown type '%1'").
-                                  arg(MilEmitter::toString(q).constData()));
-                    if( ty->type->kind != MilEmitter::Struct && ty->type->kind != MilEmitter::Union
-                            && ty->type->kind != MilEmitter::Object)
-                        execError(module, proc, pc, "operation not available for given type");
-                    int size = ty->fields.size();
-                    if( ty->type->kind == MilEmitter::Object )
-                        size++;
-                    MemSlot* record = createSequence(size); // use the flattened version of the record or union
-                    initFields(module, record, ty->fields);
+                    FlattenedType* ty = code[pc].tt;
+                    MemSlot* record = createSequence(code[pc].len); // use the flattened version of the record or union
+                    initFields(ty, record);
                     if( ty->type->kind == MilEmitter::Object )
                         record[0] = ty;
-                    stack.push_back(MemSlot( record ) );
+                    *sp++ = MemSlot( record ) ;
                 }
                 pc++;
                 vmbreak;
             vmcase(IL_not)
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(~lhs.i,lhs.hw));
+                    *sp++ = MemSlot(~lhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(~lhs.u,lhs.hw));
+                    *sp++ = MemSlot(~lhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -2195,15 +6258,15 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_or) // TODO short-circuit evaluation
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i | rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i | rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u | rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u | rhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -2212,31 +6275,32 @@ public:
                 vmbreak;
             vmcase(IL_rem)
             vmcase(IL_rem_un)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i % rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i % rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u % rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u % rhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
                 }
+                quicken(code[pc], lhs.t, LL_rem_i, LL_rem_u, 0);
                 pc++;
                 vmbreak;
             vmcase(IL_shl)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i << rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i << rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u << rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u << rhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -2244,18 +6308,20 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_shr)
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
                     if( lhs.hw )
                     {
                         qint32 l = lhs.i;
-                        stack.push_back(MemSlot(l >> rhs.i,lhs.hw));
+                        *sp++ = MemSlot(l >> rhs.i,lhs.hw);
                     }else
-                        stack.push_back(MemSlot(lhs.i >> rhs.i,lhs.hw));
+                        *sp++ = MemSlot(lhs.i >> rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u >> rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u >> rhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -2263,42 +6329,41 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_shr_un)
-                stack.push_back(MemSlot(lhs.u >> rhs.u,lhs.hw));
-                pc++;
-                vmbreak;
-            vmcase(IL_sizeof)
-                stack.push_back(MemSlot(1)); // RISK
+                rhs.move(*--sp);
+                lhs.move(*--sp);
+                *sp++ = MemSlot(lhs.u >> rhs.u,lhs.hw);
                 pc++;
                 vmbreak;
             vmcase(IL_sub)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i - rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i - rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u - rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u - rhs.u,lhs.hw);
                     break;
                 case MemSlot::F:
-                    stack.push_back(MemSlot(lhs.f - rhs.f,lhs.hw));
+                    *sp++ = MemSlot(lhs.f - rhs.f,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
                 }
+                quicken(code[pc], lhs.t, LL_sub_i, LL_sub_u, LL_sub_f);
                 pc++;
                 vmbreak;
             vmcase(IL_xor)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 switch( lhs.t )
                 {
                 case MemSlot::I:
-                    stack.push_back(MemSlot(lhs.i ^ rhs.i,lhs.hw));
+                    *sp++ = MemSlot(lhs.i ^ rhs.i,lhs.hw);
                     break;
                 case MemSlot::U:
-                    stack.push_back(MemSlot(lhs.u ^ rhs.u,lhs.hw));
+                    *sp++ = MemSlot(lhs.u ^ rhs.u,lhs.hw);
                     break;
                 default:
                     Q_ASSERT(false);
@@ -2306,184 +6371,406 @@ public:
                 pc++;
                 vmbreak;
             vmcase(IL_free) {
-                lhs = stack.takeLast();
+                lhs.move(*--sp);
                 if( (lhs.t != MemSlot::Pointer) || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid pointer");
+                    execError(pd, pc, "invalid pointer");
                 MemSlot* header = lhs.p-1;
                 if(header->t != MemSlot::Header)
-                    execError(module, proc, pc, "cannot free this object");
-                delete[] header;
+                    execError(pd, pc, "cannot free this object");
+                MemSlot::dispose(lhs.p);
                 pc++;
                 vmbreak;
             }
-            vmcase(IL_repeat) // repeat(1) until(1) end(5)
-                curStatement.push_back(IL_repeat);
-                pc++;
+            vmcase(LL_jump)
+                pc = code[pc].val;
                 vmbreak;
-            vmcase(IL_until)
-                pc++;
+            vmcase(LL_loop)
+                pc = code[pc].val;
+                vmtier();
+                vmnative();
+                vmbreak;
+            vmcase(LL_brfalse)
+                lhs.move(*--sp);
+                if( lhs.u == 0 )
+                    vmtaken();
+                else
+                    pc++;
+                vmbreak;
+            vmcase(LL_brtrue)
+                sp--;
+                if( sp->u != 0 )
+                    vmtaken();
+                else
+                    pc++;
+                vmbreak;
+            vmcase(LL_clt_brfalse)
+                sp -= 2;
+                if( !lessThan(sp[0], sp[1]) )
+                    vmtaken();
+                else
+                    pc++;
                 vmbreak;
-            vmcase(IL_exit)
-                while( !curStatement.isEmpty() && curStatement.back() != IL_loop )
-                    curStatement.pop_back(); // exit everything up to the closest loop statement
-                if( curStatement.isEmpty() || curStatement.back() != IL_loop )
-                    execError(module, proc, pc, "operation not allowed here");
-                curStatement.pop_back();
-                pc = proc->body[pc].index;
+            vmcase(LL_clt_brtrue)
+                sp -= 2;
+                if( lessThan(sp[0], sp[1]) )
+                    vmtaken();
+                else
+                    pc++;
+                vmbreak;
+            vmcase(LL_cgt_brfalse)
+                sp -= 2;
+                if( !greaterThan(sp[0], sp[1]) )
+                    vmtaken();
+                else
+                    pc++;
+                vmbreak;
+            vmcase(LL_cgt_brtrue)
+                sp -= 2;
+                if( greaterThan(sp[0], sp[1]) )
+                    vmtaken();
+                else
+                    pc++;
                 vmbreak;
-            vmcase(IL_goto)
-                pc = proc->body[pc].index;
+            vmcase(LL_ceq_brfalse)
+                sp -= 2;
+                if( sp[0].u != sp[1].u )
+                    vmtaken();
+                else
+                    pc++;
                 vmbreak;
-            vmcase(IL_ifgoto)
-                lhs = stack.takeLast();
-                if( lhs.u )
-                    pc = proc->body[pc].index;
+            vmcase(LL_ceq_brtrue)
+                sp -= 2;
+                if( sp[0].u == sp[1].u )
+                    vmtaken();
                 else
                     pc++;
                 vmbreak;
-            vmcase(IL_if) // if(1) then(2) else(2) end(5)
-                curStatement.push_back(IL_if);
+            vmcase(LL_addi)
+                addConst(sp[-1], code[pc].i);
                 pc++;
                 vmbreak;
-            vmcase(IL_iif) // iif(1) then(2) else(2) end(5)
-                curStatement.push_back(IL_iif);
+            vmcase(LL_subi)
+                subConst(sp[-1], code[pc].i);
                 pc++;
                 vmbreak;
-            vmcase(IL_then)
-                if( curStatement.isEmpty() )
-                    execError(module, proc, pc, "operation not expected here");
-                if( curStatement.back() == IL_if || curStatement.back() == IL_iif )
-                {
-                    lhs = stack.takeLast();
-                    if( lhs.u == 0 )
-                        pc = proc->body[pc].index; // jump to else+1 or end
-                    else
-                        pc++;
-                }else // we never execute then in a switch statement
-                    execError(module, proc, pc, "operation not expected here");
+            vmcase(LL_incvar)
+                addConst(*code[pc].s, (qint32)code[pc].len);
+                pc++;
+                vmbreak;
+            vmcase(LL_decvar)
+                subConst(*code[pc].s, (qint32)code[pc].len);
+                pc++;
+                vmbreak;
+            vmcase(LL_incloc)
+                addConst(locals[code[pc].val], (qint32)code[pc].len);
+                pc++;
+                vmbreak;
+            vmcase(LL_decloc)
+                subConst(locals[code[pc].val], (qint32)code[pc].len);
+                pc++;
                 vmbreak;
-            vmcase(IL_else)
-                if( curStatement.isEmpty() )
-                    execError(module, proc, pc, "operation not expected here");
-                if( curStatement.back() == IL_switch )
+            vmcase(LL_ldarg_ldfld)
+                lhs = args[code[pc].val];
+                lhs.embedded = args[code[pc].val].embedded;
+                if( (lhs.t != MemSlot::Pointer) || lhs.p == 0 )
+                    execError(pd, pc, "invalid record or field");
+                if( !lhs.embedded && lhs.p->t == MemSlot::Record )
                 {
-                    if( switchExpr.back().t == MemSlot::Procedure )
-                        pc = proc->body[pc].index; // done, else points to end
-                    else
-                        pc++; // execute else
-                }else if( curStatement.back() == IL_if || curStatement.back() == IL_iif )
-                    pc = proc->body[pc].index; // else points to end, only hit after then is executed
-                vmbreak;
-            vmcase(IL_end)
-                if( curStatement.isEmpty() )
-                    execError(module, proc, pc, "operation not expected here");
-                if( curStatement.back() == IL_repeat )
-                {
-                    // repeat until end
-                    lhs = stack.takeLast();
-                    if( lhs.u != 0 )
-                    {
-                        curStatement.pop_back();
-                        pc++;
-                        break;
-                    }
-                }else if( curStatement.back() == IL_switch )
-                    switchExpr.pop_back();
-                if( proc->body[pc].index )
-                    pc = proc->body[pc].index;
+                    lhs.p = lhs.p->p;
+                    lhs.off = 0;
+                }
+                boundsCheck(pd,pc,lhs,code[pc].len);
+                *sp++ = lhs.p[code[pc].len];
+                pc++;
+                vmbreak;
+            vmcase(LL_radd)
+                vmbinary(IL_add);
+                vmbreak;
+            vmcase(LL_rsub)
+                vmbinary(IL_sub);
+                vmbreak;
+            vmcase(LL_rmul)
+                vmbinary(IL_mul);
+                vmbreak;
+            vmcase(LL_rdiv)
+                vmbinary(IL_div);
+                vmbreak;
+            vmcase(LL_rdiv_un)
+                vmbinary(IL_div_un);
+                vmbreak;
+            vmcase(LL_rrem)
+                vmbinary(IL_rem);
+                vmbreak;
+            vmcase(LL_rand)
+                vmbinary(IL_and);
+                vmbreak;
+            vmcase(LL_ror)
+                vmbinary(IL_or);
+                vmbreak;
+            vmcase(LL_rxor)
+                vmbinary(IL_xor);
+                vmbreak;
+            vmcase(LL_rshl)
+                vmbinary(IL_shl);
+                vmbreak;
+            vmcase(LL_rshr)
+                vmbinary(IL_shr);
+                vmbreak;
+            vmcase(LL_rshr_un)
+                vmbinary(IL_shr_un);
+                vmbreak;
+            vmcase(LL_rceq)
+                vmbinary(IL_ceq);
+                vmbreak;
+            vmcase(LL_rclt)
+                vmbinary(IL_clt);
+                vmbreak;
+            vmcase(LL_rcgt)
+                vmbinary(IL_cgt);
+                vmbreak;
+            vmcase(LL_rclt_brfalse)
+                vmcompare(!lessThan(*a,*b));
+                vmbreak;
+            vmcase(LL_rclt_brtrue)
+                vmcompare(lessThan(*a,*b));
+                vmbreak;
+            vmcase(LL_rcgt_brfalse)
+                vmcompare(!greaterThan(*a,*b));
+                vmbreak;
+            vmcase(LL_rcgt_brtrue)
+                vmcompare(greaterThan(*a,*b));
+                vmbreak;
+            vmcase(LL_rceq_brfalse)
+                vmcompare(a->u != b->u);
+                vmbreak;
+            vmcase(LL_rceq_brtrue)
+                vmcompare(a->u == b->u);
+                vmbreak;
+            vmcase(LL_rbrfalse)
+                if( vmsrc(code[pc].len >> 16)->u == 0 )
+                    vmtaken();
                 else
+                    pc++;
+                vmbreak;
+            vmcase(LL_rmov) {
+                    MemSlot* a = vmsrc(code[pc].len >> 16);
+                    MemSlot* d = vmdst(code[pc].val);
+                    if( a->t == MemSlot::Record || a->t == MemSlot::Array ||
+                            d->t == MemSlot::Record || d->t == MemSlot::Array )
+                    {
+                        lhs = *a;
+                        storeVariable(module, proc, *d, lhs);
+                    }else
+                        *d = *a;
+                    pc++;
+                    vmbreak;
+                }
+            vmcase(LL_rst)
+                rhs.move(*--sp);
+                if( rhs.t != MemSlot::I && rhs.t != MemSlot::U && rhs.t != MemSlot::F
+                        && rhs.t != MemSlot::Pointer && rhs.t != MemSlot::Procedure && rhs.t != MemSlot::Method )
+                    execError(pd, pc, "incompatible value");
+                vmdst(code[pc].val)->move(rhs);
+                pc++;
+                vmbreak;
+            vmcase(LL_case)
+                if( sp[-1].t != MemSlot::I )
+                    execError(pd, pc, "switch expression has invalid type");
+                if( pd->labels.at(code[pc].i).contains( sp[-1].i ) )
                 {
-                    curStatement.pop_back();
+                    (--sp)->clear();
                     pc++;
+                }else
+                {
+                    if( code[pc].len )
+                        (--sp)->clear(); // the last case
+                    pc = code[pc].val;
                 }
                 vmbreak;
-            vmcase(IL_label)
-                // NOP
+            vmcase(LL_switch)
+                if( sp[-1].t != MemSlot::I )
+                    execError(pd, pc, "switch expression has invalid type");
+                pc = pd->switches[code[pc].i].find((--sp)->i);
+                vmbreak;
+            vmcase(LL_setin)
+                sp--;
+                sp[-1].u = ((1 << sp[-1].u) & sp->u) != 0;
+                sp[-1].t = MemSlot::U;
+                sp[-1].hw = false;
                 pc++;
                 vmbreak;
-            vmcase(IL_line)
-                // NOP
+            vmcase(LL_setdiv)
+                sp--;
+                sp[-1].u = ~(quint32)( sp[-1].u & sp->u ) & ( sp[-1].u | sp->u );
+                sp[-1].t = MemSlot::U;
+                sp[-1].hw = false;
+                pc++;
+                vmbreak;
+            vmcase(LL_relop) {
+                    const quint64 res = relop(code[pc].val, sp - 3);
+                    (--sp)->clear();
+                    (--sp)->clear();
+                    sp[-1] = MemSlot(res);
+                }
                 pc++;
                 vmbreak;
-            vmcase(IL_loop) // loop(1) end(5)
-                curStatement.push_back(IL_loop);
+            vmcase(LL_strlen)
+                sp[-1] = MemSlot(quint64(strLen(chars(sp[-1]))), true);
+                pc++;
+                vmbreak;
+            vmcase(LL_intrinsic) {
+                    MilProcedure* p = code[pc].pd->proc;
+                    MemSlot* a = sp - p->params.size();
+                    if( a < stack )
+                        execError(pd, pc, "not enough actual parameters");
+                    ret.clear();
+                    callIntrinsic(p, a, ret);
+                    const bool r = !p->retType.second.isEmpty();
+                    leaveFrame(a, sp, ret, r);
+                    sp = a + (r ? 1 : 0);
+                }
                 pc++;
                 vmbreak;
             vmcase(IL_pop)
-                stack.pop_back();
+                (--sp)->clear();
                 pc++;
                 vmbreak;
             vmcase(IL_ptroff)
-                rhs = stack.takeLast();
-                lhs = stack.takeLast();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Pointer || rhs.t != MemSlot::I )
-                    execError(module, proc, pc, "invalid argument types");
+                    execError(pd, pc, "invalid argument types");
                 lhs.p += rhs.i;
-                stack.push_back(lhs);
+                lhs.off += rhs.i;
+                *sp++ = lhs;
                 pc++;
                 vmbreak;
             vmcase(IL_ret)
-                if( !proc->retType.second.isEmpty() )
+                if( hasRet )
+                    ret.move(*--sp);
+                if( sp != stack )
+                    execError(pd, pc, "stack must be empty at this place");
+                goto do_return;
+            vmcase(LL_leave)
+#if 0
+                out << "***** " << module->module->fullName << "!" << proc->name << ":" << endl;
+                //dump(module->variables,"module");
+                //dump(locals,"locals");
+#endif
+                ret.clear();
+            do_return:
+                leaveFrame(args, sp, ret, hasRet);
+                vmTop = frame->outer;
+                vmFrame = frame;
+                if( frame == base )
+                    return;
+                if( frame == coBottom )
+                    execError(pd, pc, "the body of a coroutine must not end");
+                sp = args + (hasRet ? 1 : 0);
+                frame--;
+                pd = frame->pd;
+                module = pd->module;
+                proc = pd->proc;
+                hasRet = !proc->retType.second.isEmpty();
+                code = pd->ops.data();
+                consts = pd->consts.data();
+                args = frame->args;
+                locals = frame->locals;
+                stack = frame->stack;
+                pc = frame->pc + 1;
+                vmbreak;
+            do_transfer:
                 {
-                    ret.move(stack.back());
-                    stack.pop_back();
+                    // suspend the running coroutine at the Transfer call and resume the other one
+                    Coroutine* from = switchFrom;
+                    Coroutine* to = switchTo;
+                    switchFrom = switchTo = 0;
+                    frame->pc = pc;
+                    from->frame = frame;
+                    from->sp = sp;
+                    from->top = vmTop;
+                    from->next = vmFrame;
+                    from->end = vmEnd;
+                    from->framesEnd = vmFramesEnd;
+                    current = to;
+                    coBottom = to->seg.frames;
+                    if( to->frame == 0 )
+                    {
+                        // enter the body at the bottom of its segment
+                        vmEnd = to->seg.end;
+                        vmFramesEnd = to->seg.framesEnd;
+                        vmTop = to->seg.stack;
+                        frame = to->seg.frames;
+                        pd = to->body;
+                        if( !pd->prepared )
+                            prepareBytecode(pd);
+                        args = to->seg.stack;
+                        enterFrame(frame, pd, args);
+                        pc = -1;
+                        sp = frame->stack;
+                    }else
+                    {
+                        vmEnd = to->end;
+                        vmFramesEnd = to->framesEnd;
+                        vmTop = to->top;
+                        vmFrame = to->next;
+                        frame = to->frame;
+                        pd = frame->pd;
+                        args = frame->args;
+                        pc = frame->pc;
+                        sp = to->sp;
+                    }
+                    module = pd->module;
+                    proc = pd->proc;
+                    hasRet = !proc->retType.second.isEmpty();
+                    code = pd->ops.data();
+                    consts = pd->consts.data();
+                    locals = frame->locals;
+                    stack = frame->stack;
+                    pc++;
                 }
-                if( !stack.isEmpty() )
-                    execError(module, proc, pc, "stack must be empty at this place");
-                return;
-
+                vmbreak;
             vmcase(IL_starg)
-            vmcase(IL_starg_s)
-                storeVariable(module, proc, args[proc->body[pc].arg.toUInt()], stack.back());
-                stack.pop_back();
+                storeVariable(module, proc, args[code[pc].val], *--sp);
+                sp->clear();
                 pc++;
                 vmbreak;
             vmcase(IL_stelem)
-            vmcase(IL_stelem_i1)
-            vmcase(IL_stelem_i2)
-            vmcase(IL_stelem_i4)
-            vmcase(IL_stelem_i8)
-            vmcase(IL_stelem_r4)
-            vmcase(IL_stelem_r8)
-            vmcase(IL_stelem_ip) {
-                    rhs.move(stack.back());
-                    stack.pop_back();
-                    MemSlot index = stack.takeLast();
-                    lhs.move(stack.back());
-                    stack.pop_back();
+            vmcase(IL_stelem_i1) {
+                    rhs.move(*--sp);
+                    MemSlot index;
+                    index.move(*--sp);
+                    lhs.move(*--sp);
                     if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                        execError(module, proc, pc, "invalid array pointer");
+                        execError(pd, pc, "invalid array pointer");
                     if( index.t != MemSlot::I && index.t != MemSlot::U )
-                        execError(module, proc, pc, "invalid index type");
-                    if( rhs.i < 0 )
-                        execError(module, proc, pc, "index out of lower bound");
-                    if( proc->body[pc].op == IL_stelem )
+                        execError(pd, pc, "invalid index type");
+                    if( index.i < 0 )
+                        execError(pd, pc, "index out of lower bound");
+                    if( code[pc].op == IL_stelem )
                     {
-                        MilQuali ety = proc->body[pc].arg.value<MilQuali>();
-                        FlattenedType* ty = getFlattenedType(module, ety);
+                        FlattenedType* ty = code[pc].tt;
                         if( ty && ty->len )
                             index.u *= ty->len; // multi-dim elem types are here by value
-                        boundsCheck(module,proc,pc,lhs.p,index.i);
-                        store(module,proc,pc,lhs.p + index.u, lhs.embedded, rhs );
+                        boundsCheck(pd,pc,lhs,index.i);
+                        store(pd,pc,lhs.p + index.u, lhs.off + index.u, lhs.embedded, rhs );
                     }else
                     {
                         if( rhs.t != MemSlot::I && rhs.t != MemSlot::U && rhs.t != MemSlot::F &&
                                 rhs.t != MemSlot::Pointer && rhs.t != MemSlot::Procedure )
-                            execError(module, proc, pc, "invalid value type");
-                        boundsCheck(module,proc,pc,lhs.p,index.i);
+                            execError(pd, pc, "invalid value type");
+                        boundsCheck(pd,pc,lhs,index.i);
                         lhs.p[index.u] = rhs;
                     }
                 pc++;
                 vmbreak;
             }
             vmcase(IL_stfld)
-                rhs.move(stack.back());
-                stack.pop_back();
-                lhs.move(stack.back());
-                stack.pop_back();
+                rhs.move(*--sp);
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid object pointer");
-                store(module,proc,pc,lhs.p, lhs.embedded, rhs);
+                    execError(pd, pc, "invalid object pointer");
+                store(pd,pc,lhs.p, lhs.off, lhs.embedded, rhs);
                 pc++;
                 vmbreak;
             vmcase(IL_stind_i1)
@@ -2494,105 +6781,165 @@ public:
             vmcase(IL_stind_r8)
             vmcase(IL_stind_ip)
             vmcase(IL_stind_ipp)
-                rhs.move(stack.back());
-                stack.pop_back();
+                rhs.move(*--sp);
                 // TODO: default scalar value it t == 0
                 if( rhs.t != MemSlot::I && rhs.t != MemSlot::U && rhs.t != MemSlot::F
                         && rhs.t != MemSlot::Pointer && rhs.t != MemSlot::Procedure && rhs.t != MemSlot::Method )
-                    execError(module, proc, pc, "incompatible value");
-                lhs = stack.takeLast();
+                    execError(pd, pc, "incompatible value");
+                lhs.move(*--sp);
                 if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid pointer");
+                    execError(pd, pc, "invalid pointer");
                 lhs.p->move(rhs);
                 pc++;
                 vmbreak;
             vmcase(IL_stloc)
-            vmcase(IL_stloc_s)
-                storeVariable(module, proc, locals[proc->body[pc].arg.toUInt()], stack.back());
-                stack.pop_back();
+                storeVariable(module, proc, locals[code[pc].val], *--sp);
+                sp->clear();
                 pc++;
                 vmbreak;
-            vmcase(IL_stloc_0)
-                storeVariable(module, proc, locals[0], stack.back());
-                stack.pop_back();
+            vmcase(IL_stind)
+                Q_ASSERT( sp - stack >= 2 );
+                rhs.move(*--sp);
+                lhs.move(*--sp);
+                if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
+                    execError(pd, pc, "invalid destination pointer");
+                store(pd,pc,lhs.p,lhs.off,lhs.embedded,rhs);
                 pc++;
                 vmbreak;
-            vmcase(IL_stloc_1)
-                storeVariable(module, proc, locals[1], stack.back());
-                stack.pop_back();
+            vmcase(IL_stvar)
+                storeVariable(module, proc, *code[pc].s, *--sp);
+                sp->clear();
                 pc++;
                 vmbreak;
-            vmcase(IL_stloc_2)
-                storeVariable(module, proc, locals[2], stack.back());
-                stack.pop_back();
+            vmcase(LL_add_i)
+                vmguard(MemSlot::I, IL_add);
+                sp[-2].i += sp[-1].i;
+                sp--;
                 pc++;
                 vmbreak;
-            vmcase(IL_stloc_3)
-                storeVariable(module, proc, locals[3], stack.back());
-                stack.pop_back();
-               pc++;
+            vmcase(LL_add_u)
+                vmguard(MemSlot::U, IL_add);
+                sp[-2].u += sp[-1].u;
+                sp--;
+                pc++;
                 vmbreak;
-            vmcase(IL_stind)
-                Q_ASSERT( stack.size() >= 2 );
-                rhs.move(stack.back());
-                stack.pop_back();
-                lhs.move(stack.back());
-                stack.pop_back();
-                if( lhs.t != MemSlot::Pointer || lhs.p == 0 )
-                    execError(module, proc, pc, "invalid destination pointer");
-                store(module,proc,pc,lhs.p,lhs.embedded,rhs);
+            vmcase(LL_add_f)
+                vmguard(MemSlot::F, IL_add);
+                sp[-2].f += sp[-1].f;
+                sp--;
                 pc++;
                 vmbreak;
-            vmcase(IL_stvar)
-                storeVariable(module, proc, module->variables[proc->body[pc].index], stack.back());
-                stack.pop_back();
+            vmcase(LL_sub_i)
+                vmguard(MemSlot::I, IL_sub);
+                sp[-2].i -= sp[-1].i;
+                sp--;
                 pc++;
                 vmbreak;
-            vmcase(IL_switch) // switch(1) {case(1) then(2)} [else(2)] end(5)
-                curStatement.push_back(IL_switch);
-                switchExpr.append(MemSlot());
+            vmcase(LL_sub_u)
+                vmguard(MemSlot::U, IL_sub);
+                sp[-2].u -= sp[-1].u;
+                sp--;
                 pc++;
                 vmbreak;
-            vmcase(IL_case)
-                if( switchExpr.back().t == MemSlot::Procedure )
-                {
-                    // done
-                    pc++;
-                    if( proc->body.size() <= pc || proc->body[pc].op != IL_then )
-                        execError(module, proc, pc, "expecting 'then' operation");
-                    pc = proc->body[pc].index; // then points to end
-                    break;
-                }
-                if( switchExpr.back().t == MemSlot::Invalid )
-                    switchExpr.back() = stack.takeLast();
-                if( switchExpr.back().t != MemSlot::I )
-                    execError(module, proc, pc+1, "switch expression has invalid type");
-                if( proc->body[pc].arg.value<CaseLabelList>().contains( switchExpr.back().i ) )
-                {
-                    switchExpr.back().t = MemSlot::Procedure; // mark as done
-                    pc += 2; // skip then
-                }else
-                    pc = proc->body[pc].index;
+            vmcase(LL_sub_f)
+                vmguard(MemSlot::F, IL_sub);
+                sp[-2].f -= sp[-1].f;
+                sp--;
+                pc++;
                 vmbreak;
-            vmcase(IL_while) // while(1) do(1) end(5)
-                curStatement.push_back(IL_while);
+            vmcase(LL_mul_i)
+                vmguard(MemSlot::I, IL_mul);
+                sp[-2].i *= sp[-1].i;
+                sp--;
                 pc++;
                 vmbreak;
-            vmcase(IL_do)
-                lhs = stack.takeLast();
-                if( lhs.u == 0 )
-                {
-                    curStatement.pop_back();
-                    pc = proc->body[pc].index; // jump to end+1
-                }else
-                    pc++;
+            vmcase(LL_mul_u)
+                vmguard(MemSlot::U, IL_mul);
+                sp[-2].u *= sp[-1].u;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_mul_f)
+                vmguard(MemSlot::F, IL_mul);
+                sp[-2].f *= sp[-1].f;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_div_i)
+                vmguard(MemSlot::I, IL_div);
+                sp[-2].i /= sp[-1].i;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_div_f)
+                vmguard(MemSlot::F, IL_div);
+                sp[-2].f /= sp[-1].f;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_rem_i)
+                vmguard(MemSlot::I, IL_rem);
+                sp[-2].i %= sp[-1].i;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_rem_u)
+                vmguard(MemSlot::U, IL_rem);
+                sp[-2].u %= sp[-1].u;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_clt_i)
+                vmguard(MemSlot::I, IL_clt);
+                sp[-2].i = sp[-2].i < sp[-1].i;
+                sp[-2].t = MemSlot::I;
+                sp[-2].hw = true;
+                sp--;
+                pc++;
                 vmbreak;
-            vmcase(IL_nop)
+            vmcase(LL_clt_u)
+                vmguard(MemSlot::U, IL_clt);
+                sp[-2].i = sp[-2].u < sp[-1].u;
+                sp[-2].t = MemSlot::I;
+                sp[-2].hw = true;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_clt_f)
+                vmguard(MemSlot::F, IL_clt);
+                sp[-2].i = sp[-2].f < sp[-1].f;
+                sp[-2].t = MemSlot::I;
+                sp[-2].hw = true;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_cgt_i)
+                vmguard(MemSlot::I, IL_cgt);
+                sp[-2].i = sp[-2].i > sp[-1].i;
+                sp[-2].t = MemSlot::I;
+                sp[-2].hw = true;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_cgt_u)
+                vmguard(MemSlot::U, IL_cgt);
+                sp[-2].i = sp[-2].u > sp[-1].u;
+                sp[-2].t = MemSlot::I;
+                sp[-2].hw = true;
+                sp--;
+                pc++;
+                vmbreak;
+            vmcase(LL_cgt_f)
+                vmguard(MemSlot::F, IL_cgt);
+                sp[-2].i = sp[-2].f > sp[-1].f;
+                sp[-2].t = MemSlot::I;
+                sp[-2].hw = true;
+                sp--;
                 pc++;
                 vmbreak;
 #ifndef _USE_JUMP_TABLE
             default:
-                throw QString("operator not implemented: %1").arg(s_opName[proc->body[pc].op]);
+                throw QString("operator not implemented: %1").arg(s_opName[proc->body[pd->pcs[pc]].op]);
 #endif
             }
         }
@@ -2623,9 +6970,6 @@ MilInterpreter::MilInterpreter(MilLoader* l)
 #endif
 
     imp->intrinsicMod = Token::getSymbol("MIC$");
-    imp->outMod = Token::getSymbol("Out");
-    imp->inputMod = Token::getSymbol("Input");
-    imp->mathlMod = Token::getSymbol("MathL");
     QByteArray name;
     name = Token::getSymbol("relop1");
     imp->intrinsics.insert(name.constData(), createIntrinsic(name,1,3,true));
@@ -2654,26 +6998,181 @@ MilInterpreter::MilInterpreter(MilLoader* l)
     name = Token::getSymbol("printSet");
     imp->intrinsics.insert(name.constData(), createIntrinsic(name,13,1,false));
     name = Token::getSymbol("strcopy");
-    imp->intrinsics.insert(name.constData(), createIntrinsic(name,14,1,false));
+    imp->intrinsics.insert(name.constData(), createIntrinsic(name,14,2,false));
     name = Token::getSymbol("assert");
     imp->intrinsics.insert(name.constData(), createIntrinsic(name,15,3,false));
+    name = Token::getSymbol("strlen");
+    imp->intrinsics.insert(name.constData(), createIntrinsic(name,16,1,true));
+    imp->registerExterns();
 }
 
 MilInterpreter::~MilInterpreter()
 {
+    HeapScope scope(&imp->heap);
     delete imp;
 }
 
+void MilInterpreter::setStackSize(quint32 slots)
+{
+    HeapScope scope(&imp->heap);
+    imp->allocStack(qMax(slots, quint32(1024)));
+}
+
 void MilInterpreter::run(const QByteArray& module)
 {
+    HeapScope scope(&imp->heap);
+    if( !imp->enterFromHost() )
+    {
+        qCritical() << imp->error;
+        return;
+    }
     try
     {
         ModuleData* m = imp->loadModule(module);
+        imp->out.flush();
         if( m == 0 )
             qCritical() << "module" << module << "not found";
     }catch(const QString& str)
     {
+        imp->out.flush();
+        imp->resetStack();
         qCritical() << str;
     }
+    if( imp->report )
+        imp->reportFusion();
+}
+
+void MilInterpreter::setReport(bool on)
+{
+    imp->report = on;
+}
+
+void MilInterpreter::setEngine(Engine e)
+{
+    imp->engine = e;
+}
+
+void MilInterpreter::setJit(bool on)
+{
+#ifdef _MIC_JIT
+    imp->jit = on;
+#else
+    if( on )
+        qWarning() << "native code generation is not supported on this platform";
+#endif
+}
+
+void MilInterpreter::setCompiler(const QString& cc)
+{
+    imp->cc = cc;
+}
+
+bool MilInterpreter::addLibrary(const QString& path)
+{
+    QLibrary* lib = new QLibrary(path);
+    if( !lib->load() )
+    {
+        qCritical() << "cannot load library" << path << lib->errorString();
+        delete lib;
+        return false;
+    }
+    imp->libraries.append(lib);
+    return true;
+}
+
+bool MilInterpreter::load(const QByteArray& module)
+{
+    HeapScope scope(&imp->heap);
+    imp->error.clear();
+    if( !imp->enterFromHost() )
+        return false;
+    try
+    {
+        ModuleData* m = imp->loadModule(Token::getSymbol(module));
+        imp->out.flush();
+        if( m == 0 )
+            imp->error = QString("module %1 not found").arg(module.constData());
+    }catch(const QString& str)
+    {
+        imp->out.flush();
+        imp->resetStack();
+        imp->error = str;
+    }
+    return imp->error.isEmpty();
+}
+
+MilInterpreter::Proc MilInterpreter::resolve(const QByteArray& module, const QByteArray& proc)
+{
+    HeapScope scope(&imp->heap);
+    imp->error.clear();
+    if( !imp->enterFromHost() )
+        return 0;
+    try
+    {
+        ProcData* pd = imp->resolveFromHost(module, proc);
+        imp->out.flush();
+        return pd;
+    }catch(const QString& str)
+    {
+        imp->out.flush();
+        imp->resetStack();
+        imp->error = str;
+    }
+    return 0;
+}
+
+QVariant MilInterpreter::call(Proc proc, const QVariantList& args)
+{
+    HeapScope scope(&imp->heap);
+    return imp->call(proc, args, 0);
+}
+
+QVariant MilInterpreter::call(Proc proc, QVariantList& args)
+{
+    HeapScope scope(&imp->heap);
+    return imp->call(proc, args, &args);
+}
+
+QVariant MilInterpreter::variable(const QByteArray& module, const QByteArray& name)
+{
+    HeapScope scope(&imp->heap);
+    imp->error.clear();
+    if( !imp->enterFromHost() )
+        return QVariant();
+    try
+    {
+        QVariant res = imp->getFromHost(module, name);
+        imp->out.flush();
+        return res;
+    }catch(const QString& str)
+    {
+        imp->out.flush();
+        imp->resetStack();
+        imp->error = str;
+    }
+    return QVariant();
+}
+
+bool MilInterpreter::setVariable(const QByteArray& module, const QByteArray& name, const QVariant& value)
+{
+    HeapScope scope(&imp->heap);
+    imp->error.clear();
+    if( !imp->enterFromHost() )
+        return false;
+    try
+    {
+        imp->setFromHost(module, name, value);
+        imp->out.flush();
+    }catch(const QString& str)
+    {
+        imp->out.flush();
+        imp->resetStack();
+        imp->error = str;
+    }
+    return imp->error.isEmpty();
 }
 
+QString MilInterpreter::error() const
+{
+    return imp->error;
+}
@@ -21,16 +21,39 @@
 */
 
 #include "MicMilLoader.h"
+#include <QVariant>
 
 namespace Mic
 {
 class MilInterpreter
 {
+    // Interpreters share nothing but the modules of the loader, which they only read, so each one
+    // can run on its own thread; an interpreter must only be used by one thread at a time.
 public:
+    enum Engine { StackEngine, RegisterEngine };
     MilInterpreter(MilLoader*);
     ~MilInterpreter();
 
     void run(const QByteArray& module);
+    void setStackSize(quint32 slots); // limits the call depth, default 256k slots
+    void setReport(bool on); // print the fused and remaining op sequences after run
+    void setEngine(Engine); // RegisterEngine: translate the procedures to register form before running
+    void setJit(bool on); // compile hot procedures to native code, x86-64 only; implies the register form
+    void setCompiler(const QString& cc); // translate hot procedures to C and run them compiled by cc, empty: off
+    bool addLibrary(const QString& path); // EXTERN procedures not built in are looked up in the added libraries
+
+    // Embedding: modules stay loaded and procedures prepared between the calls. Arguments and results are
+    // integers, reals and strings (ARRAY OF CHAR); POINTER TO scalar parameters get a temporary variable.
+    // On failure the functions return an invalid or false value and error() tells why. The functions must
+    // not be called while the interpreter runs, e.g. from an EXTERN procedure bound to the host.
+    typedef void* Proc;
+    bool load(const QByteArray& module); // loads and initializes module unless already done
+    Proc resolve(const QByteArray& module, const QByteArray& proc); // an exported procedure, or 0
+    QVariant call(Proc, const QVariantList& args = QVariantList()); // fails for POINTER TO scalar parameters
+    QVariant call(Proc, QVariantList& args); // the values behind POINTER TO scalar parameters are copied back
+    QVariant variable(const QByteArray& module, const QByteArray& name); // an exported variable
+    bool setVariable(const QByteArray& module, const QByteArray& name, const QVariant& value);
+    QString error() const; // of the last of the above calls, empty if it succeeded
 private:
     class Imp;
     Imp* imp;
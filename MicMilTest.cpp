@@ -0,0 +1,1032 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Micron language project.
+*
+* The following is the license that applies to this copy of the
+* file. For a license to use the file under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+// Runs hand-written MIL through the MilInterpreter API with each engine; the modules are emitted directly,
+// so they can contain operand types and op sequences the Micron frontend never produces at one site
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QThread>
+#include <QtDebug>
+#include <MicToken.h>
+#include <MicMilEmitter.h>
+#include <MicMilLoader.h>
+#include <MicMilInterpreter.h>
+#include <string.h>
+using namespace Mic;
+
+static int failed = 0;
+static QByteArray engine;
+
+static void check(const MilInterpreter& intp, bool ok, const QByteArray& what, const QVariant& res = QVariant())
+{
+    qDebug() << (ok ? "ok  " : "FAIL") << engine.constData() << what.constData() << res.toString() << intp.error();
+    if( !ok )
+        failed++;
+}
+
+static MilQuali local(const char* name)
+{
+    return qMakePair(QByteArray(), Token::getSymbol(name));
+}
+
+static void beginProc(MilEmitter& e, const char* name, int params, const char* ret = "float64")
+{
+    // an exported procedure with int32 parameters
+    e.beginProc(Token::getSymbol(name));
+    for( int i = 0; i < params; i++ )
+        e.addArgument(local("int32"), Token::getSymbol(QByteArray("p") + QByteArray::number(i)));
+    if( ret )
+        e.setReturnType(local(ret));
+}
+
+static void operand(MilEmitter& e, qint32 i, qint32 u, double f)
+{
+    // pushes i as int32 if the first argument is 0, u as uint32 if it is 1, f as float64 otherwise
+    e.iif_();
+    e.ldarg_(0);
+    e.ldc_i4(0);
+    e.ceq_();
+    e.then_();
+    e.ldc_i4(i);
+    e.else_();
+    e.iif_();
+    e.ldarg_(0);
+    e.ldc_i4(1);
+    e.ceq_();
+    e.then_();
+    e.ldc_i4(u);
+    e.conv_(MilEmitter::U4);
+    e.else_();
+    e.ldc_r8(f);
+    e.end_();
+    e.end_();
+}
+
+// Quicken: one arithmetic or comparison site sees int32, uint32 and float64 operands in turn; the quickened
+// variant of the first type must give way to the generic op for the others
+
+enum { I = 0, U = 1, F = 2 };
+static const qint32 BigU = -294967296; // 4000000000 as uint32
+
+static void emitBinary(MilEmitter& e, const char* name, qint32 i1, qint32 u1, double f1, qint32 i2, qint32 u2, double f2)
+{
+    // one copy per first type, so that each quickened variant is tried
+    for( int t = I; t <= F; t++ )
+    {
+        beginProc(e, (QByteArray(name) + "IUF"[t]).constData(), 1);
+        operand(e, i1, u1, f1);
+        operand(e, i2, u2, f2);
+        switch( name[0] )
+        {
+        case 'A':
+            e.add_();
+            break;
+        case 'S':
+            e.sub_();
+            break;
+        case 'M':
+            e.mul_();
+            break;
+        case 'D':
+            e.div_();
+            break;
+        case 'R':
+            e.rem_();
+            break;
+        case 'L':
+            e.clt_();
+            break;
+        case 'G':
+            e.cgt_();
+            break;
+        }
+        e.conv_(MilEmitter::R8);
+        e.ret_(true);
+        e.endProc();
+    }
+}
+
+static void emitQuicken(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Quicken"), "Quicken");
+    emitBinary(e, "Add", -40, BigU, 40.5, 3, 1, 1.25);
+    emitBinary(e, "Sub", -40, BigU, 40.5, 3, 1, 1.25);
+    emitBinary(e, "Mul", -40, BigU, 40.5, 3, 1, 1.25);
+    emitBinary(e, "Div", -40, 0, 40.5, 3, 0, 1.25); // uint32 has div_un
+    emitBinary(e, "Rem", 40, BigU, 0, 3, 7, 0); // float64 has none
+    emitBinary(e, "Lt", -40, BigU, 40.5, 3, 3, 1.25);
+    emitBinary(e, "Gt", -40, BigU, 40.5, 3, 3, 1.25);
+    e.endModule();
+}
+
+static void runQuicken(MilInterpreter& intp)
+{
+    if( !intp.load("Quicken") )
+    {
+        check(intp, false, "load Quicken");
+        return;
+    }
+    const double big = 4000000000.0;
+    struct { const char* name; const char* types; double res[3]; } cases[] = {
+        { "Add", "IUF", { -37, big + 1, 41.75 } },
+        { "Sub", "IUF", { -43, big - 1, 39.25 } },
+        { "Mul", "IUF", { -120, big, 50.625 } },
+        { "Div", "IF", { -13, 0, 32.4 } },
+        { "Rem", "IU", { 1, 3, 0 } },
+        { "Lt", "IUF", { 1, 0, 0 } },
+        { "Gt", "IUF", { 0, 1, 1 } },
+    };
+    for( int c = 0; c < 7; c++ )
+    {
+        for( int first = I; first <= F; first++ )
+        {
+            if( strchr(cases[c].types, "IUF"[first]) == 0 )
+                continue;
+            // the first type twice, so that it runs quickened, then the others, then the first again
+            QList<int> order;
+            order << first << first;
+            for( int t = I; t <= F; t++ )
+                if( t != first && strchr(cases[c].types, "IUF"[t]) )
+                    order << t << t;
+            order << first;
+            const QByteArray name = QByteArray(cases[c].name) + "IUF"[first];
+            MilInterpreter::Proc p = intp.resolve("Quicken", name);
+            for( int i = 0; i < order.size(); i++ )
+            {
+                const int t = order[i];
+                const QVariant res = intp.call(p, QVariantList() << t);
+                check(intp, intp.error().isEmpty() && res.toDouble() == cases[c].res[t],
+                      name + " " + "IUF"[t], res);
+            }
+        }
+    }
+}
+
+// Fused: the op sequences replaced by superinstructions, with int32 and uint32 locals at the same sites
+
+static MilTrident field(const char* type, const char* name)
+{
+    return qMakePair(local(type), Token::getSymbol(name));
+}
+
+static void incr(MilEmitter& e, int loc, int by)
+{
+    // ldloca, ldloc, ldc_i4, add|sub, stind, i.e. incloc or decloc
+    e.ldloca_(loc);
+    e.ldloc_(loc);
+    e.ldc_i4(by < 0 ? -by : by);
+    if( by < 0 )
+        e.sub_();
+    else
+        e.add_();
+    e.stind_(MilEmitter::I4);
+}
+
+static void emitFused(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Fused"), "Fused");
+    e.addVariable(local("int32"), Token::getSymbol("calls"));
+    e.addVariable(local("int32"), Token::getSymbol("hits"));
+    e.addVariable(local("int32"), Token::getSymbol("rest"));
+    e.beginType(Token::getSymbol("Pair"));
+    e.addField(Token::getSymbol("a"), local("int32"));
+    e.addField(Token::getSymbol("b"), local("int32"));
+    e.endType();
+    e.addType(Token::getSymbol("PairPtr"), true, local("Pair"), MilEmitter::Pointer);
+
+    // Loop(k, n): the sum of 0 .. n-1 plus 5, with int32 locals if k is 0, uint32 locals if k is 1
+    beginProc(e, "Loop", 2);
+    const int i = e.addLocal(local("int32"), Token::getSymbol("i"));
+    const int sum = e.addLocal(local("int32"), Token::getSymbol("sum"));
+    const int lim = e.addLocal(local("int32"), Token::getSymbol("lim"));
+    for( int j = 0; j < 3; j++ )
+    {
+        // i := 0; sum := 0; lim := n, converted to uint32 if k is 1
+        e.iif_();
+        e.ldarg_(0);
+        e.ldc_i4(0);
+        e.ceq_();
+        e.then_();
+        j == 2 ? e.ldarg_(1) : e.ldc_i4(0);
+        e.else_();
+        j == 2 ? e.ldarg_(1) : e.ldc_i4(0);
+        e.conv_(MilEmitter::U4);
+        e.end_();
+        e.stloc_(j == 0 ? i : j == 1 ? sum : lim);
+    }
+    e.while_();
+    e.ldloc_(i);
+    e.ldloc_(lim);
+    e.clt_(); // clt_brfalse
+    e.do_();
+    e.ldloca_(sum);
+    e.ldloc_(sum);
+    e.ldloc_(i);
+    e.add_();
+    e.stind_(MilEmitter::I4);
+    e.if_();
+    e.ldloc_(i);
+    e.ldc_i4(5);
+    e.ceq_(); // ceq_brfalse
+    e.then_();
+    e.ldvara_(local("hits"));
+    e.ldvar_(local("hits"));
+    e.ldc_i4(1);
+    e.add_();
+    e.stind_(MilEmitter::I4); // incvar
+    e.end_();
+    e.if_();
+    e.ldloc_(i);
+    e.ldc_i4(2);
+    e.cgt_();
+    e.ldc_i4(0);
+    e.ceq_(); // cgt_brtrue
+    e.then_();
+    e.ldvara_(local("hits"));
+    e.ldvar_(local("hits"));
+    e.ldc_i4(10);
+    e.add_();
+    e.stind_(MilEmitter::I4);
+    e.end_();
+    e.ldvara_(local("calls"));
+    e.ldvar_(local("calls"));
+    e.ldc_i4(3);
+    e.add_();
+    e.stind_(MilEmitter::I4);
+    incr(e, i, 1);
+    e.end_();
+    // count down by two and leave the remainder in rest
+    e.while_();
+    e.ldloc_(i);
+    e.ldc_i4(2);
+    e.clt_();
+    e.ldc_i4(0);
+    e.ceq_(); // clt_brtrue
+    e.do_();
+    incr(e, i, -2);
+    e.ldvara_(local("calls"));
+    e.ldvar_(local("calls"));
+    e.ldc_i4(1);
+    e.sub_();
+    e.stind_(MilEmitter::I4); // decvar
+    e.end_();
+    e.ldloc_(i);
+    e.conv_(MilEmitter::I4);
+    e.stvar_(local("rest"));
+    e.if_();
+    e.ldloc_(i);
+    e.ldc_i4(1);
+    e.ceq_();
+    e.ldc_i4(0);
+    e.ceq_(); // ceq_brtrue
+    e.then_();
+    e.ldvara_(local("rest"));
+    e.ldvar_(local("rest"));
+    e.ldc_i4(100);
+    e.add_();
+    e.stind_(MilEmitter::I4);
+    e.end_();
+    e.ldloc_(sum);
+    e.ldc_i4(7);
+    e.add_(); // addi
+    e.ldc_i4(2);
+    e.sub_(); // subi
+    e.conv_(MilEmitter::R8);
+    e.ret_(true);
+    e.endProc();
+
+    // Second(p): p.b, with ldarg_ldfld
+    e.beginProc(Token::getSymbol("Second"), false);
+    e.addArgument(local("PairPtr"), Token::getSymbol("p"));
+    e.setReturnType(local("int32"));
+    e.ldarg_(0);
+    e.ldfld_(field("Pair", "b"));
+    e.ret_(true);
+    e.endProc();
+
+    // Pairs(n): Second of a local record with a = n, b = n * 2
+    beginProc(e, "Pairs", 1, "int32");
+    const int v = e.addLocal(local("Pair"), Token::getSymbol("v"));
+    e.ldloca_(v);
+    e.ldflda_(field("Pair", "a"));
+    e.ldarg_(0);
+    e.stind_(MilEmitter::I4);
+    e.ldloca_(v);
+    e.ldflda_(field("Pair", "b"));
+    e.ldarg_(0);
+    e.ldc_i4(2);
+    e.mul_();
+    e.stind_(MilEmitter::I4);
+    e.ldloca_(v);
+    e.call_(local("Second"), 1, true);
+    e.ret_(true);
+    e.endProc();
+    e.endModule();
+}
+
+static void runFused(MilInterpreter& intp)
+{
+    if( !intp.load("Fused") )
+    {
+        check(intp, false, "load Fused");
+        return;
+    }
+    MilInterpreter::Proc loop = intp.resolve("Fused", "Loop");
+    // int32 twice, then uint32, then back; the long run compiles Loop if the JIT is on
+    const int runs[][2] = { { I, 10 }, { I, 10 }, { U, 10 }, { U, 7 }, { I, 0 }, { U, 1 }, { I, 3000 }, { U, 3001 } };
+    for( int r = 0; r < 8; r++ )
+    {
+        const int k = runs[r][0];
+        const qint64 n = runs[r][1];
+        intp.setVariable("Fused", "calls", 0);
+        intp.setVariable("Fused", "hits", 0);
+        const QByteArray what = QByteArray("Loop ") + "IU"[k] + " " + QByteArray::number(n);
+        QVariant res = intp.call(loop, QVariantList() << k << n);
+        check(intp, intp.error().isEmpty() && res.toDouble() == n * (n - 1) / 2 + 5, what + " sum", res);
+        res = intp.variable("Fused", "hits");
+        check(intp, res.toInt() == ( n > 5 ? 1 : 0 ) + 10 * qMin(n, qint64(3)), what + " hits", res);
+        res = intp.variable("Fused", "calls");
+        check(intp, res.toInt() == 3 * n - n / 2, what + " calls", res);
+        res = intp.variable("Fused", "rest");
+        check(intp, res.toInt() == ( n % 2 == 1 ? 1 : 100 ), what + " rest", res);
+    }
+    MilInterpreter::Proc pairs = intp.resolve("Fused", "Pairs");
+    for( int n = -2; n < 3; n++ )
+    {
+        const QVariant res = intp.call(pairs, QVariantList() << n);
+        check(intp, intp.error().isEmpty() && res.toInt() == n * 2, "Pairs " + QByteArray::number(n), res);
+    }
+}
+
+// Fallback: shapes the register form can't read in place, which stay stack ops in the same dispatch loop
+
+enum { ManyLocals = 0x8001, ManyConsts = 0x8100 };
+
+static void emitFallback(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Fallback"), "Fallback");
+    const char* vars[] = { "x", "y", "z", "ra", "rb", "rc", "rd" };
+    for( int i = 0; i < 7; i++ )
+        e.addVariable(local("int32"), Token::getSymbol(vars[i]));
+
+    beginProc(e, "Odd", 1, "int32");
+    e.ldarg_(0);
+    e.ldc_i4(2);
+    e.rem_();
+    e.ret_(true);
+    e.endProc();
+
+    beginProc(e, "Mix", 1, "int32");
+    const int a = e.addLocal(local("int32"), Token::getSymbol("a"));
+    const int b = e.addLocal(local("int32"), Token::getSymbol("b"));
+    const int c = e.addLocal(local("int32"), Token::getSymbol("c"));
+    e.ldarg_(0);
+    e.stvar_(local("x"));
+    e.ldc_i4(3);
+    e.stvar_(local("y"));
+    // z := x + y, operands in two different variables
+    e.ldvar_(local("x"));
+    e.ldvar_(local("y"));
+    e.add_();
+    e.stvar_(local("z"));
+    // a := Odd(n), the result of a call
+    e.ldarg_(0);
+    e.call_(local("Odd"), 1, true);
+    e.stloc_(a);
+    // if Odd(n) then b := 100 else b := 200, a branch on the result of a call
+    e.if_();
+    e.ldarg_(0);
+    e.call_(local("Odd"), 1, true);
+    e.then_();
+    e.ldc_i4(100);
+    e.stloc_(b);
+    e.else_();
+    e.ldc_i4(200);
+    e.stloc_(b);
+    e.end_();
+    // c := ~(n < 5), a negated comparison which is stored instead of branched on
+    e.ldarg_(0);
+    e.ldc_i4(5);
+    e.clt_();
+    e.ldc_i4(0);
+    e.ceq_();
+    e.stloc_(c);
+    e.ldloc_(a);
+    e.stvar_(local("ra"));
+    e.ldloc_(b);
+    e.stvar_(local("rb"));
+    e.ldloc_(c);
+    e.stvar_(local("rc"));
+    // rd := (n > 4 ? n * 2 : n - 1) + x * y, jump targets within the expression
+    e.iif_();
+    e.ldarg_(0);
+    e.ldc_i4(4);
+    e.cgt_();
+    e.then_();
+    e.ldarg_(0);
+    e.ldc_i4(2);
+    e.mul_();
+    e.else_();
+    e.ldarg_(0);
+    e.ldc_i4(1);
+    e.sub_();
+    e.end_();
+    e.ldvar_(local("x"));
+    e.ldvar_(local("y"));
+    e.mul_();
+    e.add_();
+    e.stvar_(local("rd"));
+    e.ldvar_(local("z"));
+    e.ldloc_(a);
+    e.add_();
+    e.ldloc_(b);
+    e.add_();
+    e.ldloc_(c);
+    e.add_();
+    e.ret_(true);
+    e.endProc();
+
+    // Repeat(n): the sum of Mix(i mod 10) for i in 0 .. n-1, long enough for the JIT
+    beginProc(e, "Repeat", 1, "int32");
+    const int i = e.addLocal(local("int32"), Token::getSymbol("i"));
+    const int sum = e.addLocal(local("int32"), Token::getSymbol("sum"));
+    e.ldc_i4(0);
+    e.stloc_(i);
+    e.ldc_i4(0);
+    e.stloc_(sum);
+    e.while_();
+    e.ldloc_(i);
+    e.ldarg_(0);
+    e.clt_();
+    e.do_();
+    e.ldloc_(sum);
+    e.ldloc_(i);
+    e.ldc_i4(10);
+    e.rem_();
+    e.call_(local("Mix"), 1, true);
+    e.add_();
+    e.stloc_(sum);
+    incr(e, i, 1);
+    e.end_();
+    e.ldloc_(sum);
+    e.ret_(true);
+    e.endProc();
+
+    // Far(n): the last of ManyLocals locals is beyond the slots the register form can address
+    beginProc(e, "Far", 1, "int32");
+    for( int j = 0; j < ManyLocals; j++ )
+        e.addLocal(local("int32"));
+    e.ldarg_(0);
+    e.stloc_(ManyLocals - 1);
+    e.ldloc_(ManyLocals - 1);
+    e.ldloc_(ManyLocals - 1);
+    e.mul_();
+    e.ldloc_(0);
+    e.add_();
+    e.ret_(true);
+    e.endProc();
+
+    // Consts(n): n xor 1 xor 2 .. xor ManyConsts, more constants than the register form can address
+    beginProc(e, "Consts", 1, "int32");
+    e.ldarg_(0);
+    for( int j = 1; j <= ManyConsts; j++ )
+    {
+        e.ldc_i4(j);
+        e.xor_();
+    }
+    e.ret_(true);
+    e.endProc();
+    e.endModule();
+}
+
+static void runFallback(MilInterpreter& intp)
+{
+    if( !intp.load("Fallback") )
+    {
+        check(intp, false, "load Fallback");
+        return;
+    }
+    MilInterpreter::Proc mix = intp.resolve("Fallback", "Mix");
+    qint32 total = 0;
+    for( int n = 0; n < 10; n++ )
+    {
+        const int z = n + 3, a = n % 2, b = a ? 100 : 200, c = n < 5 ? 0 : 1;
+        const int d = ( n > 4 ? n * 2 : n - 1 ) + n * 3;
+        total += z + a + b + c;
+        const QByteArray what = "Mix " + QByteArray::number(n);
+        QVariant res = intp.call(mix, QVariantList() << n);
+        check(intp, intp.error().isEmpty() && res.toInt() == z + a + b + c, what, res);
+        res = intp.variable("Fallback", "z");
+        check(intp, res.toInt() == z, what + " z", res);
+        res = intp.variable("Fallback", "ra");
+        check(intp, res.toInt() == a, what + " a", res);
+        res = intp.variable("Fallback", "rb");
+        check(intp, res.toInt() == b, what + " b", res);
+        res = intp.variable("Fallback", "rc");
+        check(intp, res.toInt() == c, what + " c", res);
+        res = intp.variable("Fallback", "rd");
+        check(intp, res.toInt() == d, what + " d", res);
+    }
+    QVariant res = intp.call(intp.resolve("Fallback", "Repeat"), QVariantList() << 3000);
+    check(intp, intp.error().isEmpty() && res.toInt() == total * 300, "Repeat 3000", res);
+    res = intp.call(intp.resolve("Fallback", "Far"), QVariantList() << 7);
+    check(intp, intp.error().isEmpty() && res.toInt() == 49, "Far 7", res);
+    qint32 x = 5;
+    for( int j = 1; j <= ManyConsts; j++ )
+        x ^= j;
+    res = intp.call(intp.resolve("Fallback", "Consts"), QVariantList() << 5);
+    check(intp, intp.error().isEmpty() && res.toInt() == x, "Consts 5", res);
+}
+
+// Literals: quoted ldstr operands have no terminating zero of their own, unlike the hex ones Micron emits
+// for string constants; the interpreter must add one, also when the next literal follows directly
+
+static void emitLiterals(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Literals"), "Literals");
+    const char* names[] = { "First", "Second" };
+    const char* strs[] = { "abc", "defgh" };
+    for( int i = 0; i < 2; i++ )
+    {
+        // the char at index p0 of the literal
+        beginProc(e, names[i], 1, "int32");
+        e.ldstr_(strs[i]);
+        e.ldarg_(0);
+        e.ldelem_(local("uint8"));
+        e.conv_(MilEmitter::I4);
+        e.ret_(true);
+        e.endProc();
+    }
+    e.endModule();
+}
+
+static void runLiterals(MilInterpreter& intp)
+{
+    if( !intp.load("Literals") )
+    {
+        check(intp, false, "load Literals");
+        return;
+    }
+    MilInterpreter::Proc first = intp.resolve("Literals", "First");
+    QVariant res = intp.call(first, QVariantList() << 2);
+    check(intp, intp.error().isEmpty() && res.toInt() == 'c', "First 2", res);
+    res = intp.call(first, QVariantList() << 3);
+    check(intp, intp.error().isEmpty() && res.toInt() == 0, "First 3 is the terminator", res);
+    res = intp.call(intp.resolve("Literals", "Second"), QVariantList() << 5);
+    check(intp, intp.error().isEmpty() && res.toInt() == 0, "Second 5 is the terminator", res);
+}
+
+// Sizes: sizeof gives the layout a C compiler gives the same declarations, checked against the mirror
+// types below; padding, a union, arrays of records, bit fields and the flattened fields of an object
+
+struct PaddedC { quint8 c; qint32 i; quint8 b; double d; qint16 s; };
+struct TailC { double d; quint8 c; };
+struct SmallC { quint8 a, b; qint16 s; };
+union VarC { qint32 i; double r; quint8 str[3]; };
+struct BitsC { quint32 a : 3; quint32 b : 5; quint32 c : 24; quint8 d; quint16 e : 4; };
+struct MixedC { quint8 d; quint16 e : 4; quint8 f; };
+struct WideC { quint32 a : 30; quint32 b : 4; };
+struct NodeC { const void* cls; qint32 a; };
+struct LeafC { const void* cls; qint32 a; qint32 b; };
+
+static const struct { const char* type; quint32 size; } sizes[] = {
+    { "Padded", sizeof(PaddedC) },
+    { "Tail", sizeof(TailC) },
+    { "Small", sizeof(SmallC) },
+    { "Var", sizeof(VarC) },
+    { "Padded5", sizeof(PaddedC[5]) },
+    { "Small3", sizeof(SmallC[3]) },
+    { "Bits", sizeof(BitsC) },
+    { "Bits3", sizeof(BitsC[3]) },
+    { "Mixed", sizeof(MixedC) },
+    { "Wide", sizeof(WideC) },
+    { "Node", sizeof(NodeC) },
+    { "Leaf", sizeof(LeafC) },
+};
+
+static void addFields(MilEmitter& e, const char* fields)
+{
+    // "name type [bits]" separated by commas
+    foreach( const QByteArray& f, QByteArray(fields).split(',') )
+    {
+        const QList<QByteArray> parts = f.trimmed().split(' ');
+        e.addField(Token::getSymbol(parts[0]), local(parts[1].constData()), true,
+                parts.size() > 2 ? parts[2].toUInt() : 0);
+    }
+}
+
+static void emitSizes(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Sizes"), "Sizes");
+    e.beginType(Token::getSymbol("Padded"));
+    addFields(e, "c uint8, i int32, b uint8, d float64, s int16");
+    e.endType();
+    e.beginType(Token::getSymbol("Tail"));
+    addFields(e, "d float64, c uint8");
+    e.endType();
+    e.beginType(Token::getSymbol("Small"));
+    addFields(e, "a uint8, b uint8, s int16");
+    e.endType();
+    e.addType(Token::getSymbol("Str3"), true, local("uint8"), MilEmitter::Array, 3);
+    e.beginType(Token::getSymbol("Var"), true, MilEmitter::Union);
+    addFields(e, "i int32, r float64, str Str3");
+    e.endType();
+    e.addType(Token::getSymbol("Padded5"), true, local("Padded"), MilEmitter::Array, 5);
+    e.addType(Token::getSymbol("Small3"), true, local("Small"), MilEmitter::Array, 3);
+    e.beginType(Token::getSymbol("Bits"));
+    addFields(e, "a uint32 3, b uint32 5, c uint32 24, d uint8, e uint16 4");
+    e.endType();
+    e.addType(Token::getSymbol("Bits3"), true, local("Bits"), MilEmitter::Array, 3);
+    e.beginType(Token::getSymbol("Mixed"));
+    addFields(e, "d uint8, e uint16 4, f uint8");
+    e.endType();
+    e.beginType(Token::getSymbol("Wide"));
+    addFields(e, "a uint32 30, b uint32 4");
+    e.endType();
+    e.beginType(Token::getSymbol("Node"), true, MilEmitter::Object);
+    addFields(e, "a int32");
+    e.endType();
+    e.beginType(Token::getSymbol("Leaf"), true, MilEmitter::Object, local("Node"));
+    addFields(e, "b int32");
+    e.endType();
+
+    for( uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ )
+    {
+        beginProc(e, (QByteArray("Size") + sizes[i].type).constData(), 0, "int32");
+        e.sizeof_(local(sizes[i].type));
+        e.ret_(true);
+        e.endProc();
+    }
+    e.endModule();
+}
+
+static void runSizes(MilInterpreter& intp)
+{
+    if( !intp.load("Sizes") )
+    {
+        check(intp, false, "load Sizes");
+        return;
+    }
+    for( uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ )
+    {
+        const QByteArray name = QByteArray("Size") + sizes[i].type;
+        const QVariant res = intp.call(intp.resolve("Sizes", name), QVariantList());
+        check(intp, intp.error().isEmpty() && res.toUInt() == sizes[i].size,
+              name + " " + QByteArray::number(sizes[i].size), res);
+    }
+}
+
+// Dispatch: one callvirt site and one ldmeth site see receivers of two types in turn, heap objects
+// and object variables, so the call site caches must miss and refill each time
+
+static void emitMethod(MilEmitter& e, const char* type, const char* ptr, int add)
+{
+    // type.Get(): add + SELF.v
+    e.beginProc(Token::getSymbol("Get"), true, MilProcedure::Normal, Token::getSymbol(type));
+    e.addArgument(local(ptr), Token::getSymbol("SELF"));
+    e.setReturnType(local("int32"));
+    e.ldc_i4(add);
+    if( add )
+    {
+        e.ldarg_(0);
+        e.ldfld_(field(type, "v"));
+        e.add_();
+    }
+    e.ret_(true);
+    e.endProc();
+}
+
+static void receiver(MilEmitter& e)
+{
+    // pushes the heap object l if the first argument is 0, r if 1, the variable vl if 2, vr otherwise
+    e.iif_();
+    e.ldarg_(0);
+    e.ldc_i4(2);
+    e.clt_();
+    e.then_();
+    e.iif_();
+    e.ldarg_(0);
+    e.ldc_i4(0);
+    e.ceq_();
+    e.then_();
+    e.ldvar_(local("l"));
+    e.else_();
+    e.ldvar_(local("r"));
+    e.end_();
+    e.else_();
+    e.iif_();
+    e.ldarg_(0);
+    e.ldc_i4(2);
+    e.ceq_();
+    e.then_();
+    e.ldvara_(local("vl"));
+    e.else_();
+    e.ldvara_(local("vr"));
+    e.end_();
+    e.end_();
+}
+
+static void setField(MilEmitter& e, bool heap, const char* var, const char* type, int v)
+{
+    if( heap )
+        e.ldvar_(local(var));
+    else
+        e.ldvara_(local(var));
+    e.ldflda_(field(type, "v"));
+    e.ldc_i4(v);
+    e.stind_(MilEmitter::I4);
+}
+
+static void emitDispatch(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Dispatch"), "Dispatch");
+    e.beginType(Token::getSymbol("Base"), true, MilEmitter::Object);
+    e.addField(Token::getSymbol("v"), local("int32"));
+    e.endType();
+    e.addType(Token::getSymbol("BasePtr"), true, local("Base"), MilEmitter::Pointer);
+    emitMethod(e, "Base", "BasePtr", 0);
+    const char* subs[] = { "Left", "Right" };
+    for( int i = 0; i < 2; i++ )
+    {
+        e.beginType(Token::getSymbol(subs[i]), true, MilEmitter::Object, local("Base"));
+        e.endType();
+        const QByteArray ptr = QByteArray(subs[i]) + "Ptr";
+        e.addType(Token::getSymbol(ptr), true, local(subs[i]), MilEmitter::Pointer);
+        emitMethod(e, subs[i], ptr.constData(), ( i + 1 ) * 100);
+    }
+    e.beginType(Token::getSymbol("GetRef"), true, MilEmitter::MethType);
+    e.setReturnType(local("int32"));
+    e.endType();
+    e.addVariable(local("LeftPtr"), Token::getSymbol("l"));
+    e.addVariable(local("RightPtr"), Token::getSymbol("r"));
+    e.addVariable(local("Left"), Token::getSymbol("vl"));
+    e.addVariable(local("Right"), Token::getSymbol("vr"));
+
+    // the objects with v set through the field inherited from Base
+    e.beginProc(Token::getSymbol("begin$"), false, MilProcedure::ModuleInit);
+    e.newobj_(local("Left"));
+    e.stvar_(local("l"));
+    e.newobj_(local("Right"));
+    e.stvar_(local("r"));
+    setField(e, true, "l", "Left", 1);
+    setField(e, true, "r", "Right", 2);
+    setField(e, false, "vl", "Left", 3);
+    setField(e, false, "vr", "Right", 4);
+    e.endProc();
+
+    beginProc(e, "Call", 1, "int32");
+    receiver(e);
+    e.callvirt_(field("Base", "Get"), 1, true);
+    e.ret_(true);
+    e.endProc();
+
+    beginProc(e, "Meth", 1, "int32");
+    receiver(e);
+    e.ldmeth_(field("Base", "Get"));
+    e.callvi_(local("GetRef"), 0, true);
+    e.ret_(true);
+    e.endProc();
+    e.endModule();
+}
+
+static void runDispatch(MilInterpreter& intp)
+{
+    if( !intp.load("Dispatch") )
+    {
+        check(intp, false, "load Dispatch");
+        return;
+    }
+    const int expected[] = { 101, 202, 103, 204 };
+    const char* procs[] = { "Call", "Meth" };
+    for( int p = 0; p < 2; p++ )
+    {
+        MilInterpreter::Proc proc = intp.resolve("Dispatch", procs[p]);
+        // alternate the receiver types, and keep one for a while so the cache hits
+        const int order[] = { 0, 1, 0, 1, 1, 1, 0, 0, 2, 3, 2, 3, 0, 3, 1, 2 };
+        for( int i = 0; i < 16; i++ )
+        {
+            const int k = order[i];
+            const QVariant res = intp.call(proc, QVariantList() << k);
+            check(intp, intp.error().isEmpty() && res.toInt() == expected[k],
+                  QByteArray(procs[p]) + " " + QByteArray::number(k), res);
+        }
+    }
+}
+
+// Heap: allocates and frees sequences of different sizes in a loop, so interpreters on different threads
+// would hand out the same slots if they shared the free lists
+
+static void emitHeap(MilEmitter& e)
+{
+    e.beginModule(Token::getSymbol("Heap"), "Heap");
+    e.addType(Token::getSymbol("Vec"), true, local("int32"), MilEmitter::Array);
+    e.addType(Token::getSymbol("VecPtr"), true, local("Vec"), MilEmitter::Pointer);
+    e.beginType(Token::getSymbol("Pair"));
+    e.addField(Token::getSymbol("a"), local("int32"));
+    e.addField(Token::getSymbol("b"), local("int32"));
+    e.endType();
+    e.addType(Token::getSymbol("PairPtr"), true, local("Pair"), MilEmitter::Pointer);
+
+    // Churn(n): the sum of 0 .. n-1, each value stored in a fresh array and record before it is added
+    beginProc(e, "Churn", 1, "int32");
+    const int i = e.addLocal(local("int32"), Token::getSymbol("i"));
+    const int sum = e.addLocal(local("int32"), Token::getSymbol("sum"));
+    const int v = e.addLocal(local("VecPtr"), Token::getSymbol("v"));
+    const int q = e.addLocal(local("PairPtr"), Token::getSymbol("q"));
+    e.ldc_i4(0);
+    e.stloc_(i);
+    e.ldc_i4(0);
+    e.stloc_(sum);
+    e.while_();
+    e.ldloc_(i);
+    e.ldarg_(0);
+    e.clt_();
+    e.do_();
+    // v := new(Vec, i mod 7 + 1); v[i mod 7] := i
+    e.ldloc_(i);
+    e.ldc_i4(7);
+    e.rem_();
+    e.ldc_i4(1);
+    e.add_();
+    e.newarr_(local("int32"));
+    e.stloc_(v);
+    e.ldloc_(v);
+    e.ldloc_(i);
+    e.ldc_i4(7);
+    e.rem_();
+    e.ldelema_(local("int32"));
+    e.ldloc_(i);
+    e.stind_(MilEmitter::I4);
+    // q := new(Pair); q.b := v[i mod 7]
+    e.newobj_(local("Pair"));
+    e.stloc_(q);
+    e.ldloc_(q);
+    e.ldflda_(field("Pair", "b"));
+    e.ldloc_(v);
+    e.ldloc_(i);
+    e.ldc_i4(7);
+    e.rem_();
+    e.ldelem_(local("int32"));
+    e.stind_(MilEmitter::I4);
+    // sum := sum + q.b
+    e.ldloc_(sum);
+    e.ldloc_(q);
+    e.ldfld_(field("Pair", "b"));
+    e.add_();
+    e.stloc_(sum);
+    e.ldloc_(v);
+    e.free_();
+    e.ldloc_(q);
+    e.free_();
+    incr(e, i, 1);
+    e.end_();
+    e.ldloc_(sum);
+    e.ret_(true);
+    e.endProc();
+    e.endModule();
+}
+
+static const struct { const char* name; MilInterpreter::Engine engine; bool jit; } engines[] = {
+    { "stack", MilInterpreter::StackEngine, false },
+    { "reg", MilInterpreter::RegisterEngine, false },
+    { "jit", MilInterpreter::RegisterEngine, true },
+};
+
+// Parallel: interpreters on separate threads share the modules of one loader; each must compute what
+// a single interpreter computes, with its own heap, frames and compiled code
+
+static QByteArray workload(MilInterpreter& intp)
+{
+    // the results of calls into all modules as one string, errors included
+    QByteArray res;
+    const char* modules[] = { "Quicken", "Fused", "Fallback", "Dispatch", "Literals", "Heap" };
+    for( int i = 0; i < 6; i++ )
+        if( !intp.load(modules[i]) )
+            return intp.error().toUtf8();
+    struct { const char* module; const char* proc; int from, to; qint64 arg2; } calls[] = {
+        { "Quicken", "AddI", I, F, 0 },
+        { "Quicken", "MulF", I, F, 0 },
+        { "Fused", "Loop", I, U, 3000 },
+        { "Fused", "Pairs", -2, 2, 0 },
+        { "Fallback", "Mix", 0, 9, 0 },
+        { "Fallback", "Repeat", 2000, 2000, 0 },
+        { "Fallback", "Consts", 5, 5, 0 },
+        { "Dispatch", "Call", 0, 3, 0 },
+        { "Dispatch", "Meth", 0, 3, 0 },
+        { "Literals", "Second", 0, 5, 0 },
+        { "Heap", "Churn", 20000, 20000, 0 },
+    };
+    for( int c = 0; c < 11; c++ )
+    {
+        MilInterpreter::Proc p = intp.resolve(calls[c].module, calls[c].proc);
+        for( int i = calls[c].from; i <= calls[c].to; i++ )
+        {
+            QVariantList args;
+            args << i;
+            if( calls[c].arg2 )
+                args << calls[c].arg2;
+            res += intp.call(p, args).toString().toUtf8() + intp.error().toUtf8() + " ";
+        }
+        res += intp.variable("Fused", "hits").toString().toUtf8() + "\n";
+    }
+    return res;
+}
+
+class Worker : public QThread
+{
+public:
+    Worker(MilLoader* loader, int engine):loader(loader),engine(engine) {}
+    QByteArray res;
+protected:
+    void run()
+    {
+        MilInterpreter intp(loader);
+        intp.setEngine(engines[engine].engine);
+        intp.setJit(engines[engine].jit);
+        res = workload(intp);
+    }
+private:
+    MilLoader* loader;
+    int engine;
+};
+
+static void runParallel(MilLoader* loader, int e)
+{
+    MilInterpreter intp(loader);
+    intp.setEngine(engines[e].engine);
+    intp.setJit(engines[e].jit);
+    const QByteArray expected = workload(intp);
+    check(intp, !expected.isEmpty() && !expected.contains("error"), "serial workload", expected);
+    // more threads than engines, and each one starts on the same modules at once
+    QList<Worker*> workers;
+    for( int i = 0; i < 4; i++ )
+        workers << new Worker(loader, e);
+    foreach( Worker* w, workers )
+        w->start();
+    foreach( Worker* w, workers )
+        w->wait();
+    for( int i = 0; i < workers.size(); i++ )
+    {
+        const bool same = workers[i]->res == expected;
+        check(intp, same, "parallel workload " + QByteArray::number(i), same ? QVariant() : workers[i]->res);
+    }
+    qDeleteAll(workers);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    MilLoader loader;
+    InMemRenderer r(&loader);
+    MilEmitter e(&r);
+    emitQuicken(e);
+    emitFused(e);
+    emitFallback(e);
+    emitDispatch(e);
+    emitLiterals(e);
+    emitHeap(e);
+    emitSizes(e);
+
+    for( int i = 0; i < 3; i++ )
+    {
+        engine = engines[i].name;
+        MilInterpreter intp(&loader);
+        intp.setEngine(engines[i].engine);
+        intp.setJit(engines[i].jit);
+        runQuicken(intp);
+        runFused(intp);
+        runFallback(intp);
+        runDispatch(intp);
+        runLiterals(intp);
+        runSizes(intp);
+    }
+    for( int i = 0; i < 3; i++ )
+    {
+        engine = engines[i].name;
+        runParallel(&loader, i);
+    }
+
+    if( failed )
+        qCritical() << failed << "checks failed";
+    else
+        qDebug() << "all checks passed";
+    return failed ? -1 : 0;
+}
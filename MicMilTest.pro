@@ -0,0 +1,22 @@
+QT       += core
+
+QT       -= gui
+
+TARGET = MilTest
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+DEFINES += _DEBUG
+
+include(MicParser.pri)
+
+SOURCES += \
+    MicMilTest.cpp \
+    MicMilInterpreter.cpp
+
+HEADERS += \
+    MicMilInterpreter.h
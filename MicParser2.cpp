@@ -3266,6 +3266,8 @@ Type* Parser2::ProcedureType() {
 	if( FIRST_FormalParameters(la.d_type) ) {
         ret = FormalParameters();
 	}
+    if( ret == 0 )
+        ret = mdl->getType(Type::NoType); // as FormalParameters does, e.g. for Coroutines.Body = PROCEDURE
     p->typebound = bound;
     p->subs = toList(mdl->closeScope(true));
     p->setType(ret);
@@ -3389,7 +3391,7 @@ void Parser2::ProcedureDeclaration() {
             if( procDecl->typebound )
                 error(cur, "EXTERN not supported for type-bound procedures");
             procDecl->extern_ = true;
-            out->beginProc(ev->toQuali(procDecl).second,mdl->getTopScope()->kind == Declaration::Module &&
+            out->beginProc(ev->toQuali(procDecl).second,procDecl->outer && procDecl->outer->kind == Declaration::Module &&
                            procDecl->visi > 0, MilProcedure::Extern);
 
             const QList<Declaration*> params = procDecl->getParams(true);
@@ -3428,7 +3430,7 @@ void Parser2::ProcedureDeclaration() {
             QByteArray binding;
             if( procDecl->typebound )
                 binding = ev->toQuali(procDecl->link->getType()->getType()).second; // receiver is always pointer to T
-            out->beginProc(ev->toQuali(procDecl).second,mdl->getTopScope()->kind == Declaration::Module &&
+            out->beginProc(ev->toQuali(procDecl).second,procDecl->outer && procDecl->outer->kind == Declaration::Module &&
                            procDecl->visi > 0, kind, binding);
 
             const QList<Declaration*> params = procDecl->getParams(true);
@@ -19,9 +19,11 @@
 
 #include "MicSymbol.h"
 #include <QHash>
+#include <QMutex>
 using namespace Mic;
 
 static QHash<QByteArray,QByteArray> d_symbols;
+static QMutex d_lock; // interpreters on different threads look up symbols too
 
 Symbol::Symbol()
 {
@@ -32,6 +34,7 @@ QByteArray Symbol::getSymbol(const QByteArray& str)
 {
     if( str.isEmpty() )
         return str;
+    QMutexLocker lock(&d_lock);
     QByteArray& sym = d_symbols[str];
     if( sym.isEmpty() )
         sym = str;
@@ -21,8 +21,10 @@
 #include "MilValidator.h"
 #include "MilProject.h"
 #include <QDateTime>
+#include <QSet>
 #include <QCoreApplication>
 #include <QtDebug>
+#include <algorithm>
 using namespace Mil;
 
 CeeGen::CeeGen(AstModel* mdl):mdl(mdl)
@@ -100,6 +102,10 @@ bool CeeGen::requiresBody(Declaration* module)
 
 void CeeGen::visitModule()
 {
+   if( curMod->name != "MIC$" )
+       hout << "#include \"" << Project::escapeFilename("MIC$") << ".h\"" << endl; // the intrinsics are never imported
+   else
+       objectRuntime(hout);
    Declaration* sub = curMod->subs;
    while( sub )
    {
@@ -123,11 +129,15 @@ void CeeGen::visitModule()
                hout << ";" << endl;
                Type* t = deref(sub->getType());
                if( t && t->kind == Type::Object )
+               {
+                   hout << "extern const struct MIC$Class " << qualident(sub) << "$class$;" << endl;
+                   classDesc(bout, sub);
                    foreach( Declaration* p, t->subs )
                    {
                        if( p->kind == Declaration::Procedure )
                            visitProcedure(p);
                    }
+               }
            }
            break;
        case Declaration::ConstDecl:
@@ -137,6 +147,7 @@ void CeeGen::visitModule()
            break;
        case Declaration::VarDecl:
            variable(bout, sub);
+           objectInit(bout, sub->getType());
            bout << ";" << endl << endl;
            hout << "extern ";
            variable(hout, sub);
@@ -198,6 +209,7 @@ void CeeGen::visitProcedure(Declaration* proc)
             {
                 bout << ws(0);
                 parameter(bout, sub);
+                objectInit(bout, sub->getType());
                 bout << ";" << endl;
             }
             sub = sub->next;
@@ -343,7 +355,10 @@ void CeeGen::typeDecl(QTextStream& out, Declaration* d)
             out << "}";
             break;
         case Type::Object:
-            out << "Object TODO";
+            out << "struct " << qualident(d) << " {" << endl;
+            out << "   const struct MIC$Class* class$;" << endl;
+            objectFields(out, t);
+            out << "}";
             break;
         case Type::NameRef:
             out << typeRef(t->getType());
@@ -352,6 +367,75 @@ void CeeGen::typeDecl(QTextStream& out, Declaration* d)
     out << " " << qualident(d);
 }
 
+void CeeGen::objectFields(QTextStream& out, Type* t)
+{
+    // the fields of the base types come first, so a pointer to an object is also a pointer to its bases
+    Type* base = t->getType() ? t->getType()->deref() : 0;
+    if( base && base->kind == Type::Object )
+        objectFields(out, base);
+    foreach( Declaration* field, t->subs )
+    {
+        if( field->kind == Declaration::Field )
+            out << "   " << typeRef(field->getType()) << " " << field->name << ";" << endl;
+    }
+}
+
+static QList<Declaration*> display(Type* t)
+{
+    // the object types from the root down to t
+    QList<Declaration*> res;
+    while( t && t->kind == Type::Object )
+    {
+        res.prepend(t->decl);
+        t = t->getType() ? t->getType()->deref() : 0;
+    }
+    return res;
+}
+
+void CeeGen::objectRuntime(QTextStream& out)
+{
+    // every header includes the one of MIC$, so the object descriptors are declared here;
+    // the display is padded to MIC$MAXEXT so an isinst is a single indexed compare
+    out << "#include <stdlib.h>" << endl << endl;
+    out << "#define MIC$MAXEXT " << MaxExtension << endl << endl;
+    out << "struct MIC$Class {" << endl;
+    out << "   const struct MIC$Class* display[MIC$MAXEXT];" << endl;
+    out << "};" << endl << endl;
+    out << "static inline void* MIC$$newobj(unsigned int size, const struct MIC$Class* cls) {" << endl;
+    out << "    const struct MIC$Class** obj = (const struct MIC$Class**)calloc(1, size);" << endl;
+    out << "    *obj = cls;" << endl;
+    out << "    return obj;" << endl;
+    out << "}" << endl << endl;
+    out << "static inline int MIC$$isinst(const void* obj, const struct MIC$Class* cls, int level) {" << endl;
+    out << "    return obj != NULL && (*(const struct MIC$Class* const*)obj)->display[level] == cls;" << endl;
+    out << "}" << endl << endl;
+}
+
+void CeeGen::classDesc(QTextStream& out, Declaration* type)
+{
+    const QList<Declaration*> d = display(deref(type->getType()));
+    if( d.size() > MaxExtension )
+    {
+        out << "#error \"" << qualident(type) << " has more than " << MaxExtension << " extension levels\"" << endl;
+        return;
+    }
+    out << "const struct MIC$Class " << qualident(type) << "$class$ = { {";
+    for( int i = 0; i < d.size(); i++ )
+    {
+        if( i != 0 )
+            out << ",";
+        out << " &" << qualident(d[i]) << "$class$";
+    }
+    out << " } };" << endl << endl;
+}
+
+void CeeGen::objectInit(QTextStream& out, Type* t)
+{
+    t = deref(t);
+    if( t->kind == Type::Object && t->decl )
+        out << " = { &" << qualident(t->decl) << "$class$ }";
+}
+
 void CeeGen::pointerTo(QTextStream& out, Type* ptr)
 {
     Type* to = ptr->getType();
@@ -425,6 +509,52 @@ void CeeGen::constValue(QTextStream& out, Constant* c)
     }
 }
 
+static void caseLabels(QTextStream& out, Expression* e, int level, QSet<qint64>& seen)
+{
+    // the labels are integers; consecutive labels are merged to a GCC case range;
+    // a label already used by a previous case is dropped, the first case matching wins
+    QList<qint64> l;
+    while(e)
+    {
+        if( !seen.contains(e->i) )
+        {
+            seen.insert(e->i);
+            l << e->i;
+        }
+        e = e->next;
+    }
+    std::sort(l.begin(), l.end());
+    for( int i = 0; i < l.size(); )
+    {
+        int j = i;
+        while( j + 1 < l.size() && l[j+1] <= l[j] + 1 )
+            j++;
+        out << ws(level) << "case " << l[i];
+        if( l[j] != l[i] )
+            out << " ... " << l[j];
+        out << ":" << endl;
+        i = j + 1;
+    }
+}
+
+void CeeGen::stringLit(QTextStream& out, ByteString* str)
+{
+    // ldstr in hex, as Micron emits it, is still a zero terminated string; octal escapes
+    // are used because a hex escape would swallow the digits following it
+    out << "\"";
+    for( int i = 0; i < str->len; i++ )
+    {
+        const quint8 ch = str->b[i];
+        if( ch == 0 && i == str->len - 1 )
+            break;
+        if( ch < ' ' || ch >= 127 || ch == '"' || ch == '\\' || ch == '?' )
+            out << '\\' << char('0' + ( ch >> 6 )) << char('0' + ( ( ch >> 3 ) & 7 )) << char('0' + ( ch & 7 ));
+        else
+            out << char(ch);
+    }
+    out << "\"";
+}
+
 void CeeGen::statementSeq(QTextStream& out, Statement* s, int level)
 {
     while(s)
@@ -471,33 +601,29 @@ void CeeGen::statementSeq(QTextStream& out, Statement* s, int level)
             break;
 
         case Tok_SWITCH:
-            out << ws(level) << "switch( ";
-            expression(out, s->args, level+1);
-            out << " ) {" << endl;
-            while( s->next && s->next->kind == Tok_CASE )
             {
-                s = s->next;
-                Expression* e = s->e;
-                while(e)
+                out << ws(level) << "switch( ";
+                expression(out, s->args, level+1);
+                out << " ) {" << endl;
+                QSet<qint64> seen;
+                while( s->next && s->next->kind == Tok_CASE )
                 {
-                    out << ws(level) << "case ";
-                    expression(out, e, level+1 );
-                    out << ":" << endl;
-                    e = e->next;
+                    s = s->next;
+                    caseLabels(out, s->e, level, seen);
+                    out << ws(level+1) << "{" << endl;
+                    statementSeq(out, s->body, level+2);
+                    out << ws(level+1) << "} break;" << endl;
                 }
-                out << ws(level+1) << "{" << endl;
-                statementSeq(out, s->body, level+2);
-                out << ws(level+1) << "} break;" << endl;
-            }
-            if( s->next && s->next->kind == Tok_ELSE )
-            {
-                s = s->next;
-                out << "default:" << endl;
-                out << ws(level+1) << "{" << endl;
-                statementSeq(out, s->body, level+2);
-                out << ws(level+1) << "} break;" << endl;
+                if( s->next && s->next->kind == Tok_ELSE )
+                {
+                    s = s->next;
+                    out << ws(level) << "default:" << endl;
+                    out << ws(level+1) << "{" << endl;
+                    statementSeq(out, s->body, level+2);
+                    out << ws(level+1) << "} break;" << endl;
+                }
+                out << ws(level) << "}" << endl;
             }
-            out << endl;
             break;
 
         case Tok_WHILE:
@@ -763,6 +889,11 @@ void CeeGen::expression(QTextStream& out, Expression* e, int level)
         break;
 
     case Tok_LDSTR:
+        if( e->c && e->c->kind == Constant::B )
+            stringLit(out, e->c->b);
+        else
+            constValue(out, e->c);
+        break;
     case Tok_LDOBJ:
         constValue(out, e->c);
         break;
@@ -938,9 +1069,15 @@ void CeeGen::expression(QTextStream& out, Expression* e, int level)
         out << "(";
         Q_ASSERT(e->getType()->kind == Type::Pointer);
         out << typeRef(e->d->getType());
-        out << "*)calloc(1, sizeof(";
-        out << typeRef(e->d->getType());
-        out << "))";
+        if( deref(e->d->getType())->kind == Type::Object )
+            out << "*)MIC$$newobj(sizeof(" << typeRef(e->d->getType()) << "), &"
+                << qualident(deref(e->d->getType())->decl) << "$class$)";
+        else
+        {
+            out << "*)calloc(1, sizeof(";
+            out << typeRef(e->d->getType());
+            out << "))";
+        }
         break;
 
     case Tok_NEWARR:
@@ -988,9 +1125,17 @@ void CeeGen::expression(QTextStream& out, Expression* e, int level)
         e = e->next; // skip ELSE
         break;
 
+    case Tok_ISINST:
+        {
+            Type* t = deref(e->d->getType());
+            out << "MIC$$isinst(";
+            expression(out, e->lhs, level+1);
+            out << ", &" << qualident(t->decl) << "$class$, " << display(t).size() - 1 << ")";
+        }
+        break;
+
     case Tok_SIZEOF:
     case Tok_NEWVLA:
-    case Tok_ISINST:
     case Tok_CALLVI:
     case Tok_CALLVIRT:
         out << "TODO: " << tokenTypeName(e->kind);
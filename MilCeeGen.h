@@ -43,7 +43,12 @@ namespace Mil
         void variable(QTextStream& out, Declaration* var);
         void typeDecl(QTextStream& out, Declaration* type);
         void pointerTo(QTextStream& out, Type* type);
+        void objectFields(QTextStream& out, Type* type);
+        void objectRuntime(QTextStream& out);
+        void classDesc(QTextStream& out, Declaration* type);
+        void objectInit(QTextStream& out, Type* type);
         void constValue(QTextStream& out, Constant* c);
+        void stringLit(QTextStream& out, ByteString* str);
         void statementSeq(QTextStream& out, Statement* s, int level = 0);
         void expression(QTextStream& out, Expression* e, int level = 0);
         void emitBinOP(QTextStream& out, Expression* e, const char* op, int level);
@@ -51,6 +56,7 @@ namespace Mil
         Type* deref(Type* t);
 
     private:
+        enum { MaxExtension = 16 };
         AstModel* mdl;
         QTextStream hout;
         QTextStream bout;
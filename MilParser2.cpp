@@ -1195,7 +1195,6 @@ void Parser2::MemberList() {
     foreach( Declaration* field, fields )
     {
         field->setType(t);
-        Q_ASSERT(field->outer == 0);
         field->outer = curDecl;
     }
 }
@@ -1266,6 +1265,7 @@ void Parser2::ProcedureDeclaration() {
         {
             p->typebound = true;
             scopeStack.pop_back();
+            tmp.subs = 0; // p is owned by the object type, not by the temporary scope
             Declaration* object = scopeStack.back()->findSubByName(receiver);
             if( object && object->getType() && object->getType()->kind != Type::Object )
                 error(tok, "binding doesn't reference an object type");
@@ -1861,9 +1861,10 @@ Expression* Parser2::ExpInstr() {
             Constant* c = new Constant();
             c->kind = Constant::B;
             c->b = new ByteString();
-            c->b->len = cur.d_val.size();
-            c->b->b = (unsigned char*)malloc(cur.d_val.size());
-            memcpy(c->b->b, cur.d_val.constData(), c->b->len);
+            const QByteArray bytes = QByteArray::fromHex(cur.d_val); // the lexer only collects the digits
+            c->b->len = bytes.size();
+            c->b->b = (unsigned char*)malloc(bytes.size());
+            memcpy(c->b->b, bytes.constData(), c->b->len);
             res->c = c;
         } else
             invalid("ExpInstr");
@@ -2266,9 +2267,10 @@ Constant* Parser2::ConstExpression() {
         Constant* c = new Constant();
         c->kind = Constant::B;
         c->b = new ByteString();
-        c->b->len = cur.d_val.size();
-        c->b->b = (unsigned char*)malloc(cur.d_val.size());
-        memcpy(c->b->b, cur.d_val.constData(), c->b->len);
+        const QByteArray bytes = QByteArray::fromHex(cur.d_val); // the lexer only collects the digits
+        c->b->len = bytes.size();
+        c->b->b = (unsigned char*)malloc(bytes.size());
+        memcpy(c->b->b, bytes.constData(), c->b->len);
         return c;
     } else
         invalid("ConstExpression");
@@ -2317,9 +2319,10 @@ Constant* Parser2::ConstExpression2() {
         Constant* c = new Constant();
         c->kind = Constant::B;
         c->b = new ByteString();
-        c->b->len = cur.d_val.size();
-        c->b->b = (unsigned char*)malloc(cur.d_val.size());
-        memcpy(c->b->b, cur.d_val.constData(), c->b->len);
+        const QByteArray bytes = QByteArray::fromHex(cur.d_val); // the lexer only collects the digits
+        c->b->len = bytes.size();
+        c->b->b = (unsigned char*)malloc(bytes.size());
+        memcpy(c->b->b, bytes.constData(), c->b->len);
         return c;
     } else
         invalid("ConstExpression2");
@@ -2340,9 +2343,10 @@ Constant* Parser2::constructor() {
         Constant* c = new Constant();
         c->kind = Constant::B;
         c->b = new ByteString();
-        c->b->len = cur.d_val.size();
-        c->b->b = (unsigned char*)malloc(cur.d_val.size());
-        memcpy(c->b->b, cur.d_val.constData(), c->b->len);
+        const QByteArray bytes = QByteArray::fromHex(cur.d_val); // the lexer only collects the digits
+        c->b->len = bytes.size();
+        c->b->b = (unsigned char*)malloc(bytes.size());
+        memcpy(c->b->b, bytes.constData(), c->b->len);
         return c;
     } else
         invalid("constructor");
@@ -682,7 +682,7 @@ Expression* Validator::visitExpr(Expression* e)
                 Type* lhsT = deref(e->lhs->getType());
                 Type* ot1 = deref(lhsT->getType());
                 if( lhsT->kind != Type::Pointer ||
-                        !(ot1->kind == Type::Struct || ot1->kind == Type::Union || ot1->kind != Type::Object) )
+                        !(ot1->kind == Type::Struct || ot1->kind == Type::Union || ot1->kind == Type::Object) )
                 {
                     error(e->pos, "expecting a pointer to struct, union or object on the stack");
                     break;
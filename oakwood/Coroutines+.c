@@ -0,0 +1,276 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Coroutines as green threads: Transfer saves the callee-saved registers on the stack of the running
+// coroutine and switches the stack pointer; x86-64 and AArch64 use a few instructions of assembly, the
+// other platforms fall back to fibers (Windows) or ucontext. Coroutine stacks are recycled.
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define _CO_ASM
+#ifdef __APPLE__
+#define _CO_SYM(x) "_" #x
+#else
+#define _CO_SYM(x) #x
+#endif
+// void Coroutines$switch(void** from, void* to)
+__asm__(
+    ".text\n"
+    ".globl " _CO_SYM(Coroutines$switch) "\n"
+    _CO_SYM(Coroutines$switch) ":\n"
+    "   pushq %rbp\n"
+    "   pushq %rbx\n"
+    "   pushq %r12\n"
+    "   pushq %r13\n"
+    "   pushq %r14\n"
+    "   pushq %r15\n"
+    "   movq %rsp, (%rdi)\n"
+    "   movq %rsi, %rsp\n"
+    "   popq %r15\n"
+    "   popq %r14\n"
+    "   popq %r13\n"
+    "   popq %r12\n"
+    "   popq %rbx\n"
+    "   popq %rbp\n"
+    "   ret\n"
+);
+#define _CO_SAVED 6 // registers below the return address
+#elif defined(__aarch64__) && !defined(_WIN32)
+#define _CO_ASM
+#ifdef __APPLE__
+#define _CO_SYM(x) "_" #x
+#else
+#define _CO_SYM(x) #x
+#endif
+__asm__(
+    ".text\n"
+    ".globl " _CO_SYM(Coroutines$switch) "\n"
+    _CO_SYM(Coroutines$switch) ":\n"
+    "   sub sp, sp, #160\n"
+    "   stp x19, x20, [sp, #0]\n"
+    "   stp x21, x22, [sp, #16]\n"
+    "   stp x23, x24, [sp, #32]\n"
+    "   stp x25, x26, [sp, #48]\n"
+    "   stp x27, x28, [sp, #64]\n"
+    "   stp x29, x30, [sp, #80]\n"
+    "   stp d8, d9, [sp, #96]\n"
+    "   stp d10, d11, [sp, #112]\n"
+    "   stp d12, d13, [sp, #128]\n"
+    "   stp d14, d15, [sp, #144]\n"
+    "   mov x2, sp\n"
+    "   str x2, [x0]\n"
+    "   mov sp, x1\n"
+    "   ldp x19, x20, [sp, #0]\n"
+    "   ldp x21, x22, [sp, #16]\n"
+    "   ldp x23, x24, [sp, #32]\n"
+    "   ldp x25, x26, [sp, #48]\n"
+    "   ldp x27, x28, [sp, #64]\n"
+    "   ldp x29, x30, [sp, #80]\n"
+    "   ldp d8, d9, [sp, #96]\n"
+    "   ldp d10, d11, [sp, #112]\n"
+    "   ldp d12, d13, [sp, #128]\n"
+    "   ldp d14, d15, [sp, #144]\n"
+    "   add sp, sp, #160\n"
+    "   ret\n"
+);
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+#ifdef _CO_ASM
+extern void Coroutines$switch(void** from, void* to);
+#endif
+
+typedef void (*Coroutines$Body)(void);
+
+typedef struct Coroutines$State {
+    const void* cor; // the Coroutine record, the key of the table
+    Coroutines$Body body;
+    char* stack; // 0 for the coroutine the program started with
+    size_t size;
+#if defined(_CO_ASM)
+    void* sp;
+#elif defined(_WIN32)
+    void* fiber;
+#else
+    ucontext_t ctx;
+#endif
+} Coroutines$State;
+
+// the states by the address of the Coroutine record, open addressing
+static Coroutines$State** table = 0;
+static size_t tableSize = 0, tableUsed = 0;
+static Coroutines$State* current = 0;
+// the stacks of reinitialized coroutines
+enum { PoolSize = 16, MinStack = 16 * 1024 };
+static char* pool[PoolSize];
+static size_t poolSizes[PoolSize];
+static int pooled = 0;
+
+static void fail(const char* msg)
+{
+    fprintf(stderr, "Coroutines: %s\n", msg);
+    abort();
+}
+
+static size_t slot(const void* cor, size_t size)
+{
+    size_t h = ((uintptr_t)cor >> 3) * 2654435761u;
+    return h & (size - 1);
+}
+
+static Coroutines$State* lookup(const void* cor, int create)
+{
+    if( tableSize == 0 || tableUsed * 2 >= tableSize )
+    {
+        const size_t oldSize = tableSize;
+        Coroutines$State** old = table;
+        size_t i;
+        tableSize = oldSize ? oldSize * 2 : 64;
+        table = (Coroutines$State**)calloc(tableSize, sizeof(Coroutines$State*));
+        if( table == 0 )
+            fail("out of memory");
+        for( i = 0; i < oldSize; i++ )
+        {
+            if( old[i] )
+            {
+                size_t j = slot(old[i]->cor, tableSize);
+                while( table[j] )
+                    j = (j + 1) & (tableSize - 1);
+                table[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t i = slot(cor, tableSize);
+    while( table[i] )
+    {
+        if( table[i]->cor == cor )
+            return table[i];
+        i = (i + 1) & (tableSize - 1);
+    }
+    if( !create )
+        fail("transfer to a coroutine which was not initialized");
+    table[i] = (Coroutines$State*)calloc(1, sizeof(Coroutines$State));
+    if( table[i] == 0 )
+        fail("out of memory");
+    table[i]->cor = cor;
+    tableUsed++;
+    return table[i];
+}
+
+static void release(Coroutines$State* s)
+{
+    if( s->stack == 0 )
+        return;
+    if( pooled < PoolSize )
+    {
+        pool[pooled] = s->stack;
+        poolSizes[pooled++] = s->size;
+    }else
+        free(s->stack);
+    s->stack = 0;
+    s->size = 0;
+}
+
+static void acquire(Coroutines$State* s, size_t size)
+{
+    int i;
+    for( i = 0; i < pooled; i++ )
+    {
+        if( poolSizes[i] >= size )
+        {
+            s->stack = pool[i];
+            s->size = poolSizes[i];
+            pool[i] = pool[--pooled];
+            poolSizes[i] = poolSizes[pooled];
+            return;
+        }
+    }
+    s->stack = (char*)malloc(size);
+    if( s->stack == 0 )
+        fail("out of memory");
+    s->size = size;
+}
+
+#if defined(_WIN32) && !defined(_CO_ASM)
+static void __stdcall start(void* arg)
+#else
+static void start(void)
+#endif
+{
+    current->body();
+    fail("the body of a coroutine must not end");
+}
+
+void Coroutines$Init(Coroutines$Body body, int stackSize, void* cor)
+{
+    Coroutines$State* s = lookup(cor, 1);
+    if( s == current )
+        fail("cannot initialize the running coroutine");
+    const size_t size = stackSize < MinStack ? MinStack : ((size_t)stackSize + 15) & ~(size_t)15;
+    s->body = body;
+#if defined(_CO_ASM)
+    if( s->stack && s->size < size )
+        release(s);
+    if( s->stack == 0 )
+        acquire(s, size);
+    {
+        // an initial frame as left by Coroutines$switch, which returns to start
+        void** top = (void**)(((uintptr_t)(s->stack + s->size)) & ~(uintptr_t)15);
+#if defined(__x86_64__)
+        *--top = 0; // the return address of start, so it is entered with the stack aligned as by a call
+        *--top = (void*)start;
+        for( int i = 0; i < _CO_SAVED; i++ )
+            *--top = 0;
+#else
+        top -= 20;
+        for( int i = 0; i < 20; i++ )
+            top[i] = 0;
+        top[11] = (void*)start; // x30
+#endif
+        s->sp = top;
+    }
+#elif defined(_WIN32)
+    if( s->fiber )
+        DeleteFiber(s->fiber);
+    s->fiber = CreateFiber(size, start, 0);
+    if( s->fiber == 0 )
+        fail("cannot create fiber");
+#else
+    if( s->stack && s->size < size )
+        release(s);
+    if( s->stack == 0 )
+        acquire(s, size);
+    getcontext(&s->ctx);
+    s->ctx.uc_stack.ss_sp = s->stack;
+    s->ctx.uc_stack.ss_size = s->size;
+    s->ctx.uc_link = 0;
+    makecontext(&s->ctx, start, 0);
+#endif
+}
+
+void Coroutines$Transfer(void* from, void* to_)
+{
+    Coroutines$State* t = lookup(to_, 0);
+    Coroutines$State* f = lookup(from, 1);
+    if( f == t )
+        return;
+    current = t;
+#if defined(_CO_ASM)
+    Coroutines$switch(&f->sp, t->sp);
+#elif defined(_WIN32)
+    if( f->fiber == 0 )
+        f->fiber = ConvertThreadToFiber(0);
+    SwitchToFiber(t->fiber);
+#else
+    swapcontext(&f->ctx, &t->ctx);
+#endif
+}
+
+void Coroutines$begin$()
+{
+}
@@ -98,8 +98,12 @@ void MIC$$strcopy(char* lhs,char* rhs)
 
 void MIC$$assert(uint8_t cond, uint32_t line, const char* file)
 {
-	if(cond)
-		fprintf(stderr,"assertion failed in %s line %d", file, line);
+	if(!cond)
+		fprintf(stderr,"assertion failed in %s line %d\n", file, line);
 	assert(cond);
 }
 
+uint32_t MIC$$strlen(const char* s)
+{
+	return strlen(s);
+}
@@ -0,0 +1,38 @@
+// the C side of Ffi.mic, build with: cc -shared -fPIC -o libFfi.so Ffi+.c
+// and run with: MicCompiler -r -L ./libFfi.so Ffi.mic
+
+#include <ctype.h>
+
+int Ffi$Add(int a, int b)
+{
+    return a + b;
+}
+
+double Ffi$Mix(int i, double x, float y)
+{
+    return i * x + y;
+}
+
+void Ffi$Twice(int* i)
+{
+    *i *= 2;
+}
+
+int Ffi$Sum(int* a, int n)
+{
+    int s = 0;
+    for( int i = 0; i < n; i++ )
+    {
+        s += a[i];
+        a[i] = -a[i];
+    }
+    return s;
+}
+
+int Ffi$Upper(char* str)
+{
+    int n = 0;
+    for( ; *str; str++, n++ )
+        *str = toupper((unsigned char)*str);
+    return n;
+}